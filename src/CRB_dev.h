@@ -22,6 +22,7 @@ typedef struct CRB_String_tag CRB_String;
 typedef struct CRB_Assoc_tag CRB_Assoc;
 typedef struct CRB_ParameterList_tag CRB_ParameterList;
 typedef struct CRB_Block_tag CRB_Block;
+typedef struct CRB_Executable_tag CRB_Executable;
 typedef struct CRB_FunctionDefinition_tag CRB_FunctionDefinition;
 typedef struct CRB_LocalEnvironment_tag CRB_LocalEnvironment;
 
@@ -99,6 +100,11 @@ struct CRB_FunctionDefinition_tag {
         struct {
             CRB_ParameterList   *parameter;
             CRB_Block           *block;
+            CRB_Executable      *executable;
+            int                 local_variable_count;
+            char                **local_variable;
+            int                 global_variable_count;
+            CRB_Boolean         is_capture_free;
         } crowbar_f;
         struct {
             CRB_NativeFunctionProc      *proc;
@@ -109,6 +115,18 @@ struct CRB_FunctionDefinition_tag {
 
 typedef struct CRB_Regexp_tag CRB_Regexp;
 
+typedef enum {
+    CRB_CONSTANT_PROPAGATION_PASS = 1,
+    CRB_CONSTANT_FOLDING_PASS,
+    CRB_DEAD_BRANCH_ELIMINATION_PASS,
+    CRB_UNUSED_EXPRESSION_ELIMINATION_PASS,
+    CRB_LOOP_OPTIMIZATION_PASS,
+    CRB_INLINE_EXPANSION_PASS,
+    CRB_TYPE_INFERENCE_PASS,
+    CRB_TAIL_CALL_PASS,
+    CRB_OPTIMIZE_PASS_COUNT_PLUS_1
+} CRB_OptimizePass;
+
 /* interface.c */
 CRB_FunctionDefinition *
 CRB_add_native_function(CRB_Interpreter *interpreter,
@@ -144,6 +162,14 @@ CRB_Value
 CRB_call_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                 int line_number, CRB_Object *obj, char *method_name,
                 int arg_count, CRB_Value *args);
+void CRB_get_member_cache_statistics(CRB_Interpreter *inter,
+                                     long *hit_count, long *miss_count);
+
+/* optimize.c */
+void CRB_set_optimize_pass(CRB_Interpreter *inter, CRB_OptimizePass pass,
+                           CRB_Boolean enabled);
+int CRB_get_optimize_statistics(CRB_Interpreter *inter,
+                                CRB_OptimizePass pass);
 
 /* heap.c */
 CRB_Object *
@@ -155,6 +181,9 @@ CRB_Object *CRB_create_assoc(CRB_Interpreter *inter,
                              CRB_LocalEnvironment *env);
 void CRB_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *v);
 void CRB_array_resize(CRB_Interpreter *inter, CRB_Object *obj, int new_size);
+void CRB_array_reserve(CRB_Interpreter *inter, CRB_Object *obj,
+                       int alloc_size);
+void CRB_array_shrink_to_fit(CRB_Interpreter *inter, CRB_Object *obj);
 void CRB_array_insert(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                       CRB_Object *obj, int pos,
                       CRB_Value *v, int line_number);
@@ -189,6 +218,11 @@ CRB_NativePointerInfo *CRB_get_native_pointer_type(CRB_Object *native_pointer);
 CRB_Object *CRB_create_exception(CRB_Interpreter *inter,
                                  CRB_LocalEnvironment *env,
                                  CRB_Object *message, int line_number);
+/* 0 makes full collections stop the world until they finish. */
+void CRB_set_gc_pause_budget(CRB_Interpreter *inter, long usec);
+
+/* symbol.c */
+char *CRB_intern(CRB_Interpreter *inter, char *name);
 
 /* util.c */
 CRB_FunctionDefinition *CRB_search_function(CRB_Interpreter *inter,
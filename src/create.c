@@ -14,6 +14,11 @@ create_function_definition(char *identifier, CRB_ParameterList *parameter_list,
     f->is_closure = is_closure;
     f->u.crowbar_f.parameter = parameter_list;
     f->u.crowbar_f.block = block;
+    f->u.crowbar_f.executable = NULL;
+    f->u.crowbar_f.local_variable_count = -1;
+    f->u.crowbar_f.local_variable = NULL;
+    f->u.crowbar_f.global_variable_count = 0;
+    f->u.crowbar_f.is_capture_free = CRB_FALSE;
 
     return f;
 }
@@ -34,8 +39,7 @@ crb_function_define(char *identifier, CRB_ParameterList *parameter_list,
     f = create_function_definition(identifier, parameter_list, CRB_FALSE,
                                    block);
     inter = crb_get_current_interpreter();
-    f->next = inter->function_list;
-    inter->function_list = f;
+    crb_add_function(inter, f);
 }
 
 CRB_ParameterList *
@@ -224,6 +228,7 @@ crb_create_binary_expression(ExpressionType operator,
         exp = crb_alloc_expression(operator);
         exp->u.binary_expression.left = left;
         exp->u.binary_expression.right = right;
+        exp->u.binary_expression.quickening = BINARY_NOT_QUICKENED;
         return exp;
     }
 }
@@ -266,6 +271,7 @@ crb_create_index_expression(Expression *array, Expression *index)
     exp = crb_alloc_expression(INDEX_EXPRESSION);
     exp->u.index_expression.array = array;
     exp->u.index_expression.index = index;
+    exp->u.index_expression.is_in_bounds = CRB_FALSE;
 
     return exp;
 }
@@ -277,6 +283,7 @@ crb_create_incdec_expression(Expression *operand, ExpressionType inc_or_dec)
 
     exp = crb_alloc_expression(inc_or_dec);
     exp->u.inc_dec.operand = operand;
+    exp->u.inc_dec.is_local_int = CRB_FALSE;
 
     return exp;
 }
@@ -287,7 +294,13 @@ crb_create_identifier_expression(char *identifier)
     Expression  *exp;
 
     exp = crb_alloc_expression(IDENTIFIER_EXPRESSION);
-    exp->u.identifier = identifier;
+    exp->u.identifier.name = identifier;
+    exp->u.identifier.depth = -1;
+    exp->u.identifier.index = 0;
+    exp->u.identifier.global_index = -1;
+    exp->u.identifier.global_variable = NULL;
+    exp->u.identifier.function = NULL;
+    exp->u.identifier.function_version = 0;
 
     return exp;
 }
@@ -301,6 +314,10 @@ crb_create_function_call_expression(Expression *function,
     exp = crb_alloc_expression(FUNCTION_CALL_EXPRESSION);
     exp->u.function_call_expression.function = function;
     exp->u.function_call_expression.argument = argument;
+    exp->u.function_call_expression.fake_method_index = -1;
+    exp->u.function_call_expression.is_array_size = CRB_FALSE;
+    exp->u.function_call_expression.inline_function = NULL;
+    exp->u.function_call_expression.inline_body = NULL;
 
     return exp;
 }
@@ -313,6 +330,9 @@ crb_create_member_expression(Expression *expression, char *member_name)
     exp = crb_alloc_expression(MEMBER_EXPRESSION);
     exp->u.member_expression.expression = expression;
     exp->u.member_expression.member_name = member_name;
+    exp->u.member_expression.cache.entry_count = 0;
+    exp->u.member_expression.cache.hit_count = 0;
+    exp->u.member_expression.cache.miss_count = 0;
 
     return exp;
 }
@@ -394,6 +414,8 @@ crb_create_global_identifier(char *identifier)
 
     i_list = crb_malloc(sizeof(IdentifierList));
     i_list->name = identifier;
+    i_list->global_index = -1;
+    i_list->global_variable = NULL;
     i_list->next = NULL;
 
     return i_list;
@@ -490,9 +512,15 @@ crb_create_foreach_statement(char *label, char *variable,
 
     st = alloc_statement(FOREACH_STATEMENT);
     st->u.foreach_s.label = label;
-    st->u.foreach_s.variable = variable;
+    st->u.foreach_s.variable.name = variable;
+    st->u.foreach_s.variable.depth = -1;
+    st->u.foreach_s.variable.index = 0;
+    st->u.foreach_s.variable.global_index = -1;
+    st->u.foreach_s.variable.global_variable = NULL;
+    st->u.foreach_s.variable.function = NULL;
+    st->u.foreach_s.variable.function_version = 0;
     st->u.foreach_s.collection = collection;
-    st->u.for_s.block = block;
+    st->u.foreach_s.block = block;
 
     return st;
 }
@@ -526,6 +554,7 @@ crb_create_return_statement(Expression *expression)
 
     st = alloc_statement(RETURN_STATEMENT);
     st->u.return_s.return_value = expression;
+    st->u.return_s.is_tail_call = CRB_FALSE;
 
     return st;
 }
@@ -561,7 +590,13 @@ crb_create_try_statement(CRB_Block *try_block, char *exception,
     st = alloc_statement(TRY_STATEMENT);
     st->u.try_s.try_block = try_block;
     st->u.try_s.catch_block = catch_block;
-    st->u.try_s.exception = exception;
+    st->u.try_s.exception.name = exception;
+    st->u.try_s.exception.depth = -1;
+    st->u.try_s.exception.index = 0;
+    st->u.try_s.exception.global_index = -1;
+    st->u.try_s.exception.global_variable = NULL;
+    st->u.try_s.exception.function = NULL;
+    st->u.try_s.exception.function_version = 0;
     st->u.try_s.finally_block = finally_block;
 
     return st;
@@ -14,8 +14,25 @@
 #define MESSAGE_ARGUMENT_MAX    (256)
 #define LINE_BUF_SIZE           (1024)
 #define STACK_ALLOC_SIZE        (256)
-#define ARRAY_ALLOC_SIZE        (256)
+#ifndef ARRAY_GROWTH_FACTOR
+#define ARRAY_GROWTH_FACTOR     (2)
+#endif
 #define HEAP_THRESHOLD_SIZE     (1024 * 256)
+#ifndef HEAP_NURSERY_SIZE
+#define HEAP_NURSERY_SIZE       (1024 * 128)
+#endif
+#define REMEMBERED_SET_ALLOC_SIZE       (256)
+#define HEAP_SLICE_SIZE         (1024 * 16)
+#define GRAY_LIST_ALLOC_SIZE    (256)
+#define GC_SLICE_CHECK_COUNT    (64)
+#define GC_ARRAY_CHUNK_SIZE     (256)
+#ifndef GC_PAUSE_BUDGET
+#define GC_PAUSE_BUDGET         (1000)
+#endif
+#define OBJECT_PAGE_SIZE        (256)
+#define SHARED_SHAPE_MEMBER_MAX (64)
+#define MEMBER_CACHE_SIZE       (4)
+#define ASSOC_ALLOC_SIZE        (4)
 #define LONGJMP_ARG             (1)
 #define REGEXP_GROUP_INDEX_MAX_COLUMN  (3)
 
@@ -78,6 +95,7 @@ typedef enum {
     ARRAY_RESIZE_ARGUMENT_ERR,
     ARRAY_INSERT_ARGUMENT_ERR,
     ARRAY_REMOVE_ARGUMENT_ERR,
+    ARRAY_RESERVE_ARGUMENT_ERR,
     STRING_POS_OUT_OF_BOUNDS_ERR,
     STRING_SUBSTR_LEN_ERR,
     STRING_SUBSTR_ARGUMENT_ERR,
@@ -139,6 +157,7 @@ typedef enum {
     INCREMENT_EXPRESSION,
     DECREMENT_EXPRESSION,
     CLOSURE_EXPRESSION,
+    INLINE_PARAMETER_EXPRESSION,
     EXPRESSION_TYPE_COUNT_PLUS_1
 } ExpressionType;
 
@@ -184,14 +203,40 @@ typedef struct {
     Expression  *operand;
 } AssignExpression;
 
+/*
+ * The operand types a binary expression was specialized for by its
+ * first evaluation, or by the type inference of optimize.c.
+ * A failed type guard makes it BINARY_GENERIC.
+ */
+typedef enum {
+    BINARY_NOT_QUICKENED = 1,
+    BINARY_INT_INT,
+    BINARY_DOUBLE_DOUBLE,
+    BINARY_STRING_CONCAT,
+    BINARY_GENERIC
+} BinaryQuickening;
+
 typedef struct {
     Expression  *left;
     Expression  *right;
+    BinaryQuickening    quickening;
 } BinaryExpression;
 
+/*
+ * fake_method_index caches the entry of the fake method table
+ * the call last dispatched to, -1 if none.
+ * is_array_size marks a size() call in a loop condition,
+ * which reads the size of an array directly (see optimize.c).
+ * inline_function is the function whose body inline_body substitutes,
+ * when the callee turns out to be it at runtime.
+ */
 typedef struct {
     Expression          *function;
     ArgumentList        *argument;
+    int                 fake_method_index;
+    CRB_Boolean         is_array_size;
+    CRB_FunctionDefinition      *inline_function;
+    Expression          *inline_body;
 } FunctionCallExpression;
 
 typedef struct ExpressionList_tag {
@@ -199,24 +244,74 @@ typedef struct ExpressionList_tag {
     struct ExpressionList_tag   *next;
 } ExpressionList;
 
+/*
+ * is_in_bounds is set when the optimizer has proven the index
+ * to be an int within the array, if the operand is an array.
+ */
 typedef struct {
     Expression  *array;
     Expression  *index;
+    CRB_Boolean is_in_bounds;
 } IndexExpression;
 
+typedef struct Shape_tag Shape;
+
+/*
+ * Inline cache of a member expression: the member index for each
+ * shared shape seen at the site. When the member is not in the shape,
+ * new_shape is the shape an assignment to the member moves the assoc to.
+ */
+typedef struct {
+    Shape       *shape;
+    int         index;
+    Shape       *new_shape;
+} MemberCacheEntry;
+
+typedef struct {
+    int                 entry_count;
+    MemberCacheEntry    entry[MEMBER_CACHE_SIZE];
+    long                hit_count;
+    long                miss_count;
+} MemberCache;
+
 typedef struct {
     Expression          *expression;
     char                *member_name;
+    MemberCache         cache;
 } MemberExpression;
 
+/*
+ * is_local_int is set when the optimizer has proven the operand
+ * to be a defined, non-final local variable holding an int.
+ */
 typedef struct {
     Expression  *operand;
+    CRB_Boolean is_local_int;
 } IncrementOrDecrement;
 
 typedef struct {
     CRB_FunctionDefinition *function_definition;
 } ClosureExpression;
 
+/*
+ * depth and index locate the frame slot found by crb_resolve_variables().
+ * depth is -1 when the identifier is not a local variable.
+ * global_index is the index of the name among the global statements
+ * of the function, -1 if none declares it.
+ * global_variable caches the global variable at the top level.
+ * function caches the function the identifier was found to be,
+ * valid while function_version matches the interpreter's.
+ */
+typedef struct {
+    char        *name;
+    int         depth;
+    int         index;
+    int         global_index;
+    struct Variable_tag         *global_variable;
+    CRB_FunctionDefinition      *function;
+    long        function_version;
+} IdentifierExpression;
+
 struct CRB_Regexp_tag {
     CRB_Boolean is_literal;
     regex_t     *regexp;
@@ -232,7 +327,7 @@ struct Expression_tag {
         double                  double_value;
         CRB_Char                *string_value;
         CRB_Regexp              *regexp_value;
-        char                    *identifier;
+        IdentifierExpression    identifier;
         CommaExpression         comma;
         AssignExpression        assign_expression;
         BinaryExpression        binary_expression;
@@ -244,6 +339,7 @@ struct Expression_tag {
         IndexExpression         index_expression;
         IncrementOrDecrement    inc_dec;
         ClosureExpression       closure;
+        int                     inline_parameter;
     } u;
 };
 
@@ -258,8 +354,14 @@ struct CRB_Block_tag {
     StatementList       *statement_list;
 };
 
+/*
+ * An identifier of a global statement. global_variable is searched
+ * at the first execution; global variables are never removed.
+ */
 typedef struct IdentifierList_tag {
     char        *name;
+    int         global_index;
+    struct Variable_tag         *global_variable;
     struct IdentifierList_tag   *next;
 } IdentifierList;
 
@@ -296,13 +398,18 @@ typedef struct {
 
 typedef struct {
     char        *label;
-    char        *variable;
+    IdentifierExpression        variable;
     Expression  *collection;
     CRB_Block   *block;
 } ForeachStatement;
 
+/*
+ * is_tail_call is set by the optimizer when return_value is a call
+ * that can reuse the local environment of the returning function.
+ */
 typedef struct {
     Expression *return_value;
+    CRB_Boolean is_tail_call;
 } ReturnStatement;
 
 typedef struct {
@@ -316,7 +423,7 @@ typedef struct {
 typedef struct {
     CRB_Block   *try_block;
     CRB_Block   *catch_block;
-    char        *exception;
+    IdentifierExpression        exception;
     CRB_Block   *finally_block;
 } TryStatement;
 
@@ -374,22 +481,140 @@ typedef enum {
     RETURN_STATEMENT_RESULT,
     BREAK_STATEMENT_RESULT,
     CONTINUE_STATEMENT_RESULT,
+    TAIL_CALL_STATEMENT_RESULT,
     STATEMENT_RESULT_TYPE_COUNT_PLUS_1
 } StatementResultType;
 
+/*
+ * For a TAIL_CALL_STATEMENT_RESULT, the function and the arguments
+ * of the call are left on the top of the stack.
+ */
 typedef struct {
     StatementResultType type;
     union {
         CRB_Value       return_value;
         char            *label;
+        struct {
+            Expression  *expression;
+            int         argument_count;
+        } tail_call;
     } u;
 } StatementResult;
 
-typedef struct GlobalVariableRef_tag {
-    char        *name;
-    Variable    *variable;
-    struct GlobalVariableRef_tag *next;
-} GlobalVariableRef;
+typedef enum {
+    PUSH_BOOLEAN_OP = 1,
+    PUSH_INT_OP,
+    PUSH_DOUBLE_OP,
+    PUSH_STRING_OP,
+    PUSH_REGEXP_OP,
+    PUSH_NULL_OP,
+    PUSH_IDENTIFIER_OP,
+    PUSH_CLOSURE_OP,
+    POP_OP,
+    ASSIGN_IDENTIFIER_OP,
+    ASSIGN_MEMBER_OP,
+    ASSIGN_INDEX_OP,
+    NOT_LVALUE_OP,
+    ADD_OP,
+    SUB_OP,
+    MUL_OP,
+    DIV_OP,
+    MOD_OP,
+    EQ_OP,
+    NE_OP,
+    GT_OP,
+    GE_OP,
+    LT_OP,
+    LE_OP,
+    LOGICAL_AND_OP,
+    LOGICAL_OR_OP,
+    LOGICAL_RESULT_OP,
+    MINUS_OP,
+    LOGICAL_NOT_OP,
+    CALL_OP,
+    MEMBER_OP,
+    INDEX_OP,
+    NEW_ARRAY_OP,
+    INC_DEC_IDENTIFIER_OP,
+    INC_DEC_MEMBER_OP,
+    INC_DEC_INDEX_OP,
+    JUMP_OP,
+    JUMP_IF_FALSE_OP,
+    GLOBAL_OP,
+    FOREACH_ITERATOR_OP,
+    FOREACH_INIT_OP,
+    FOREACH_IS_DONE_OP,
+    FOREACH_CURRENT_ITEM_OP,
+    FOREACH_NEXT_OP,
+    CATCH_OP,
+    RETHROW_OP,
+    THROW_OP,
+    RETURN_OP,
+    LEAVE_OP,
+    BINARY_INT_OP,
+    BINARY_DOUBLE_OP,
+    CONCAT_STRING_OP,
+    ARRAY_SIZE_OP,
+    INLINE_ENTER_OP,
+    INLINE_PARAMETER_OP,
+    INLINE_LEAVE_OP,
+    INC_DEC_LOCAL_INT_OP,
+    TAIL_CALL_OP,
+    OPCODE_COUNT_PLUS_1
+} OpCode;
+
+/*
+ * An opcode is followed by its operands in the same array.
+ * Pointer operands refer to the AST node the instruction came from.
+ */
+typedef union {
+    OpCode      opcode;
+    int         int_value;
+    double      double_value;
+    void        *pointer;
+} Code;
+
+typedef struct {
+    int         start_pc;
+    int         end_pc;
+    int         handler_pc;
+    int         stack_depth;
+} TryRegion;
+
+struct CRB_Executable_tag {
+    int         code_size;
+    Code        *code;
+    int         try_region_count;
+    TryRegion   *try_region;
+    int         need_stack_size;
+};
+
+typedef enum {
+    BYTE_CODE_EXECUTE_MODE = 1,
+    AST_WALK_EXECUTE_MODE
+} ExecuteMode;
+
+typedef struct {
+    CRB_Boolean is_enabled[CRB_OPTIMIZE_PASS_COUNT_PLUS_1];
+    int         rewrite_count[CRB_OPTIMIZE_PASS_COUNT_PLUS_1];
+} OptimizeSetting;
+
+/*
+ * An inlined function being executed in env. Its arguments are on
+ * the stack from base.
+ */
+typedef struct {
+    CRB_FunctionDefinition      *function;
+    CRB_LocalEnvironment        *env;
+    int                         caller_line_number;
+    int                         base;
+} InlineFrame;
+
+typedef struct {
+    int         frame_count;
+    int         frame_alloc_size;
+    InlineFrame *frame;
+} InlineFrameStack;
 
 typedef struct RefInNativeFunc_tag {
     CRB_Object  *object;
@@ -400,7 +625,8 @@ struct CRB_LocalEnvironment_tag {
     char                *current_function_name;
     int                 caller_line_number;
     CRB_Object          *variable;      /* ScopeChain */
-    GlobalVariableRef   *global_variable;
+    Variable            **global_variable;
+    int                 global_variable_alloc_size;
     RefInNativeFunc     *ref_in_native_method;
     struct CRB_LocalEnvironment_tag     *next;
 };
@@ -411,12 +637,95 @@ typedef struct {
     CRB_Value   *stack;
 } Stack;
 
+typedef struct ObjectPage_tag ObjectPage;
+
+typedef struct {
+    CRB_Object  *object;
+    int         index;  /* next element of a large array */
+} GrayEntry;
+
+/*
+ * Objects are allocated in the nursery, and the survivors of a collection
+ * are promoted to the old generation, which only a full collection sweeps.
+ * The remembered set holds the old objects that may refer to young ones.
+ * A full collection marks the heap incrementally, spending at most
+ * pause_budget microseconds (0 for no limit) on each slice. Then
+ * the pages are swept lazily, as the allocation needs a free slot
+ * and a slice at a time. gc_epoch counts the full collections.
+ */
 typedef struct {
     int         current_heap_size;
     int         current_threshold;
-    CRB_Object  *header;
+    int         nursery_threshold;
+    int         slice_threshold;
+    ObjectPage  *page;
+    ObjectPage  *free_page;     /* pages with a free slot */
+    ObjectPage  *young_page;    /* pages with a young object */
+    int         remembered_count;
+    int         remembered_alloc_size;
+    CRB_Object  **remembered;
+    CRB_Boolean is_marking;
+    CRB_Boolean is_sweeping;
+    int         gc_epoch;
+    ObjectPage  **sweep_link;   /* link to the next page to sweep */
+    long        pause_budget;
+    int         gray_count;
+    int         gray_alloc_size;
+    GrayEntry   *gray;
 } Heap;
 
+typedef struct {
+    char        *name;
+    CRB_Boolean is_final;
+    Shape       *shape;
+} ShapeTransition;
+
+/*
+ * The member layout of assocs. Assocs which got the same members in the
+ * same order share a shape. An assoc with many members gets a shape of
+ * its own, which is not shared and has a hash index of the members.
+ */
+struct Shape_tag {
+    int                 member_count;
+    int                 alloc_size;
+    char                **member_name;
+    CRB_Boolean         *is_final;
+    CRB_Boolean         is_shared;
+    int                 hash_size;
+    int                 *hash_index;
+    int                 transition_count;
+    ShapeTransition     *transition;
+    Shape               *next;
+};
+
+typedef struct Symbol_tag {
+    char                *name;
+    unsigned int        hash_value;
+    struct Symbol_tag   *next;
+} Symbol;
+
+typedef struct {
+    int         bucket_size;
+    int         symbol_count;
+    Symbol      **bucket;
+} SymbolTable;
+
+typedef struct {
+    int         size;
+    int         count;
+    CRB_FunctionDefinition      **entry;
+} FunctionTable;
+
+/*
+ * Environments and scope chains of returned functions, kept for reuse
+ * by the next call. A scope chain captured by a closure is left to the GC.
+ */
+typedef struct {
+    CRB_LocalEnvironment        *environment;
+    CRB_Object                  *scope_chain;
+    RefInNativeFunc             *ref_in_native_method;
+} FramePool;
+
 typedef struct {
     jmp_buf     environment;
 } RecoveryEnvironment;
@@ -432,16 +741,29 @@ struct CRB_Interpreter_tag {
     MEM_Storage         execute_storage;
     Variable            *variable;
     CRB_FunctionDefinition      *function_list;
+    FunctionTable       function_table;
+    long                function_version;
     StatementList       *statement_list;
     int                 current_line_number;
     Stack               stack;
     Heap                heap;
+    FramePool           frame_pool;
+    SymbolTable         symbol_table;
+    Shape               *empty_shape;
+    Shape               *shape_list;
+    long                member_cache_hit_count;
+    long                member_cache_miss_count;
+    char                **fake_method_name;
     CRB_LocalEnvironment        *top_environment;
     CRB_Value           current_exception;
     RecoveryEnvironment current_recovery_environment;
     CRB_InputMode       input_mode;
     CRB_Regexp          *regexp_literals;
     Encoding            source_encoding;
+    ExecuteMode         execute_mode;
+    OptimizeSetting     optimize;
+    InlineFrameStack    inline_frame;
+    CRB_Executable      *executable;
 };
 
 struct CRB_Array_tag {
@@ -455,19 +777,26 @@ struct CRB_String_tag {
     CRB_Char    *string;
 };
 
-typedef struct {
-    char        *name;
-    CRB_Value   value;
-    CRB_Boolean is_final;
-} AssocMember;
-
 struct CRB_Assoc_tag {
-    int         member_count;
-    AssocMember *member;
+    Shape       *shape;
+    int         alloc_size;
+    CRB_Value   *value;
 };
 
 typedef struct {
-    CRB_Object  *frame; /* CRB_Assoc */
+    CRB_Boolean is_defined;
+    CRB_Boolean is_final;
+    CRB_Value   value;
+} Slot;
+
+typedef struct {
+    int         slot_count;
+    int         slot_alloc_size;
+    char        **slot_name;
+    Slot        *slot;
+    CRB_Boolean is_captured;
+    CRB_Boolean is_in_heap;
+    CRB_Object  *frame; /* CRB_Assoc, created on demand */
     CRB_Object  *next;  /* ScopeChain */
 } ScopeChain;
 
@@ -492,16 +821,36 @@ typedef enum {
 
 struct CRB_Object_tag {
     ObjectType  type;
-    unsigned int        marked:1;
+    unsigned int        is_old:1;
+    unsigned int        is_remembered:1;
     union {
         CRB_Array       array;
         CRB_String      string;
         CRB_Assoc       assoc;
         ScopeChain      scope_chain;
         NativePointer   native_pointer;
+        struct CRB_Object_tag *next_free;
     } u;
-    struct CRB_Object_tag *prev;
-    struct CRB_Object_tag *next;
+    ObjectPage  *page;
+};
+
+/*
+ * Objects are allocated from pages. The in_heap and mark bitmaps have
+ * a bit for each slot of the page. A slot not in the heap is free
+ * or holds the scope chain of a capture-free function.
+ */
+struct ObjectPage_tag {
+    int         used_count;
+    int         unused_index;
+    CRB_Object  *free_object;
+    CRB_Boolean is_young;
+    int         sweep_epoch;
+    unsigned char       in_heap[OBJECT_PAGE_SIZE / 8];
+    unsigned char       mark[OBJECT_PAGE_SIZE / 8];
+    struct ObjectPage_tag       *next;
+    struct ObjectPage_tag       *next_free;
+    struct ObjectPage_tag       *next_young;
+    CRB_Object  object[OBJECT_PAGE_SIZE];
 };
 
 typedef struct {
@@ -585,17 +934,111 @@ CRB_Char *crb_close_string_literal(void);
 void crb_set_regexp_start_char(char ch);
 char crb_regexp_start_char(void);
 
+/* symbol.c */
+void crb_init_symbol_table(CRB_Interpreter *inter);
+void crb_dispose_symbol_table(CRB_Interpreter *inter);
+char *crb_search_symbol(CRB_Interpreter *inter, char *name);
+
 /* execute.c */
+void crb_execute_global_statement(CRB_Interpreter *inter,
+                                  CRB_LocalEnvironment *env,
+                                  Statement *statement);
+CRB_Value *crb_assign_to_variable(CRB_Interpreter *inter,
+                                  CRB_LocalEnvironment *env,
+                                  int line_number,
+                                  IdentifierExpression *variable,
+                                  CRB_Value *value);
 StatementResult
 crb_execute_statement_list(CRB_Interpreter *inter,
                            CRB_LocalEnvironment *env, StatementList *list);
 
+/* resolve.c */
+void crb_resolve_variables(CRB_Interpreter *inter);
+
+/* optimize.c */
+void crb_init_optimize_setting(CRB_Interpreter *inter);
+void crb_optimize(CRB_Interpreter *inter, StatementList *last_statement,
+                  CRB_FunctionDefinition *last_function);
+
+/* generate.c */
+void crb_generate_code(CRB_Interpreter *inter);
+
+/* vm.c */
+OpCode crb_binary_opcode(Expression *expr);
+StatementResult crb_execute_byte_code(CRB_Interpreter *inter,
+                                      CRB_LocalEnvironment *env,
+                                      CRB_Executable *exe);
+
 /* eval.c */
+void crb_intern_fake_method_names(CRB_Interpreter *inter);
+void crb_unwind_local_environment(CRB_Interpreter *inter,
+                                  CRB_LocalEnvironment *env);
 int crb_get_stack_pointer(CRB_Interpreter *inter);
 void crb_set_stack_pointer(CRB_Interpreter *inter, int stack_pointer);
+void crb_eval_identifier(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *expr);
 CRB_Value *crb_get_identifier_lvalue(CRB_Interpreter *inter,
                                      CRB_LocalEnvironment *env,
-                                     int line_number, char *identifier);
+                                     int line_number,
+                                     IdentifierExpression *identifier);
+CRB_Value *crb_get_array_element_lvalue(CRB_Interpreter *inter,
+                                        CRB_LocalEnvironment *env,
+                                        Expression *expr);
+CRB_Value *crb_get_member_lvalue(CRB_Interpreter *inter,
+                                 CRB_LocalEnvironment *env,
+                                 Expression *expr);
+void crb_assign_to_identifier(CRB_Interpreter *inter,
+                              CRB_LocalEnvironment *env, Expression *expr);
+void crb_assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          Expression *expr);
+void crb_assign_to_array_element(CRB_Interpreter *inter,
+                                 CRB_LocalEnvironment *env, Expression *expr);
+void crb_binary_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          ExpressionType operator,
+                          Expression *left, Expression *right);
+void crb_minus_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *operand);
+void crb_logical_not_operation(CRB_Interpreter *inter,
+                               CRB_LocalEnvironment *env,
+                               Expression *operand);
+void crb_member_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          Expression *expr);
+void crb_inc_dec_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                           Expression *expr, CRB_Value *operand);
+void crb_inc_dec_local_int_operation(CRB_Interpreter *inter,
+                                     CRB_LocalEnvironment *env,
+                                     Expression *expr);
+BinaryQuickening crb_quicken_binary_expression(CRB_Interpreter *inter,
+                                               Expression *expr);
+CRB_Boolean crb_binary_int_operation(CRB_Interpreter *inter,
+                                     CRB_LocalEnvironment *env,
+                                     Expression *expr);
+CRB_Boolean crb_binary_double_operation(CRB_Interpreter *inter,
+                                        CRB_LocalEnvironment *env,
+                                        Expression *expr);
+CRB_Boolean crb_concat_string_operation(CRB_Interpreter *inter,
+                                        CRB_LocalEnvironment *env,
+                                        Expression *expr);
+CRB_Boolean crb_is_native_iterable(CRB_Value *collection);
+CRB_Boolean crb_foreach_is_done(CRB_Object *collection, int index);
+void crb_foreach_current_item(CRB_Interpreter *inter, CRB_Object *collection,
+                              int index, CRB_Value *item);
+void crb_call_function_on_stack(CRB_Interpreter *inter,
+                                CRB_LocalEnvironment *env,
+                                int line_number, int arg_count);
+void crb_call_function_expression(CRB_Interpreter *inter,
+                                  CRB_LocalEnvironment *env,
+                                  Expression *expr, int arg_count);
+void crb_array_size_operation(CRB_Interpreter *inter,
+                              CRB_LocalEnvironment *env, Expression *expr);
+StatementResult crb_eval_tail_call(CRB_Interpreter *inter,
+                                   CRB_LocalEnvironment *env,
+                                   Expression *expr);
+CRB_Boolean crb_enter_inline_function(CRB_Interpreter *inter,
+                                      CRB_LocalEnvironment *env,
+                                      Expression *expr, int arg_count);
+void crb_leave_inline_function(CRB_Interpreter *inter, int arg_count);
+void crb_inline_parameter(CRB_Interpreter *inter, int index);
 CRB_Value crb_eval_binary_expression(CRB_Interpreter *inter,
                                      CRB_LocalEnvironment *env,
                                      ExpressionType operator,
@@ -621,8 +1064,30 @@ CRB_Object *crb_string_substr_i(CRB_Interpreter *inter,
 CRB_Object *crb_create_native_pointer_i(CRB_Interpreter *inter,
                                         void *pointer,
                                         CRB_NativePointerInfo *info);
-CRB_Object *crb_create_scope_chain(CRB_Interpreter *inter);
+CRB_Value *crb_add_assoc_member_i(CRB_Interpreter *inter, CRB_Object *assoc,
+                                  char *name, CRB_Value *value,
+                                  CRB_Boolean is_final);
+CRB_Value *crb_add_assoc_member_with_shape(CRB_Interpreter *inter,
+                                          CRB_Object *assoc, Shape *new_shape,
+                                          CRB_Value *value);
+CRB_Value *crb_search_assoc_member_i(CRB_Object *assoc, char *member_name,
+                                     CRB_Boolean *is_final);
+int crb_search_shape_member(Shape *shape, char *member_name);
+CRB_Object *crb_create_scope_chain(CRB_Interpreter *inter, int slot_count,
+                                   char **slot_name);
+CRB_Object *crb_create_frame_scope_chain(CRB_Interpreter *inter,
+                                         int slot_count, char **slot_name);
+void crb_capture_scope_chain(CRB_Interpreter *inter, CRB_Object *sc);
+void crb_release_scope_chain(CRB_Interpreter *inter, CRB_Object *sc);
+void crb_dispose_frame_pool(CRB_Interpreter *inter);
+void crb_dispose_object_pages(CRB_Interpreter *inter);
+void crb_write_barrier(CRB_Interpreter *inter, CRB_Object *obj,
+                       CRB_Value *value);
+void crb_variable_write_barrier(CRB_Interpreter *inter,
+                                CRB_LocalEnvironment *env, CRB_Value *value);
 void crb_garbage_collect(CRB_Interpreter *inter);
+void crb_init_shapes(CRB_Interpreter *inter);
+void crb_dispose_shapes(CRB_Interpreter *inter);
 
 
 /* util.c */
@@ -633,7 +1098,20 @@ void *crb_execute_malloc(CRB_Interpreter *inter, size_t size);
 Variable *crb_search_global_variable(CRB_Interpreter *inter, char *identifier);
 CRB_NativeFunctionProc *
 crb_search_native_function(CRB_Interpreter *inter, char *name);
+CRB_FunctionDefinition *crb_search_function(CRB_Interpreter *inter,
+                                            char *name);
 CRB_FunctionDefinition *crb_search_function_in_compile(char *name);
+void crb_add_function(CRB_Interpreter *inter, CRB_FunctionDefinition *fd);
+void crb_variable_added(CRB_Interpreter *inter, char *name);
+void crb_dispose_function_table(CRB_Interpreter *inter);
+CRB_Value *crb_search_local_variable(CRB_LocalEnvironment *env,
+                                     char *identifier, CRB_Boolean *is_final);
+Slot *crb_search_slot(CRB_LocalEnvironment *env,
+                      IdentifierExpression *identifier);
+CRB_Value *crb_define_local_variable(CRB_Interpreter *inter,
+                                     CRB_LocalEnvironment *env,
+                                     IdentifierExpression *identifier,
+                                     CRB_Value *value, CRB_Boolean is_final);
 char *crb_get_operator_string(ExpressionType type);
 void crb_vstr_clear(VString *v);
 void crb_vstr_append_string(VString *v, CRB_Char *str);
@@ -82,6 +82,9 @@ CRB_ErrorDefinition crb_runtime_error_message_format[] = {
     {"数组的remove()必须传入整数值"
      "(不能传入$(type))。",
      "ArrayRemoveArgumentException"},
+    {"数组的reserve()必须传入整数值"
+     "(不能传入$(type))。",
+     "ArrayReserveArgumentException"},
     {"指定的位置超出字符串长度。"
      "为长度为$(len)的字符串指定了$(pos)。",
      "StringPositionOutOfBoundsException"},
@@ -117,50 +117,86 @@ eval_null_expression(CRB_Interpreter *inter)
     push_value(inter, &v);
 }
 
+/*
+ * In a function, only the globals its executed global statements
+ * declared are visible.
+ */
 static CRB_Value *
 search_global_variable_from_env(CRB_Interpreter *inter,
-                                CRB_LocalEnvironment *env, char *name,
+                                CRB_LocalEnvironment *env,
+                                IdentifierExpression *identifier,
                                 CRB_Boolean *is_final)
 {
-    GlobalVariableRef *pos;
+    Variable *variable;
 
     if (env == NULL) {
-        return CRB_search_global_variable_w(inter, name, is_final);
-    }
-
-    for (pos = env->global_variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, name)) {
-            return &pos->variable->value;
+        if (identifier->global_variable == NULL) {
+            identifier->global_variable
+                = crb_search_global_variable(inter, identifier->name);
+            if (identifier->global_variable == NULL)
+                return NULL;
         }
+        *is_final = identifier->global_variable->is_final;
+        return &identifier->global_variable->value;
     }
 
-    return NULL;
+    if (identifier->global_index < 0)
+        return NULL;
+    variable = env->global_variable[identifier->global_index];
+    if (variable == NULL)
+        return NULL;
+
+    return &variable->value;
 }
 
-static void
-eval_identifier_expression(CRB_Interpreter *inter,
-                           CRB_LocalEnvironment *env, Expression *expr)
+void
+crb_eval_identifier(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                    Expression *expr)
 {
     CRB_Value *vp;
+    Slot *slot;
     CRB_FunctionDefinition *func;
     CRB_Boolean is_final; /* dummy */
+    CRB_Value   v;
+
+    if (expr->u.identifier.function_version == inter->function_version) {
+        v.type = CRB_CLOSURE_VALUE;
+        v.u.closure.function = expr->u.identifier.function;
+        v.u.closure.environment = NULL;
+        push_value(inter, &v);
+        return;
+    }
+
+    if (env && (slot = crb_search_slot(env, &expr->u.identifier)) != NULL) {
+        push_value(inter, &slot->value);
+        return;
+    }
 
-    vp = CRB_search_local_variable(env, expr->u.identifier);
+    vp = crb_search_local_variable(env, expr->u.identifier.name, &is_final);
     if (vp != NULL) {
         push_value(inter, vp);
         return;
     }
 
-    vp = search_global_variable_from_env(inter, env, expr->u.identifier,
+    vp = search_global_variable_from_env(inter, env, &expr->u.identifier,
                                          &is_final);
     if (vp != NULL) {
         push_value(inter, vp);
         return;
     }
 
-    func = CRB_search_function(inter, expr->u.identifier);
+    func = crb_search_function(inter, expr->u.identifier.name);
     if (func != NULL) {
-        CRB_Value       v;
+        /*
+         * Only a variable added at runtime can shadow the function
+         * where the identifier is not a local variable. A global
+         * statement may bind the name later in the function too.
+         */
+        if (expr->u.identifier.depth < 0
+            && expr->u.identifier.global_index < 0) {
+            expr->u.identifier.function = func;
+            expr->u.identifier.function_version = inter->function_version;
+        }
         v.type = CRB_CLOSURE_VALUE;
         v.u.closure.function = func;
         v.u.closure.environment = NULL;
@@ -170,7 +206,7 @@ eval_identifier_expression(CRB_Interpreter *inter,
 
     crb_runtime_error(inter, env, expr->line_number, VARIABLE_NOT_FOUND_ERR,
                       CRB_STRING_MESSAGE_ARGUMENT,
-                      "name", expr->u.identifier,
+                      "name", expr->u.identifier.name,
                       CRB_MESSAGE_ARGUMENT_END);
 }
 
@@ -179,20 +215,28 @@ static void eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 CRB_Value *
 crb_get_identifier_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                          int line_number, char *identifier)
+                          int line_number,
+                          IdentifierExpression *identifier)
 {
     CRB_Value *left;
+    Slot *slot;
     CRB_Boolean is_final = CRB_FALSE;
 
-    left = CRB_search_local_variable_w(env, identifier, &is_final);
-    if (left == NULL) {
-        left = search_global_variable_from_env(inter, env, identifier,
-                                               &is_final);
+    if (env && (slot = crb_search_slot(env, identifier)) != NULL) {
+        left = &slot->value;
+        is_final = slot->is_final;
+    } else {
+        left = crb_search_local_variable(env, identifier->name, &is_final);
+        if (left == NULL) {
+            left = search_global_variable_from_env(inter, env, identifier,
+                                                   &is_final);
+        }
     }
     if (is_final) {
         crb_runtime_error(inter, env, line_number,
                           ASSIGN_TO_FINAL_VARIABLE_ERR,
-                          CRB_STRING_MESSAGE_ARGUMENT, "name", identifier,
+                          CRB_STRING_MESSAGE_ARGUMENT, "name",
+                          identifier->name,
                           CRB_MESSAGE_ARGUMENT_END);
     }
 
@@ -208,15 +252,16 @@ eval_comma_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     eval_expression(inter, env, expr->u.comma.right);
 }
 
-static CRB_Value *
-get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                         Expression *expr)
+/*
+ * The array and the index are on the stack. Both are popped.
+ */
+CRB_Value *
+crb_get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                             Expression *expr)
 {
     CRB_Value   array;
     CRB_Value   index;
 
-    eval_expression(inter, env, expr->u.index_expression.array);
-    eval_expression(inter, env, expr->u.index_expression.index);
     index = pop_value(inter);
     array = pop_value(inter);
 
@@ -225,6 +270,9 @@ get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           INDEX_OPERAND_NOT_ARRAY_ERR,
                           CRB_MESSAGE_ARGUMENT_END);
     }
+    if (expr->u.index_expression.is_in_bounds) {
+        return &array.u.object->u.array.array[index.u.int_value];
+    }
     if (index.type != CRB_INT_VALUE) {
         crb_runtime_error(inter, env, expr->line_number,
                           INDEX_OPERAND_NOT_INT_ERR,
@@ -244,14 +292,106 @@ get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 }
 
 static CRB_Value *
-get_member_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                  Expression *expr)
+get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *expr)
+{
+    eval_expression(inter, env, expr->u.index_expression.array);
+    eval_expression(inter, env, expr->u.index_expression.index);
+
+    return crb_get_array_element_lvalue(inter, env, expr);
+}
+
+/*
+ * Searches the member of the assoc through the inline cache of the member
+ * expression. Only shared shapes are cached, since they are never freed.
+ */
+static CRB_Value *
+search_member(CRB_Interpreter *inter, CRB_Object *assoc,
+              MemberExpression *member, CRB_Boolean *is_final)
+{
+    Shape *shape = assoc->u.assoc.shape;
+    MemberCache *cache = &member->cache;
+    int index;
+    int i;
+
+    for (i = 0; i < cache->entry_count; i++) {
+        if (cache->entry[i].shape == shape) {
+            cache->hit_count++;
+            inter->member_cache_hit_count++;
+            if (cache->entry[i].new_shape)
+                return NULL;
+            index = cache->entry[i].index;
+            *is_final = shape->is_final[index];
+            return &assoc->u.assoc.value[index];
+        }
+    }
+    cache->miss_count++;
+    inter->member_cache_miss_count++;
+
+    index = crb_search_shape_member(shape, member->member_name);
+    if (index < 0)
+        return NULL;
+
+    if (shape->is_shared && cache->entry_count < MEMBER_CACHE_SIZE) {
+        cache->entry[cache->entry_count].shape = shape;
+        cache->entry[cache->entry_count].index = index;
+        cache->entry[cache->entry_count].new_shape = NULL;
+        cache->entry_count++;
+    }
+    *is_final = shape->is_final[index];
+
+    return &assoc->u.assoc.value[index];
+}
+
+/*
+ * Adds the member which search_member() did not find,
+ * caching the shape transition.
+ */
+static void
+add_member(CRB_Interpreter *inter, CRB_Object *assoc,
+           MemberExpression *member, CRB_Value *value, CRB_Boolean is_final)
+{
+    Shape *shape = assoc->u.assoc.shape;
+    MemberCache *cache = &member->cache;
+    int i;
+
+    for (i = 0; i < cache->entry_count; i++) {
+        if (cache->entry[i].shape == shape && cache->entry[i].new_shape) {
+            crb_add_assoc_member_with_shape(inter, assoc,
+                                            cache->entry[i].new_shape, value);
+            return;
+        }
+    }
+    crb_add_assoc_member_i(inter, assoc, member->member_name,
+                           value, is_final);
+    if (shape->is_shared && assoc->u.assoc.shape->is_shared
+        && cache->entry_count < MEMBER_CACHE_SIZE) {
+        cache->entry[cache->entry_count].shape = shape;
+        cache->entry[cache->entry_count].index = shape->member_count;
+        cache->entry[cache->entry_count].new_shape = assoc->u.assoc.shape;
+        cache->entry_count++;
+    }
+}
+
+void
+CRB_get_member_cache_statistics(CRB_Interpreter *inter,
+                                long *hit_count, long *miss_count)
+{
+    *hit_count = inter->member_cache_hit_count;
+    *miss_count = inter->member_cache_miss_count;
+}
+
+/*
+ * The object is on the stack and is popped.
+ */
+CRB_Value *
+crb_get_member_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      Expression *expr)
 {
     CRB_Value assoc;
     CRB_Value *dest;
     CRB_Boolean is_final = CRB_FALSE;
 
-    eval_expression(inter, env, expr->u.member_expression.expression);
     assoc = pop_value(inter);
 
     if (assoc.type != CRB_ASSOC_VALUE) {
@@ -260,9 +400,8 @@ get_member_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           CRB_MESSAGE_ARGUMENT_END);
     }
 
-    dest = CRB_search_assoc_member_w(assoc.u.object,
-                                     expr->u.member_expression.member_name,
-                                     &is_final);
+    dest = search_member(inter, assoc.u.object, &expr->u.member_expression,
+                         &is_final);
     if (is_final) {
         crb_runtime_error(inter, env, expr->line_number,
                           ASSIGN_TO_FINAL_VARIABLE_ERR,
@@ -274,6 +413,15 @@ get_member_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return dest;
 }
 
+static CRB_Value *
+get_member_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                  Expression *expr)
+{
+    eval_expression(inter, env, expr->u.member_expression.expression);
+
+    return crb_get_member_lvalue(inter, env, expr);
+}
+
 static CRB_Value *
 get_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                Expression *expr)
@@ -282,7 +430,7 @@ get_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
     if (expr->type == IDENTIFIER_EXPRESSION) {
         dest = crb_get_identifier_lvalue(inter, env, expr->line_number,
-                                         expr->u.identifier);
+                                         &expr->u.identifier);
     } else if (expr->type == INDEX_EXPRESSION) {
         dest = get_array_element_lvalue(inter, env, expr);
     } else if (expr->type == MEMBER_EXPRESSION) {
@@ -374,6 +522,7 @@ eval_binary_int(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     case NULL_EXPRESSION:       /* FALLTHRU */
     case ARRAY_EXPRESSION:      /* FALLTHRU */
     case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
     case INDEX_EXPRESSION:      /* FALLTHRU */
     case INCREMENT_EXPRESSION:  /* FALLTHRU */
     case DECREMENT_EXPRESSION:  /* FALLTHRU */
@@ -454,6 +603,7 @@ eval_binary_double(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     case NULL_EXPRESSION:               /* FALLTHRU */
     case ARRAY_EXPRESSION:      /* FALLTHRU */
     case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
     case INDEX_EXPRESSION:      /* FALLTHRU */
     case INCREMENT_EXPRESSION:
     case DECREMENT_EXPRESSION:
@@ -559,16 +709,21 @@ do_assign(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     }
 }
 
-static void
-assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                 Expression *expr, CRB_Value *src)
+/*
+ * The stack holds the source value and the object on top of it.
+ * The object is popped, the source value is left as the result.
+ */
+void
+crb_assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                     Expression *expr)
 {
+    CRB_Value *src;
     CRB_Value *assoc;
     CRB_Value *dest;
     Expression *left = expr->u.assign_expression.left;
     CRB_Boolean is_final;
 
-    eval_expression(inter, env, left->u.member_expression.expression);
+    src = peek_stack(inter, 1);
     assoc = peek_stack(inter, 0);
     if (assoc->type != CRB_ASSOC_VALUE) {
         crb_runtime_error(inter, env, expr->line_number,
@@ -576,9 +731,8 @@ assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           CRB_MESSAGE_ARGUMENT_END);
     }
 
-    dest = CRB_search_assoc_member_w(assoc->u.object,
-                                     left->u.member_expression.member_name,
-                                     &is_final);
+    dest = search_member(inter, assoc->u.object, &left->u.member_expression,
+                         &is_final);
     if (dest == NULL) {
         if (expr->u.assign_expression.operator != NORMAL_ASSIGN) {
             crb_runtime_error(inter, env, expr->line_number,
@@ -587,9 +741,8 @@ assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                               left->u.member_expression.member_name,
                               CRB_MESSAGE_ARGUMENT_END);
         }
-        CRB_add_assoc_member(inter, assoc->u.object,
-                             left->u.member_expression.member_name,
-                             src, expr->u.assign_expression.is_final);
+        add_member(inter, assoc->u.object, &left->u.member_expression,
+                   src, expr->u.assign_expression.is_final);
     } else {
         if (is_final) {
             crb_runtime_error(inter, env, expr->line_number,
@@ -600,53 +753,92 @@ assign_to_member(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         }
         do_assign(inter, env, src, dest, expr->u.assign_expression.operator,
                   expr->line_number);
+        crb_write_barrier(inter, assoc->u.object, dest);
     }
     pop_value(inter);
 }
 
-static void
-eval_assign_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                       Expression *expr)
+/*
+ * The source value is on the stack and is left as the result.
+ */
+void
+crb_assign_to_identifier(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *expr)
 {
     CRB_Value   *src;
     CRB_Value   *dest;
     Expression  *left = expr->u.assign_expression.left;
 
-    eval_expression(inter, env, expr->u.assign_expression.operand);
     src = peek_stack(inter, 0);
-
-    if (left->type == MEMBER_EXPRESSION) {
-        assign_to_member(inter, env, expr, src);
-        return;
-    }
-
-    dest = get_lvalue(inter, env, left);
-    if (left->type == IDENTIFIER_EXPRESSION && dest == NULL) {
+    dest = crb_get_identifier_lvalue(inter, env, left->line_number,
+                                     &left->u.identifier);
+    if (dest == NULL) {
         if (expr->u.assign_expression.operator != NORMAL_ASSIGN) {
             crb_runtime_error(inter, env, expr->line_number,
                               VARIABLE_NOT_FOUND_ERR,
                               CRB_STRING_MESSAGE_ARGUMENT, "name",
-                              left->u.identifier,
+                              left->u.identifier.name,
                               CRB_MESSAGE_ARGUMENT_END);
         }
         if (env != NULL) {
-            CRB_add_local_variable(inter, env, left->u.identifier, src,
-                                   expr->u.assign_expression.is_final);
+            crb_define_local_variable(inter, env, &left->u.identifier, src,
+                                      expr->u.assign_expression.is_final);
         } else {
-            if (CRB_search_function(inter, left->u.identifier)) {
+            if (crb_search_function(inter, left->u.identifier.name)) {
                 crb_runtime_error(inter, env, expr->line_number,
                                   FUNCTION_EXISTS_ERR,
                                   CRB_STRING_MESSAGE_ARGUMENT, "name",
-                                  left->u.identifier,
+                                  left->u.identifier.name,
                                   CRB_MESSAGE_ARGUMENT_END);
             }
-            CRB_add_global_variable(inter, left->u.identifier, src,
+            CRB_add_global_variable(inter, left->u.identifier.name, src,
                                     expr->u.assign_expression.is_final);
         }
     } else {
-        DBG_assert(dest != NULL, ("dest == NULL.\n"));
         do_assign(inter, env, src, dest, expr->u.assign_expression.operator,
                   expr->line_number);
+        crb_variable_write_barrier(inter, env, dest);
+    }
+}
+
+/*
+ * The stack holds the source value, the array and the index.
+ * The array and the index are popped.
+ */
+void
+crb_assign_to_array_element(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                            Expression *expr)
+{
+    CRB_Object  *array = peek_stack(inter, 1)->u.object;
+    CRB_Value   *dest;
+
+    dest = crb_get_array_element_lvalue(inter, env,
+                                        expr->u.assign_expression.left);
+    do_assign(inter, env, peek_stack(inter, 0), dest,
+              expr->u.assign_expression.operator, expr->line_number);
+    crb_write_barrier(inter, array, dest);
+}
+
+static void
+eval_assign_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       Expression *expr)
+{
+    Expression  *left = expr->u.assign_expression.left;
+
+    eval_expression(inter, env, expr->u.assign_expression.operand);
+
+    if (left->type == IDENTIFIER_EXPRESSION) {
+        crb_assign_to_identifier(inter, env, expr);
+    } else if (left->type == MEMBER_EXPRESSION) {
+        eval_expression(inter, env, left->u.member_expression.expression);
+        crb_assign_to_member(inter, env, expr);
+    } else if (left->type == INDEX_EXPRESSION) {
+        eval_expression(inter, env, left->u.index_expression.array);
+        eval_expression(inter, env, left->u.index_expression.index);
+        crb_assign_to_array_element(inter, env, expr);
+    } else {
+        crb_runtime_error(inter, env, left->line_number, NOT_LVALUE_ERR,
+                          CRB_MESSAGE_ARGUMENT_END);
     }
 }
 
@@ -726,17 +918,19 @@ eval_binary_null(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return result;
 }
 
-static void
-eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                       ExpressionType operator,
-                       Expression *left, Expression *right)
+/*
+ * Replaces the values of left and right on the stack with the result.
+ * left and right are used only for the line numbers.
+ */
+void
+crb_binary_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                     ExpressionType operator,
+                     Expression *left, Expression *right)
 {
     CRB_Value   *left_val;
     CRB_Value   *right_val;
     CRB_Value   result;
 
-    eval_expression(inter, env, left);
-    eval_expression(inter, env, right);
     left_val = peek_stack(inter, 1);
     right_val = peek_stack(inter, 0);
 
@@ -784,187 +978,649 @@ eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     push_value(inter, &result);
 }
 
-CRB_Value
-crb_eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                           ExpressionType operator,
-                           Expression *left, Expression *right)
-{
-    eval_binary_expression(inter, env, operator, left, right);
-    return pop_value(inter);
-}
-
-static void
-eval_logical_and_or_expression(CRB_Interpreter *inter,
-                               CRB_LocalEnvironment *env,
-                               ExpressionType operator,
-                               Expression *left, Expression *right)
+/*
+ * Records the operand types on the stack as the quickening
+ * of the binary expression.
+ */
+BinaryQuickening
+crb_quicken_binary_expression(CRB_Interpreter *inter, Expression *expr)
 {
-    CRB_Value   left_val;
-    CRB_Value   right_val;
-    CRB_Value   result;
+    CRB_Value   *left_val = peek_stack(inter, 1);
+    CRB_Value   *right_val = peek_stack(inter, 0);
+    BinaryQuickening quickening;
 
-    result.type = CRB_BOOLEAN_VALUE;
-    eval_expression(inter, env, left);
-    left_val = pop_value(inter);
-    if (left_val.type != CRB_BOOLEAN_VALUE) {
-        crb_runtime_error(inter, env, left->line_number, NOT_BOOLEAN_TYPE_ERR,
-                          CRB_MESSAGE_ARGUMENT_END);
-    }
-    if (operator == LOGICAL_AND_EXPRESSION) {
-        if (!left_val.u.boolean_value) {
-            result.u.boolean_value = CRB_FALSE;
-            goto FUNC_END;
-        }
-    } else if (operator == LOGICAL_OR_EXPRESSION) {
-        if (left_val.u.boolean_value) {
-            result.u.boolean_value = CRB_TRUE;
-            goto FUNC_END;
-        }
+    if (left_val->type == CRB_INT_VALUE
+        && right_val->type == CRB_INT_VALUE) {
+        quickening = BINARY_INT_INT;
+    } else if (left_val->type == CRB_DOUBLE_VALUE
+               && right_val->type == CRB_DOUBLE_VALUE) {
+        quickening = BINARY_DOUBLE_DOUBLE;
+    } else if (left_val->type == CRB_STRING_VALUE
+               && expr->type == ADD_EXPRESSION) {
+        quickening = BINARY_STRING_CONCAT;
     } else {
-        DBG_panic(("bad operator..%d\n", operator));
+        quickening = BINARY_GENERIC;
     }
+    expr->u.binary_expression.quickening = quickening;
 
-    eval_expression(inter, env, right);
-    right_val = pop_value(inter);
-    result.u.boolean_value = right_val.u.boolean_value;
-
-  FUNC_END:
-    push_value(inter, &result);
+    return quickening;
 }
 
-static void
-eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                      Expression *operand)
+/*
+ * The quickened operations below replace the operands on the stack
+ * with the result, or return FALSE leaving the stack as it is
+ * when the operands fail the type guard.
+ */
+CRB_Boolean
+crb_binary_int_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *expr)
 {
-    CRB_Value   *operand_val;
+    CRB_Value   *left_val = peek_stack(inter, 1);
+    CRB_Value   *right_val = peek_stack(inter, 0);
+    int         left;
+    int         right;
 
-    eval_expression(inter, env, operand);
-    operand_val = peek_stack(inter, 0);
-    if (operand_val->type == CRB_INT_VALUE) {
-        operand_val->u.int_value = -operand_val->u.int_value;
-    } else if (operand_val->type == CRB_DOUBLE_VALUE) {
-        operand_val->u.double_value = -operand_val->u.double_value;
-    } else {
-        crb_runtime_error(inter, env, operand->line_number,
-                          MINUS_OPERAND_TYPE_ERR,
-                          CRB_MESSAGE_ARGUMENT_END);
+    if (left_val->type != CRB_INT_VALUE || right_val->type != CRB_INT_VALUE)
+        return CRB_FALSE;
+
+    left = left_val->u.int_value;
+    right = right_val->u.int_value;
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case IDENTIFIER_EXPRESSION: /* FALLTHRU */
+    case COMMA_EXPRESSION:      /* FALLTHRU */
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+    case MINUS_EXPRESSION:      /* FALLTHRU */
+    case LOGICAL_NOT_EXPRESSION:        /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case MEMBER_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:       /* FALLTHRU */
+    case ARRAY_EXPRESSION:      /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
+    case INDEX_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:  /* FALLTHRU */
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", expr->type));
+        break;
+    case ADD_EXPRESSION:
+        left_val->u.int_value = left + right;
+        break;
+    case SUB_EXPRESSION:
+        left_val->u.int_value = left - right;
+        break;
+    case MUL_EXPRESSION:
+        left_val->u.int_value = left * right;
+        break;
+    case DIV_EXPRESSION:
+        if (right == 0) {
+            crb_runtime_error(inter, env,
+                              expr->u.binary_expression.left->line_number,
+                              DIVISION_BY_ZERO_ERR,
+                              CRB_MESSAGE_ARGUMENT_END);
+        }
+        left_val->u.int_value = left / right;
+        break;
+    case MOD_EXPRESSION:
+        if (right == 0) {
+            crb_runtime_error(inter, env,
+                              expr->u.binary_expression.left->line_number,
+                              DIVISION_BY_ZERO_ERR,
+                              CRB_MESSAGE_ARGUMENT_END);
+        }
+        left_val->u.int_value = left % right;
+        break;
+    case EQ_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left == right;
+        break;
+    case NE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left != right;
+        break;
+    case GT_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left > right;
+        break;
+    case GE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left >= right;
+        break;
+    case LT_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left < right;
+        break;
+    case LE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left <= right;
+        break;
     }
-}
+    shrink_stack(inter, 1);
 
-CRB_Value
-crb_eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                          Expression *operand)
-{
-    eval_minus_expression(inter, env, operand);
-    return pop_value(inter);
+    return CRB_TRUE;
 }
 
-static void
-eval_logical_not_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                            Expression *operand)
+CRB_Boolean
+crb_binary_double_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                            Expression *expr)
 {
-    CRB_Value   *operand_val;
+    CRB_Value   *left_val = peek_stack(inter, 1);
+    CRB_Value   *right_val = peek_stack(inter, 0);
+    double      left;
+    double      right;
 
-    eval_expression(inter, env, operand);
-    operand_val = peek_stack(inter, 0);
+    if (left_val->type != CRB_DOUBLE_VALUE
+        || right_val->type != CRB_DOUBLE_VALUE)
+        return CRB_FALSE;
 
-    if (operand_val->type != CRB_BOOLEAN_VALUE) {
-        crb_runtime_error(inter, env, operand->line_number,
-                          NOT_BOOLEAN_TYPE_ERR,
-                          CRB_MESSAGE_ARGUMENT_END);
-    }
-    operand_val->u.boolean_value = !operand_val->u.boolean_value;
+    left = left_val->u.double_value;
+    right = right_val->u.double_value;
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case IDENTIFIER_EXPRESSION: /* FALLTHRU */
+    case COMMA_EXPRESSION:      /* FALLTHRU */
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+    case MINUS_EXPRESSION:      /* FALLTHRU */
+    case LOGICAL_NOT_EXPRESSION:        /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case MEMBER_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:       /* FALLTHRU */
+    case ARRAY_EXPRESSION:      /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
+    case INDEX_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:  /* FALLTHRU */
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", expr->type));
+        break;
+    case ADD_EXPRESSION:
+        left_val->u.double_value = left + right;
+        break;
+    case SUB_EXPRESSION:
+        left_val->u.double_value = left - right;
+        break;
+    case MUL_EXPRESSION:
+        left_val->u.double_value = left * right;
+        break;
+    case DIV_EXPRESSION:
+        left_val->u.double_value = left / right;
+        break;
+    case MOD_EXPRESSION:
+        left_val->u.double_value = fmod(left, right);
+        break;
+    case EQ_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left == right;
+        break;
+    case NE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left != right;
+        break;
+    case GT_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left > right;
+        break;
+    case GE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left >= right;
+        break;
+    case LT_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left < right;
+        break;
+    case LE_EXPRESSION:
+        left_val->type = CRB_BOOLEAN_VALUE;
+        left_val->u.boolean_value = left <= right;
+        break;
+    }
+    shrink_stack(inter, 1);
+
+    return CRB_TRUE;
+}
+
+CRB_Boolean
+crb_concat_string_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                            Expression *expr)
+{
+    CRB_Value   *left_val = peek_stack(inter, 1);
+    CRB_Value   result;
+
+    if (left_val->type != CRB_STRING_VALUE)
+        return CRB_FALSE;
+
+    chain_string(inter, env, expr->u.binary_expression.right->line_number,
+                 left_val, peek_stack(inter, 0), &result);
+    shrink_stack(inter, 2);
+    push_value(inter, &result);
+
+    return CRB_TRUE;
+}
+
+static void
+eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       ExpressionType operator,
+                       Expression *left, Expression *right)
+{
+    eval_expression(inter, env, left);
+    eval_expression(inter, env, right);
+    crb_binary_operation(inter, env, operator, left, right);
+}
+
+static void
+eval_quickened_binary_expression(CRB_Interpreter *inter,
+                                 CRB_LocalEnvironment *env, Expression *expr)
+{
+    BinaryExpression *binary = &expr->u.binary_expression;
+
+    eval_expression(inter, env, binary->left);
+    eval_expression(inter, env, binary->right);
+    if (binary->quickening == BINARY_NOT_QUICKENED) {
+        crb_quicken_binary_expression(inter, expr);
+    }
+    switch (binary->quickening) {
+    case BINARY_INT_INT:
+        if (crb_binary_int_operation(inter, env, expr))
+            return;
+        break;
+    case BINARY_DOUBLE_DOUBLE:
+        if (crb_binary_double_operation(inter, env, expr))
+            return;
+        break;
+    case BINARY_STRING_CONCAT:
+        if (crb_concat_string_operation(inter, env, expr))
+            return;
+        break;
+    case BINARY_NOT_QUICKENED:  /* FALLTHRU */
+    case BINARY_GENERIC:
+        break;
+    default:
+        DBG_assert(0, ("bad case...%d", binary->quickening));
+    }
+    binary->quickening = BINARY_GENERIC;
+    crb_binary_operation(inter, env, expr->type, binary->left, binary->right);
+}
+
+CRB_Value
+crb_eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                           ExpressionType operator,
+                           Expression *left, Expression *right)
+{
+    eval_binary_expression(inter, env, operator, left, right);
+    return pop_value(inter);
+}
+
+static void
+eval_logical_and_or_expression(CRB_Interpreter *inter,
+                               CRB_LocalEnvironment *env,
+                               ExpressionType operator,
+                               Expression *left, Expression *right)
+{
+    CRB_Value   left_val;
+    CRB_Value   right_val;
+    CRB_Value   result;
+
+    result.type = CRB_BOOLEAN_VALUE;
+    eval_expression(inter, env, left);
+    left_val = pop_value(inter);
+    if (left_val.type != CRB_BOOLEAN_VALUE) {
+        crb_runtime_error(inter, env, left->line_number, NOT_BOOLEAN_TYPE_ERR,
+                          CRB_MESSAGE_ARGUMENT_END);
+    }
+    if (operator == LOGICAL_AND_EXPRESSION) {
+        if (!left_val.u.boolean_value) {
+            result.u.boolean_value = CRB_FALSE;
+            goto FUNC_END;
+        }
+    } else if (operator == LOGICAL_OR_EXPRESSION) {
+        if (left_val.u.boolean_value) {
+            result.u.boolean_value = CRB_TRUE;
+            goto FUNC_END;
+        }
+    } else {
+        DBG_panic(("bad operator..%d\n", operator));
+    }
+
+    eval_expression(inter, env, right);
+    right_val = pop_value(inter);
+    result.u.boolean_value = right_val.u.boolean_value;
+
+  FUNC_END:
+    push_value(inter, &result);
+}
+
+/*
+ * Negates the value of operand on the top of the stack.
+ */
+void
+crb_minus_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                    Expression *operand)
+{
+    CRB_Value   *operand_val;
+
+    operand_val = peek_stack(inter, 0);
+    if (operand_val->type == CRB_INT_VALUE) {
+        operand_val->u.int_value = -operand_val->u.int_value;
+    } else if (operand_val->type == CRB_DOUBLE_VALUE) {
+        operand_val->u.double_value = -operand_val->u.double_value;
+    } else {
+        crb_runtime_error(inter, env, operand->line_number,
+                          MINUS_OPERAND_TYPE_ERR,
+                          CRB_MESSAGE_ARGUMENT_END);
+    }
+}
+
+static void
+eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      Expression *operand)
+{
+    eval_expression(inter, env, operand);
+    crb_minus_operation(inter, env, operand);
+}
+
+CRB_Value
+crb_eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          Expression *operand)
+{
+    eval_minus_expression(inter, env, operand);
+    return pop_value(inter);
+}
+
+void
+crb_logical_not_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          Expression *operand)
+{
+    CRB_Value   *operand_val;
+
+    operand_val = peek_stack(inter, 0);
+
+    if (operand_val->type != CRB_BOOLEAN_VALUE) {
+        crb_runtime_error(inter, env, operand->line_number,
+                          NOT_BOOLEAN_TYPE_ERR,
+                          CRB_MESSAGE_ARGUMENT_END);
+    }
+    operand_val->u.boolean_value = !operand_val->u.boolean_value;
+}
+
+static void
+eval_logical_not_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                            Expression *operand)
+{
+    eval_expression(inter, env, operand);
+    crb_logical_not_operation(inter, env, operand);
+}
+
+/*
+ * Sets up the variables of env for a call of fd.
+ */
+static void
+init_local_environment(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       char *func_name, CRB_FunctionDefinition *fd,
+                       CRB_Object *closure_env)
+{
+    int slot_count = 0;
+    char **slot_name = NULL;
+    int global_count = 0;
+    int i;
+
+    if (fd && fd->type == CRB_CROWBAR_FUNCTION_DEFINITION) {
+        DBG_assert(fd->u.crowbar_f.local_variable_count >= 0,
+                   ("%s is not resolved.\n", fd->name));
+        slot_count = fd->u.crowbar_f.local_variable_count;
+        slot_name = fd->u.crowbar_f.local_variable;
+        global_count = fd->u.crowbar_f.global_variable_count;
+    }
+
+    if (global_count > env->global_variable_alloc_size) {
+        env->global_variable = MEM_realloc(env->global_variable,
+                                           sizeof(Variable*) * global_count);
+        env->global_variable_alloc_size = global_count;
+    }
+    for (i = 0; i < global_count; i++) {
+        env->global_variable[i] = NULL;
+    }
+
+    env->current_function_name = func_name;
+    env->ref_in_native_method = NULL; /* to stop marking by GC */
+    env->variable = NULL; /* to stop marking by GC */
+    if (fd && fd->type == CRB_CROWBAR_FUNCTION_DEFINITION
+        && fd->u.crowbar_f.is_capture_free) {
+        env->variable = crb_create_frame_scope_chain(inter, slot_count,
+                                                     slot_name);
+    } else {
+        env->variable = crb_create_scope_chain(inter, slot_count, slot_name);
+    }
+    env->variable->u.scope_chain.next = closure_env;
 }
 
 static CRB_LocalEnvironment *
 alloc_local_environment(CRB_Interpreter *inter, char *func_name,
-                        int caller_line_number, CRB_Object *closure_env)
+                        int caller_line_number, CRB_FunctionDefinition *fd,
+                        CRB_Object *closure_env)
 {
     CRB_LocalEnvironment *ret;
 
-    ret = MEM_malloc(sizeof(CRB_LocalEnvironment));
+    if (inter->frame_pool.environment) {
+        ret = inter->frame_pool.environment;
+        inter->frame_pool.environment = ret->next;
+    } else {
+        ret = MEM_malloc(sizeof(CRB_LocalEnvironment));
+        ret->global_variable = NULL;
+        ret->global_variable_alloc_size = 0;
+    }
     ret->next = inter->top_environment;
     inter->top_environment = ret;
 
-    ret->current_function_name = func_name;
     ret->caller_line_number = caller_line_number;
-    ret->ref_in_native_method = NULL; /* to stop marking by GC */
-    ret->variable = NULL; /* to stop marking by GC */
-    ret->variable = crb_create_scope_chain(inter);
-    ret->variable->u.scope_chain.frame = crb_create_assoc_i(inter);
-    ret->variable->u.scope_chain.next = closure_env;
-    ret->global_variable = NULL;
+    init_local_environment(inter, ret, func_name, fd, closure_env);
 
     return ret;
 }
 
+/*
+ * A named closure can refer itself from the slot 0.
+ */
 static void
-dispose_ref_in_native_method(CRB_LocalEnvironment *env)
+define_closure_slot(CRB_LocalEnvironment *env, CRB_Value *func)
+{
+    CRB_FunctionDefinition *fd = func->u.closure.function;
+    Slot *slot;
+
+    if (fd->is_closure && fd->name) {
+        slot = &env->variable->u.scope_chain.slot[0];
+        slot->is_defined = CRB_TRUE;
+        slot->is_final = CRB_TRUE;
+        slot->value = *func;
+    }
+}
+
+static void
+dispose_ref_in_native_method(CRB_Interpreter *inter,
+                             CRB_LocalEnvironment *env)
 {
     RefInNativeFunc     *ref;
 
     while (env->ref_in_native_method) {
         ref = env->ref_in_native_method;
         env->ref_in_native_method = ref->next;
-        MEM_free(ref);
+        ref->next = inter->frame_pool.ref_in_native_method;
+        inter->frame_pool.ref_in_native_method = ref;
     }
 }
 
+/*
+ * Local environments and their bookkeeping go back to the frame pool
+ * of the interpreter instead of being freed.
+ */
 static void
 dispose_local_environment(CRB_Interpreter *inter)
 {
-    GlobalVariableRef *ref;
-
     CRB_LocalEnvironment *temp = inter->top_environment;
     inter->top_environment = inter->top_environment->next;
 
-    while (temp->global_variable) {
-        ref = temp->global_variable;
-        temp->global_variable = ref->next;
-        MEM_free(ref);
+    dispose_ref_in_native_method(inter, temp);
+    crb_release_scope_chain(inter, temp->variable);
+    temp->variable = NULL;
+
+    temp->next = inter->frame_pool.environment;
+    inter->frame_pool.environment = temp;
+}
+
+/*
+ * Function calls do not catch exceptions. The catcher disposes the local
+ * environments of the functions the exception went through, down to
+ * the one it saved before setjmp().
+ */
+void
+crb_unwind_local_environment(CRB_Interpreter *inter,
+                             CRB_LocalEnvironment *env)
+{
+    while (inter->top_environment != env) {
+        dispose_local_environment(inter);
     }
-    dispose_ref_in_native_method(temp);
+}
 
-    MEM_free(temp);
+static StatementResult
+execute_function_body(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      CRB_FunctionDefinition *fd)
+{
+    if (inter->execute_mode == BYTE_CODE_EXECUTE_MODE) {
+        return crb_execute_byte_code(inter, env, fd->u.crowbar_f.executable);
+    } else {
+        return crb_execute_statement_list(inter, env,
+                                          fd->u.crowbar_f.block
+                                          ->statement_list);
+    }
 }
 
 static void
-call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                      CRB_LocalEnvironment *caller_env,
-                      Expression *expr, CRB_Value *func)
+check_argument_count(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                     int line_number, CRB_FunctionDefinition *fd,
+                     int arg_count)
 {
-    CRB_Value   value;
-    StatementResult     result;
-    ArgumentList        *arg_p;
     CRB_ParameterList   *param_p;
+    int         param_count = 0;
 
-    for (arg_p = expr->u.function_call_expression.argument,
-             param_p = func->u.closure.function->u.crowbar_f.parameter;
-         arg_p;
-
-         arg_p = arg_p->next, param_p = param_p->next) {
-        CRB_Value *arg_val;
-
-        if (param_p == NULL) {
-            crb_runtime_error(inter, caller_env, expr->line_number,
-                              ARGUMENT_TOO_MANY_ERR,
-                              CRB_MESSAGE_ARGUMENT_END);
-        }
-        eval_expression(inter, caller_env, arg_p->expression);
-        arg_val = peek_stack(inter, 0);
-        CRB_add_local_variable(inter, env, param_p->name, arg_val,
-                               CRB_FALSE);
-        pop_value(inter);
-    }
-    if (param_p) {
-        crb_runtime_error(inter, caller_env, expr->line_number,
+    for (param_p = fd->u.crowbar_f.parameter; param_p;
+         param_p = param_p->next) {
+        param_count++;
+    }
+    if (arg_count > param_count) {
+        crb_runtime_error(inter, env, line_number,
+                          ARGUMENT_TOO_MANY_ERR,
+                          CRB_MESSAGE_ARGUMENT_END);
+    } else if (arg_count < param_count) {
+        crb_runtime_error(inter, env, line_number,
                           ARGUMENT_TOO_FEW_ERR,
                           CRB_MESSAGE_ARGUMENT_END);
     }
+}
+
+static void
+bind_arguments(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+               CRB_FunctionDefinition *fd, int arg_count)
+{
+    CRB_Value   *args;
+    int         arg_idx;
+    Slot        *slot;
 
-    result = crb_execute_statement_list(inter, env,
-                                        func->u.closure.function
-                                        ->u.crowbar_f.block->statement_list);
+    args = &inter->stack.stack[inter->stack.stack_pointer-arg_count];
+    slot = env->variable->u.scope_chain.slot;
+    if (fd->is_closure && fd->name) {
+        slot++;
+    }
+    for (arg_idx = 0; arg_idx < arg_count; arg_idx++) {
+        slot[arg_idx].is_defined = CRB_TRUE;
+        slot[arg_idx].is_final = CRB_FALSE;
+        slot[arg_idx].value = args[arg_idx];
+    }
+    shrink_stack(inter, arg_count);
+}
+
+/*
+ * The function and the arguments of a tail call are on the stack,
+ * above the function returning at base - 1. A crowbar function takes
+ * over env and the place of the returning function on the stack.
+ * Anything else is called as usual, and NULL is returned with
+ * the return value on the stack.
+ */
+static CRB_FunctionDefinition *
+prepare_tail_call(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                  Expression *expr, int base, int arg_count)
+{
+    CRB_Value   func = *peek_stack(inter, arg_count);
+    CRB_Value   value;
+    CRB_FunctionDefinition      *fd;
+
+    if (func.type != CRB_CLOSURE_VALUE
+        || func.u.closure.function->type != CRB_CROWBAR_FUNCTION_DEFINITION) {
+        crb_call_function_expression(inter, env, expr, arg_count);
+        value = pop_value(inter);
+        inter->stack.stack_pointer = base;
+        push_value(inter, &value);
+        return NULL;
+    }
+    fd = func.u.closure.function;
+    check_argument_count(inter, env, expr->line_number, fd, arg_count);
+
+    dispose_ref_in_native_method(inter, env);
+    crb_release_scope_chain(inter, env->variable);
+    env->variable = NULL;
+    inter->stack.stack[base - 1] = func;
+    memmove(&inter->stack.stack[base],
+            &inter->stack.stack[inter->stack.stack_pointer - arg_count],
+            sizeof(CRB_Value) * arg_count);
+    inter->stack.stack_pointer = base + arg_count;
+    init_local_environment(inter, env, fd->name, fd,
+                           func.u.closure.environment);
+    define_closure_slot(env, &func);
+
+    return fd;
+}
+
+/*
+ * Tail calls loop here instead of nesting, so the functions that
+ * made them are not in the stack traces of their callees.
+ */
+static void
+call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      CRB_LocalEnvironment *caller_env, int line_number,
+                      CRB_Value *func, int arg_count)
+{
+    CRB_Value   value;
+    StatementResult     result;
+    CRB_FunctionDefinition      *fd = func->u.closure.function;
+    int         base;
+
+    check_argument_count(inter, caller_env, line_number, fd, arg_count);
+    for (;;) {
+        bind_arguments(inter, env, fd, arg_count);
+        base = inter->stack.stack_pointer;
+        result = execute_function_body(inter, env, fd);
+        if (result.type != TAIL_CALL_STATEMENT_RESULT)
+            break;
+
+        arg_count = result.u.tail_call.argument_count;
+        fd = prepare_tail_call(inter, env, result.u.tail_call.expression,
+                               base, arg_count);
+        if (fd == NULL)
+            return;
+    }
 
     if (result.type == RETURN_STATEMENT_RESULT) {
         value = result.u.return_value;
@@ -977,19 +1633,11 @@ call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 static void
 call_native_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                     CRB_LocalEnvironment *caller_env,
-                     Expression *expr, CRB_NativeFunctionProc *proc)
+                     CRB_NativeFunctionProc *proc, int arg_count)
 {
     CRB_Value   value;
-    int         arg_count;
-    ArgumentList        *arg_p;
-    CRB_Value   *args = NULL;
+    CRB_Value   *args;
 
-    for (arg_count = 0, arg_p = expr->u.function_call_expression.argument;
-         arg_p; arg_p = arg_p->next) {
-        eval_expression(inter, caller_env, arg_p->expression);
-        arg_count++;
-    }
     args = &inter->stack.stack[inter->stack.stack_pointer-arg_count];
     value = proc(inter, env, arg_count, args);
     shrink_stack(inter, arg_count);
@@ -1016,12 +1664,12 @@ typedef struct {
     char        *name;
     int         argument_count;
     void        (*func)(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                        CRB_Object *obj, CRB_Value *result);
+                        int line_number, CRB_Object *obj, CRB_Value *result);
 } FakeMethodTable;
 
 static void
 array_add_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                 CRB_Object *obj, CRB_Value *result)
+                 int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value *add;
 
@@ -1032,7 +1680,7 @@ array_add_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 static void
 array_size_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                  CRB_Object *obj, CRB_Value *result)
+                  int line_number, CRB_Object *obj, CRB_Value *result)
 {
     result->type = CRB_INT_VALUE;
     result->u.int_value = obj->u.array.size;
@@ -1040,13 +1688,13 @@ array_size_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 static void
 array_resize_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                    CRB_Object *obj, CRB_Value *result)
+                    int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value *new_size;
 
     new_size = peek_stack(inter, 0);
     if (new_size->type != CRB_INT_VALUE) {
-        crb_runtime_error(inter, env, __LINE__,
+        crb_runtime_error(inter, env, line_number,
                           ARRAY_RESIZE_ARGUMENT_ERR,
                           CRB_STRING_MESSAGE_ARGUMENT,
                           "type", CRB_get_type_name(new_size->type),
@@ -1056,9 +1704,35 @@ array_resize_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     result->type = CRB_NULL_VALUE;
 }
 
+static void
+array_reserve_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                     int line_number, CRB_Object *obj, CRB_Value *result)
+{
+    CRB_Value *alloc_size;
+
+    alloc_size = peek_stack(inter, 0);
+    if (alloc_size->type != CRB_INT_VALUE) {
+        crb_runtime_error(inter, env, line_number,
+                          ARRAY_RESERVE_ARGUMENT_ERR,
+                          CRB_STRING_MESSAGE_ARGUMENT,
+                          "type", CRB_get_type_name(alloc_size->type),
+                          CRB_MESSAGE_ARGUMENT_END);
+    }
+    CRB_array_reserve(inter, obj, alloc_size->u.int_value);
+    result->type = CRB_NULL_VALUE;
+}
+
+static void
+array_shrink_to_fit_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                           int line_number, CRB_Object *obj, CRB_Value *result)
+{
+    CRB_array_shrink_to_fit(inter, obj);
+    result->type = CRB_NULL_VALUE;
+}
+
 static void
 array_insert_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                    CRB_Object *obj, CRB_Value *result)
+                    int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value *new_value;
     CRB_Value *pos;
@@ -1066,39 +1740,39 @@ array_insert_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     new_value = peek_stack(inter, 0);
     pos = peek_stack(inter, 1);
     if (pos->type != CRB_INT_VALUE) {
-        crb_runtime_error(inter, env, __LINE__,
+        crb_runtime_error(inter, env, line_number,
                           ARRAY_INSERT_ARGUMENT_ERR,
                           CRB_STRING_MESSAGE_ARGUMENT,
                           "type", CRB_get_type_name(pos->type),
                           CRB_MESSAGE_ARGUMENT_END);
     }
     CRB_array_insert(inter, env, obj, pos->u.int_value,
-                     new_value, __LINE__);
+                     new_value, line_number);
     result->type = CRB_NULL_VALUE;
 }
 
 static void
 array_remove_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                    CRB_Object *obj, CRB_Value *result)
+                    int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value *pos;
 
     pos = peek_stack(inter, 0);
     if (pos->type != CRB_INT_VALUE) {
-        crb_runtime_error(inter, env, __LINE__,
+        crb_runtime_error(inter, env, line_number,
                           ARRAY_REMOVE_ARGUMENT_ERR,
                           CRB_STRING_MESSAGE_ARGUMENT,
                           "type", CRB_get_type_name(pos->type),
                           CRB_MESSAGE_ARGUMENT_END);
     }
     CRB_array_remove(inter, env, obj, pos->u.int_value,
-                     __LINE__);
+                     line_number);
     result->type = CRB_NULL_VALUE;
 }
 
 static void
 array_iterator_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                    CRB_Object *obj, CRB_Value *result)
+                    int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value ret;
     CRB_Value array;
@@ -1106,15 +1780,52 @@ array_iterator_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     array.type = CRB_ARRAY_VALUE;
     array.u.object = obj;
 
-    ret = CRB_call_function_by_name(inter, env, __LINE__,
+    ret = CRB_call_function_by_name(inter, env, line_number,
                                     ARRAY_ITERATOR_METHOD_NAME,
                                     1, &array);
     *result = ret;
 }
 
+/*
+ * foreach walks arrays and strings by index instead of
+ * calling the iterator protocol.
+ */
+CRB_Boolean
+crb_is_native_iterable(CRB_Value *collection)
+{
+    return collection->type == CRB_ARRAY_VALUE
+        || collection->type == CRB_STRING_VALUE;
+}
+
+CRB_Boolean
+crb_foreach_is_done(CRB_Object *collection, int index)
+{
+    if (collection->type == ARRAY_OBJECT) {
+        return index >= collection->u.array.size;
+    }
+    return collection->u.string.string[index] == L'\0';
+}
+
+void
+crb_foreach_current_item(CRB_Interpreter *inter, CRB_Object *collection,
+                         int index, CRB_Value *item)
+{
+    CRB_Char    *str;
+
+    if (collection->type == ARRAY_OBJECT) {
+        *item = collection->u.array.array[index];
+        return;
+    }
+    str = MEM_malloc(sizeof(CRB_Char) * 2);
+    str[0] = collection->u.string.string[index];
+    str[1] = L'\0';
+    item->u.object = crb_create_crowbar_string_i(inter, str);
+    item->type = CRB_STRING_VALUE;
+}
+
 static void
 string_length_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                     CRB_Object *obj, CRB_Value *result)
+                     int line_number, CRB_Object *obj, CRB_Value *result)
 {
     result->type = CRB_INT_VALUE;
     result->u.int_value = CRB_wcslen(obj->u.string.string);
@@ -1122,7 +1833,7 @@ string_length_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 static void
 string_substr_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                     CRB_Object *obj, CRB_Value *result)
+                     int line_number, CRB_Object *obj, CRB_Value *result)
 {
     CRB_Value *arg1;
     CRB_Value *arg2;
@@ -1131,7 +1842,7 @@ string_substr_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     arg2 = peek_stack(inter, 0);
 
     if (arg1->type != CRB_INT_VALUE || arg2->type != CRB_INT_VALUE) {
-        crb_runtime_error(inter, env, __LINE__,
+        crb_runtime_error(inter, env, line_number,
                           STRING_SUBSTR_ARGUMENT_ERR,
                           CRB_STRING_MESSAGE_ARGUMENT,
                           "type1", CRB_get_type_name(arg1->type),
@@ -1143,13 +1854,15 @@ string_substr_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     result->u.object
         = crb_string_substr_i(inter, env, obj,
                               arg1->u.int_value, arg2->u.int_value,
-                              __LINE__);
+                              line_number);
 }
 
 static FakeMethodTable st_fake_method_table[] = {
     {ARRAY_OBJECT, "add", 1, array_add_method},
     {ARRAY_OBJECT, "size", 0, array_size_method},
     {ARRAY_OBJECT, "resize", 1, array_resize_method},
+    {ARRAY_OBJECT, "reserve", 1, array_reserve_method},
+    {ARRAY_OBJECT, "shrink_to_fit", 0, array_shrink_to_fit_method},
     {ARRAY_OBJECT, "insert", 2, array_insert_method},
     {ARRAY_OBJECT, "remove", 1, array_remove_method},
     {ARRAY_OBJECT, "iterator", 0, array_iterator_method},
@@ -1159,13 +1872,18 @@ static FakeMethodTable st_fake_method_table[] = {
 
 static FakeMethodTable *
 search_fake_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                   int line_number, CRB_FakeMethod *fm)
+                   int line_number, CRB_FakeMethod *fm, int *cache)
 {
     int i;
 
+    if (cache && *cache >= 0
+        && fm->object->type == st_fake_method_table[*cache].type
+        && fm->method_name == inter->fake_method_name[*cache]) {
+        return &st_fake_method_table[*cache];
+    }
     for (i = 0; i < ARRAY_SIZE(st_fake_method_table); i++) {
         if (fm->object->type == st_fake_method_table[i].type
-            && !strcmp(fm->method_name, st_fake_method_table[i].name)) {
+            && fm->method_name == inter->fake_method_name[i]) {
             break;
         }
     }
@@ -1175,57 +1893,69 @@ search_fake_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           fm->method_name,
                           CRB_MESSAGE_ARGUMENT_END);
     }
+    if (cache) {
+        *cache = i;
+    }
 
     return &st_fake_method_table[i];
 }
 
+/*
+ * The method names of the fake method table as symbols of the interpreter,
+ * so that search_fake_method() can compare them by pointer.
+ */
+void
+crb_intern_fake_method_names(CRB_Interpreter *inter)
+{
+    int i;
+
+    inter->fake_method_name
+        = MEM_storage_malloc(inter->interpreter_storage,
+                             sizeof(char*) * ARRAY_SIZE(st_fake_method_table));
+    for (i = 0; i < ARRAY_SIZE(st_fake_method_table); i++) {
+        inter->fake_method_name[i]
+            = CRB_intern(inter, st_fake_method_table[i].name);
+    }
+}
+
+/*
+ * Fake methods run in the environment of the caller. The fake method
+ * value on the stack keeps the object alive while the method runs.
+ * The fake method and its arguments are replaced with the return value.
+ */
 static void
 call_fake_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                 CRB_LocalEnvironment *caller_env,
-                 Expression *expr, CRB_FakeMethod *fm)
+                 int line_number, int arg_count, int *cache)
 {
     CRB_Value           result;
-    ArgumentList        *arg_p;
-    int arg_count = 0;
+    CRB_FakeMethod      *fm;
     FakeMethodTable *fmt;
 
-    fmt = search_fake_method(inter, env, expr->line_number, fm);
-
-    for (arg_p = expr->u.function_call_expression.argument;
-         arg_p; arg_p = arg_p->next) {
-        arg_count++;
-    }
-    check_method_argument_count(inter, env, expr->line_number,
-                                arg_count,
-                                fmt->argument_count);
-    for (arg_p = expr->u.function_call_expression.argument;
-         arg_p; arg_p = arg_p->next) {
-        eval_expression(inter, caller_env, arg_p->expression);
-    }
-    fmt->func(inter, env, fm->object, &result);
-    shrink_stack(inter, arg_count);
+    fm = &peek_stack(inter, arg_count)->u.fake_method;
+    fmt = search_fake_method(inter, env, line_number, fm, cache);
+    check_method_argument_count(inter, env, line_number,
+                                arg_count, fmt->argument_count);
+    fmt->func(inter, env, line_number, fm->object, &result);
+    shrink_stack(inter, arg_count + 1);
     push_value(inter, &result);
 }
 
 static void
 do_function_call(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                 CRB_LocalEnvironment *caller_env, Expression *expr,
-                 CRB_Value *func)
+                 CRB_LocalEnvironment *caller_env, int line_number,
+                 CRB_Value *func, int arg_count)
 {
-    if (func->type == CRB_FAKE_METHOD_VALUE) {
-        call_fake_method(inter, env, caller_env, expr, &func->u.fake_method);
-        return;
-    }
-
     DBG_assert(func->type == CRB_CLOSURE_VALUE,
                ("func->type..%d\n", func->type));
     switch (func->u.closure.function->type) {
     case CRB_CROWBAR_FUNCTION_DEFINITION:
-        call_crowbar_function(inter, env, caller_env, expr, func);
+        call_crowbar_function(inter, env, caller_env, line_number, func,
+                              arg_count);
         break;
     case CRB_NATIVE_FUNCTION_DEFINITION:
-        call_native_function(inter, env, caller_env, expr,
-                             func->u.closure.function->u.native_f.proc);
+        call_native_function(inter, env,
+                             func->u.closure.function->u.native_f.proc,
+                             arg_count);
         break;
     case CRB_FUNCTION_DEFINITION_TYPE_COUNT_PLUS_1:
     default:
@@ -1234,55 +1964,40 @@ do_function_call(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 
 }
 
-static void
-eval_function_call_expression(CRB_Interpreter *inter,
-                              CRB_LocalEnvironment *env,
-                              Expression *expr)
+/*
+ * The function and its arg_count arguments are on the stack.
+ * They are replaced with the return value.
+ */
+void
+crb_call_function_on_stack(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                           int line_number, int arg_count)
 {
-    CRB_Value   *func;
+    CRB_Value   func;
+    CRB_FunctionDefinition      *fd;
     CRB_LocalEnvironment        *local_env;
     CRB_Object                  *closure_env;
     char                        *func_name;
-    RecoveryEnvironment env_backup;
     CRB_Value   return_value;
-    int stack_pointer_backup;
 
-    eval_expression(inter, env,
-                    expr->u.function_call_expression.function);
-    func = peek_stack(inter, 0);
-    if (func->type == CRB_CLOSURE_VALUE) {
-        func_name = func->u.closure.function->name;
-        closure_env = func->u.closure.environment;
-    } else if (func->type == CRB_FAKE_METHOD_VALUE) {
-        func_name = func->u.fake_method.method_name;
-        closure_env = NULL;
+    func = *peek_stack(inter, arg_count);
+    if (func.type == CRB_CLOSURE_VALUE) {
+        fd = func.u.closure.function;
+        func_name = fd->name;
+        closure_env = func.u.closure.environment;
+    } else if (func.type == CRB_FAKE_METHOD_VALUE) {
+        call_fake_method(inter, env, line_number, arg_count, NULL);
+        return;
     } else {
-        crb_runtime_error(inter, env, expr->line_number,
+        crb_runtime_error(inter, env, line_number,
                           NOT_FUNCTION_ERR,
                           CRB_MESSAGE_ARGUMENT_END);
     }
     
-    local_env = alloc_local_environment(inter, func_name, expr->line_number,
+    local_env = alloc_local_environment(inter, func_name, line_number, fd,
                                         closure_env);
-    if (func->type == CRB_CLOSURE_VALUE
-        && func->u.closure.function->is_closure
-        && func->u.closure.function->name) {
-        CRB_add_assoc_member(inter,
-                             local_env->variable->u.scope_chain.frame,
-                             func->u.closure.function->name,
-                             func, CRB_TRUE);
-    }
-
-    stack_pointer_backup = crb_get_stack_pointer(inter);
-    env_backup = inter->current_recovery_environment;
-    if (setjmp(inter->current_recovery_environment.environment) == 0) {
-        do_function_call(inter, local_env, env, expr, func);
-    } else {
-        dispose_local_environment(inter);
-        crb_set_stack_pointer(inter, stack_pointer_backup);
-        longjmp(env_backup.environment, LONGJMP_ARG);
-    }
-    inter->current_recovery_environment = env_backup;
+    define_closure_slot(local_env, &func);
+
+    do_function_call(inter, local_env, env, line_number, &func, arg_count);
     dispose_local_environment(inter);
 
     return_value = pop_value(inter);
@@ -1290,168 +2005,186 @@ eval_function_call_expression(CRB_Interpreter *inter,
     push_value(inter, &return_value);
 }
 
-static CRB_Value
-call_crowbar_function_from_native(CRB_Interpreter *inter,
-                                  CRB_LocalEnvironment *env,
-                                  int line_number,
-                                  CRB_LocalEnvironment *caller_env,
-                                  CRB_Value *func,
-                                  int arg_count, CRB_Value *args)
+/*
+ * Same as crb_call_function_on_stack(), but a fake method is looked up
+ * through the cache of the function call expression.
+ */
+void
+crb_call_function_expression(CRB_Interpreter *inter,
+                             CRB_LocalEnvironment *env, Expression *expr,
+                             int arg_count)
+{
+    if (peek_stack(inter, arg_count)->type == CRB_FAKE_METHOD_VALUE) {
+        call_fake_method(inter, env, expr->line_number, arg_count,
+                         &expr->u.function_call_expression
+                         .fake_method_index);
+        return;
+    }
+    crb_call_function_on_stack(inter, env, expr->line_number, arg_count);
+}
+
+/*
+ * The object of the size() call is on the stack. An array is replaced
+ * with its size, anything else is called as usual.
+ */
+void
+crb_array_size_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Expression *expr)
 {
-    CRB_Value   value;
-    StatementResult     result;
-    int arg_idx;
-    CRB_ParameterList   *param_p;
+    CRB_Value   *obj = peek_stack(inter, 0);
+    int         size;
 
-    for (arg_idx = 0,
-             param_p = func->u.closure.function->u.crowbar_f.parameter;
-         arg_idx < arg_count;
-         arg_idx++, param_p = param_p->next) {
-        if (param_p == NULL) {
-            crb_runtime_error(inter, caller_env, line_number,
-                              ARGUMENT_TOO_MANY_ERR,
-                              CRB_MESSAGE_ARGUMENT_END);
-        }
-        CRB_add_local_variable(inter, env, param_p->name, &args[arg_idx],
-                               CRB_FALSE);
-    }
-    if (param_p) {
-        crb_runtime_error(inter, caller_env, line_number,
-                          ARGUMENT_TOO_FEW_ERR,
-                          CRB_MESSAGE_ARGUMENT_END);
+    if (obj->type == CRB_ARRAY_VALUE) {
+        size = obj->u.object->u.array.size;
+        obj->type = CRB_INT_VALUE;
+        obj->u.int_value = size;
+        return;
     }
+    crb_member_operation(inter, env, expr->u.function_call_expression.function);
+    crb_call_function_expression(inter, env, expr, 0);
+}
 
-    result = crb_execute_statement_list(inter, env,
-                                        func->u.closure.function
-                                        ->u.crowbar_f.block->statement_list);
+/*
+ * The function and its arg_count arguments are on the stack.
+ * When the function is the one inlined at expr, an inline frame
+ * is pushed for its body to read the arguments.
+ */
+CRB_Boolean
+crb_enter_inline_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          Expression *expr, int arg_count)
+{
+    CRB_Value   *func = peek_stack(inter, arg_count);
+    InlineFrameStack    *stack = &inter->inline_frame;
+    InlineFrame *frame;
 
-    if (result.type == RETURN_STATEMENT_RESULT) {
-        value = result.u.return_value;
-    } else {
-        value.type = CRB_NULL_VALUE;
+    if (func->type != CRB_CLOSURE_VALUE
+        || func->u.closure.function
+        != expr->u.function_call_expression.inline_function) {
+        return CRB_FALSE;
     }
-    
-    return value;
+    if (stack->frame_count == stack->frame_alloc_size) {
+        stack->frame_alloc_size += 8;
+        stack->frame = MEM_realloc(stack->frame,
+                                   sizeof(InlineFrame)
+                                   * stack->frame_alloc_size);
+    }
+    frame = &stack->frame[stack->frame_count];
+    frame->function = func->u.closure.function;
+    frame->env = env;
+    frame->caller_line_number = expr->line_number;
+    frame->base = inter->stack.stack_pointer - arg_count;
+    stack->frame_count++;
+
+    return CRB_TRUE;
 }
 
-static CRB_Value
-call_native_function_from_native(CRB_Interpreter *inter,
-                                 CRB_LocalEnvironment *env,
-                                 int line_number,
-                                 CRB_LocalEnvironment *caller_env,
-                                 CRB_Value *func,
-                                 int arg_count, CRB_Value *args)
-{
-    CRB_Value value;
-    int i;
-    CRB_Value *arg_p;
+/*
+ * The value of the inlined body replaces the function and its arguments.
+ */
+void
+crb_leave_inline_function(CRB_Interpreter *inter, int arg_count)
+{
+    CRB_Value   result;
 
-    for (i = 0; i < arg_count; i++) {
-        push_value(inter, &args[i]);
+    result = pop_value(inter);
+    shrink_stack(inter, arg_count + 1);
+    push_value(inter, &result);
+    inter->inline_frame.frame_count--;
+}
+
+void
+crb_inline_parameter(CRB_Interpreter *inter, int index)
+{
+    InlineFrameStack    *stack = &inter->inline_frame;
+    CRB_Value   value;
+
+    value = inter->stack.stack[stack->frame[stack->frame_count-1].base
+                               + index];
+    push_value(inter, &value);
+}
+
+/*
+ * Pushes the function and the arguments of the call, and returns
+ * the number of the arguments.
+ */
+static int
+eval_function_and_arguments(CRB_Interpreter *inter,
+                            CRB_LocalEnvironment *env, Expression *expr)
+{
+    ArgumentList        *arg_p;
+    int         arg_count = 0;
+
+    eval_expression(inter, env,
+                    expr->u.function_call_expression.function);
+    for (arg_p = expr->u.function_call_expression.argument;
+         arg_p; arg_p = arg_p->next) {
+        eval_expression(inter, env, arg_p->expression);
+        arg_count++;
     }
-    arg_p = &inter->stack.stack[inter->stack.stack_pointer-arg_count];
-    value = func->u.closure.function->u.native_f.proc(inter, env,
-                                                      arg_count, arg_p);
-    shrink_stack(inter, arg_count);
 
-    return value;
+    return arg_count;
 }
 
-static CRB_Value
-call_fake_method_from_native(CRB_Interpreter *inter,
-                             CRB_LocalEnvironment *env,
-                             int line_number,
-                             CRB_LocalEnvironment *caller_env,
-                             CRB_Value *func,
-                             int arg_count, CRB_Value *args)
-{
-    CRB_Value value;
-    FakeMethodTable *fmt;
-    int i;
+static void
+eval_function_call_expression(CRB_Interpreter *inter,
+                              CRB_LocalEnvironment *env,
+                              Expression *expr)
+{
+    int         arg_count;
 
-    fmt = search_fake_method(inter, env, line_number, &func->u.fake_method);
-    check_method_argument_count(inter, env, line_number, arg_count,
-                                fmt->argument_count);
-    for (i = 0; i < arg_count; i++) {
-        push_value(inter, &args[i]);
+    if (expr->u.function_call_expression.is_array_size) {
+        eval_expression(inter, env,
+                        expr->u.function_call_expression.function
+                        ->u.member_expression.expression);
+        crb_array_size_operation(inter, env, expr);
+        return;
     }
-    fmt->func(inter, env, func->u.fake_method.object, &value);
-    shrink_stack(inter, arg_count);
+    arg_count = eval_function_and_arguments(inter, env, expr);
+    if (expr->u.function_call_expression.inline_function
+        && crb_enter_inline_function(inter, env, expr, arg_count)) {
+        eval_expression(inter, env,
+                        expr->u.function_call_expression.inline_body);
+        crb_leave_inline_function(inter, arg_count);
+        return;
+    }
+    crb_call_function_expression(inter, env, expr, arg_count);
+}
+
+/*
+ * Leaves the function and the arguments of the call on the stack
+ * for call_crowbar_function().
+ */
+StatementResult
+crb_eval_tail_call(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                   Expression *expr)
+{
+    StatementResult result;
+
+    result.type = TAIL_CALL_STATEMENT_RESULT;
+    result.u.tail_call.expression = expr;
+    result.u.tail_call.argument_count
+        = eval_function_and_arguments(inter, env, expr);
 
-    return value;
+    return result;
 }
 
 /* 
- * See also eval_function_call_expression().
+ * See also crb_call_function_on_stack().
  */
 CRB_Value
 CRB_call_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                   int line_number, CRB_Value *func,
                   int arg_count, CRB_Value *args)
 {
-    CRB_Value ret;
-    CRB_LocalEnvironment        *local_env;
-    CRB_Object                  *closure_env;
-    char                        *func_name;
-    RecoveryEnvironment env_backup;
-    int stack_pointer_backup;
-
-    if (func->type == CRB_CLOSURE_VALUE) {
-        func_name = func->u.closure.function->name;
-        closure_env = func->u.closure.environment;
-    } else if (func->type == CRB_FAKE_METHOD_VALUE) {
-        func_name = func->u.fake_method.method_name;
-        closure_env = NULL;
-    } else {
-        DBG_panic(("func->type..%d\n", func->type));
-    }
-    local_env
-        = alloc_local_environment(inter, func_name, line_number, closure_env);
-    if (func->type == CRB_CLOSURE_VALUE
-        && func->u.closure.function->is_closure
-        && func->u.closure.function->name) {
-        CRB_add_assoc_member(inter,
-                             local_env->variable->u.scope_chain.frame,
-                             func->u.closure.function->name,
-                             func, CRB_TRUE);
-    }
-
-    stack_pointer_backup = crb_get_stack_pointer(inter);
-    env_backup = inter->current_recovery_environment;
-    if (setjmp(inter->current_recovery_environment.environment) == 0) {
-        if (func->type == CRB_CLOSURE_VALUE) {
-            switch (func->u.closure.function->type) {
-            case CRB_CROWBAR_FUNCTION_DEFINITION:
-                ret = call_crowbar_function_from_native(inter, local_env,
-                                                        line_number, env, func,
-                                                        arg_count, args);
-                break;
-            case CRB_NATIVE_FUNCTION_DEFINITION:
-                ret = call_native_function_from_native(inter, local_env,
-                                                       line_number, env,
-                                                       func, arg_count, args);
-                break;
-            case CRB_FUNCTION_DEFINITION_TYPE_COUNT_PLUS_1:
-            default:
-                DBG_assert(0, ("bad case..%d\n",
-                               func->u.closure.function->type));
-            }
-        } else if (func->type == CRB_FAKE_METHOD_VALUE) {
-            ret = call_fake_method_from_native(inter, local_env,
-                                               line_number, env,
-                                               func, arg_count, args);
-        } else {
-            DBG_panic(("func->type..%d\n", func->type));
-        }
-    } else {
-        dispose_local_environment(inter);
-        crb_set_stack_pointer(inter, stack_pointer_backup);
-        longjmp(env_backup.environment, LONGJMP_ARG);
+    int i;
+
+    push_value(inter, func);
+    for (i = 0; i < arg_count; i++) {
+        push_value(inter, &args[i]);
     }
-    inter->current_recovery_environment = env_backup;
-    dispose_local_environment(inter);
+    crb_call_function_on_stack(inter, env, line_number, arg_count);
 
-    return ret;
+    return pop_value(inter);
 }
 
 CRB_Value
@@ -1469,7 +2202,9 @@ CRB_call_function_by_name(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           FUNCTION_NOT_FOUND_ERR, "name", func_name,
                           CRB_MESSAGE_ARGUMENT_END);
     }
-    func = CRB_create_closure(env, fd);
+    func.type = CRB_CLOSURE_VALUE;
+    func.u.closure.function = fd;
+    func.u.closure.environment = NULL;
 
     ret = CRB_call_function(inter, env, line_number, &func, arg_count, args);
 
@@ -1484,13 +2219,15 @@ CRB_call_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Value func;
     CRB_Value result;
 
+    method_name = CRB_intern(inter, method_name);
     if (obj->type == STRING_OBJECT || obj->type == ARRAY_OBJECT) {
         func.type = CRB_FAKE_METHOD_VALUE;
         func.u.fake_method.method_name = method_name;
         func.u.fake_method.object = obj;
     } else if (obj->type == ASSOC_OBJECT) {
         CRB_Value *func_p;
-        func_p = CRB_search_assoc_member(obj, method_name);
+        CRB_Boolean is_final; /* dummy */
+        func_p = crb_search_assoc_member_i(obj, method_name, &is_final);
         if (func_p->type != CRB_CLOSURE_VALUE) {
             crb_runtime_error(inter, env, line_number,
                               NOT_FUNCTION_ERR,
@@ -1508,19 +2245,22 @@ CRB_call_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return result;
 }
 
-static void
-eval_member_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                       Expression *expr)
+/*
+ * Replaces the object on the top of the stack with its member.
+ */
+void
+crb_member_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                     Expression *expr)
 {
     CRB_Value left;
 
-    eval_expression(inter,env, expr->u.member_expression.expression);
     left = pop_value(inter);
     
     if (left.type == CRB_ASSOC_VALUE) {
         CRB_Value *v;
-        v = CRB_search_assoc_member(left.u.object,
-                                    expr->u.member_expression.member_name);
+        CRB_Boolean is_final; /* dummy */
+        v = search_member(inter, left.u.object, &expr->u.member_expression,
+                          &is_final);
         if (v == NULL) {
             crb_runtime_error(inter, env, expr->line_number,
                               NO_SUCH_MEMBER_ERR,
@@ -1543,6 +2283,14 @@ eval_member_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     }
 }
 
+static void
+eval_member_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       Expression *expr)
+{
+    eval_expression(inter,env, expr->u.member_expression.expression);
+    crb_member_operation(inter, env, expr);
+}
+
 static void
 eval_array_expression(CRB_Interpreter *inter,
                       CRB_LocalEnvironment *env, ExpressionList *list)
@@ -1563,6 +2311,7 @@ eval_array_expression(CRB_Interpreter *inter,
     for (pos = list, i = 0; pos; pos = pos->next, i++) {
         eval_expression(inter, env, pos->expression);
         v.u.object->u.array.array[i] = pop_value(inter);
+        crb_write_barrier(inter, v.u.object, &v.u.object->u.array.array[i]);
     }
 }
 
@@ -1577,15 +2326,17 @@ eval_index_expression(CRB_Interpreter *inter,
     push_value(inter, left);
 }
 
-static void
-eval_inc_dec_expression(CRB_Interpreter *inter,
-                        CRB_LocalEnvironment *env, Expression *expr)
+/*
+ * operand is the lvalue of expr->u.inc_dec.operand.
+ * The old value is pushed as the result.
+ */
+void
+crb_inc_dec_operation(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      Expression *expr, CRB_Value *operand)
 {
-    CRB_Value   *operand;
     CRB_Value   result;
     int         old_value;
-    
-    operand = get_lvalue(inter, env, expr->u.inc_dec.operand);
+
     if (operand == NULL) {
         crb_runtime_error(inter, env, expr->line_number,
                           INC_DEC_OPERAND_NOT_EXIST_ERR,
@@ -1610,6 +2361,50 @@ eval_inc_dec_expression(CRB_Interpreter *inter,
     push_value(inter, &result);
 }
 
+/*
+ * The optimizer has proven the operand to be an int local variable.
+ * The guard fails only if native code has changed the variable.
+ */
+void
+crb_inc_dec_local_int_operation(CRB_Interpreter *inter,
+                                CRB_LocalEnvironment *env, Expression *expr)
+{
+    Expression  *operand = expr->u.inc_dec.operand;
+    Slot        *slot;
+    CRB_Value   result;
+
+    slot = &env->variable->u.scope_chain.slot[operand->u.identifier.index];
+    if (!slot->is_defined || slot->value.type != CRB_INT_VALUE) {
+        crb_inc_dec_operation(inter, env, expr,
+                              crb_get_identifier_lvalue(inter, env,
+                                                        operand->line_number,
+                                                        &operand
+                                                        ->u.identifier));
+        return;
+    }
+    result = slot->value;
+    if (expr->type == INCREMENT_EXPRESSION) {
+        slot->value.u.int_value++;
+    } else {
+        slot->value.u.int_value--;
+    }
+    push_value(inter, &result);
+}
+
+static void
+eval_inc_dec_expression(CRB_Interpreter *inter,
+                        CRB_LocalEnvironment *env, Expression *expr)
+{
+    CRB_Value   *operand;
+
+    if (expr->u.inc_dec.is_local_int) {
+        crb_inc_dec_local_int_operation(inter, env, expr);
+        return;
+    }
+    operand = get_lvalue(inter, env, expr->u.inc_dec.operand);
+    crb_inc_dec_operation(inter, env, expr, operand);
+}
+
 static void
 eval_closure_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                         Expression *expr)
@@ -1620,6 +2415,7 @@ eval_closure_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     result.u.closure.function = expr->u.closure.function_definition;
     if (env) {
         result.u.closure.environment = env->variable;
+        crb_capture_scope_chain(inter, env->variable);
     } else {
         result.u.closure.environment = NULL;
     }
@@ -1648,7 +2444,7 @@ eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         eval_regexp_expression(inter, expr->u.regexp_value);
         break;
     case IDENTIFIER_EXPRESSION:
-        eval_identifier_expression(inter, env, expr);
+        crb_eval_identifier(inter, env, expr);
         break;
     case COMMA_EXPRESSION:
         eval_comma_expression(inter, env, expr);
@@ -1667,9 +2463,7 @@ eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     case GE_EXPRESSION: /* FALLTHRU */
     case LT_EXPRESSION: /* FALLTHRU */
     case LE_EXPRESSION:
-        eval_binary_expression(inter, env, expr->type,
-                               expr->u.binary_expression.left,
-                               expr->u.binary_expression.right);
+        eval_quickened_binary_expression(inter, env, expr);
         break;
     case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
     case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
@@ -1705,6 +2499,9 @@ eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     case DECREMENT_EXPRESSION:
         eval_inc_dec_expression(inter, env, expr);
         break;
+    case INLINE_PARAMETER_EXPRESSION:
+        crb_inline_parameter(inter, expr->u.inline_parameter);
+        break;
     case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
     default:
         DBG_assert(0, ("bad case. type..%d\n", expr->type));
@@ -22,14 +22,11 @@ execute_expression_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return result;
 }
 
-static StatementResult
-execute_global_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                         Statement *statement)
+void
+crb_execute_global_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                             Statement *statement)
 {
     IdentifierList *pos;
-    StatementResult result;
-
-    result.type = NORMAL_STATEMENT_RESULT;
 
     if (env == NULL) {
         crb_runtime_error(inter, env, statement->line_number,
@@ -37,29 +34,31 @@ execute_global_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           CRB_MESSAGE_ARGUMENT_END);
     }
     for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
-        GlobalVariableRef *ref_pos;
-        GlobalVariableRef *new_ref;
-        Variable *variable;
-        for (ref_pos = env->global_variable; ref_pos;
-             ref_pos = ref_pos->next) {
-            if (!strcmp(ref_pos->name, pos->name))
-                goto NEXT_IDENTIFIER;
-        }
-        variable = crb_search_global_variable(inter, pos->name);
-        if (variable == NULL) {
-            crb_runtime_error(inter, env, statement->line_number,
-                              GLOBAL_VARIABLE_NOT_FOUND_ERR,
-                              CRB_STRING_MESSAGE_ARGUMENT, "name", pos->name,
-                              CRB_MESSAGE_ARGUMENT_END);
+        if (pos->global_variable == NULL) {
+            pos->global_variable = crb_search_global_variable(inter,
+                                                              pos->name);
+            if (pos->global_variable == NULL) {
+                crb_runtime_error(inter, env, statement->line_number,
+                                  GLOBAL_VARIABLE_NOT_FOUND_ERR,
+                                  CRB_STRING_MESSAGE_ARGUMENT,
+                                  "name", pos->name,
+                                  CRB_MESSAGE_ARGUMENT_END);
+            }
         }
-        new_ref = MEM_malloc(sizeof(GlobalVariableRef));
-        new_ref->name = pos->name;
-        new_ref->variable = variable;
-        new_ref->next = env->global_variable;
-        env->global_variable = new_ref;
-      NEXT_IDENTIFIER:
-        ;
+        DBG_assert(pos->global_index >= 0,
+                   ("%s is not resolved.\n", pos->name));
+        env->global_variable[pos->global_index] = pos->global_variable;
     }
+}
+
+static StatementResult
+execute_global_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         Statement *statement)
+{
+    StatementResult result;
+
+    result.type = NORMAL_STATEMENT_RESULT;
+    crb_execute_global_statement(inter, env, statement);
 
     return result;
 }
@@ -130,6 +129,9 @@ execute_if_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return result;
 }
 
+/*
+ * A break or continue labeled for an outer loop leaves this loop too.
+ */
 static StatementResultType
 compare_labels(char *result_label, char *loop_label, 
                StatementResultType current_result)
@@ -137,7 +139,7 @@ compare_labels(char *result_label, char *loop_label,
     if (result_label == NULL)
         return NORMAL_STATEMENT_RESULT;
 
-    if (loop_label && !strcmp(result_label, loop_label)) {
+    if (loop_label && result_label == loop_label) {
         return NORMAL_STATEMENT_RESULT;
     } else {
         return current_result;
@@ -167,7 +169,8 @@ execute_while_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         result = crb_execute_statement_list(inter, env,
                                             statement->u.while_s.block
                                             ->statement_list);
-        if (result.type == RETURN_STATEMENT_RESULT) {
+        if (result.type == RETURN_STATEMENT_RESULT
+            || result.type == TAIL_CALL_STATEMENT_RESULT) {
             break;
         } else if (result.type == BREAK_STATEMENT_RESULT) {
             result.type = compare_labels(result.u.label,
@@ -178,6 +181,8 @@ execute_while_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             result.type = compare_labels(result.u.label,
                                          statement->u.while_s.label,
                                          result.type);
+            if (result.type == CONTINUE_STATEMENT_RESULT)
+                break;
         }
     }
 
@@ -214,7 +219,8 @@ execute_for_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         result = crb_execute_statement_list(inter, env,
                                             statement->u.for_s.block
                                             ->statement_list);
-        if (result.type == RETURN_STATEMENT_RESULT) {
+        if (result.type == RETURN_STATEMENT_RESULT
+            || result.type == TAIL_CALL_STATEMENT_RESULT) {
             break;
         } else if (result.type == BREAK_STATEMENT_RESULT) {
             result.type = compare_labels(result.u.label,
@@ -225,6 +231,8 @@ execute_for_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             result.type = compare_labels(result.u.label,
                                          statement->u.for_s.label,
                                          result.type);
+            if (result.type == CONTINUE_STATEMENT_RESULT)
+                break;
         }
 
         if (statement->u.for_s.post) {
@@ -235,33 +243,80 @@ execute_for_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return result;
 }
 
-static CRB_Value *
-assign_to_variable(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
-                   int line_number, char *name, CRB_Value *value)
+CRB_Value *
+crb_assign_to_variable(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       int line_number, IdentifierExpression *variable,
+                       CRB_Value *value)
 {
     CRB_Value *ret;
 
-    ret = crb_get_identifier_lvalue(inter, env, line_number, name);
+    ret = crb_get_identifier_lvalue(inter, env, line_number, variable);
     if (ret == NULL) {
         if (env != NULL) {
-            ret = CRB_add_local_variable(inter, env, name, value, CRB_FALSE);
+            ret = crb_define_local_variable(inter, env, variable, value,
+                                            CRB_FALSE);
         } else {
-            if (CRB_search_function(inter, name)) {
+            if (crb_search_function(inter, variable->name)) {
                 crb_runtime_error(inter, env, line_number,
                                   FUNCTION_EXISTS_ERR,
                                   CRB_STRING_MESSAGE_ARGUMENT, "name",
-                                  name,
+                                  variable->name,
                                   CRB_MESSAGE_ARGUMENT_END);
             }
-            ret = CRB_add_global_variable(inter,  name, value, CRB_FALSE);
+            ret = CRB_add_global_variable(inter, variable->name, value,
+                                          CRB_FALSE);
         }
     } else {
         *ret = *value;
+        crb_variable_write_barrier(inter, env, ret);
     }
 
     return ret;
 }
 
+static StatementResult
+execute_native_foreach_statement(CRB_Interpreter *inter,
+                                 CRB_LocalEnvironment *env,
+                                 Statement *statement,
+                                 CRB_Object *collection)
+{
+    StatementResult result;
+    CRB_Value   *var;
+    CRB_Value   temp;
+    int         index;
+
+    result.type = NORMAL_STATEMENT_RESULT;
+
+    temp.type = CRB_NULL_VALUE;
+    var = crb_assign_to_variable(inter, env, statement->line_number,
+                                 &statement->u.foreach_s.variable,
+                                 &temp);
+    for (index = 0; !crb_foreach_is_done(collection, index); index++) {
+        crb_foreach_current_item(inter, collection, index, var);
+        crb_variable_write_barrier(inter, env, var);
+
+        result = crb_execute_statement_list(inter, env,
+                                            statement->u.foreach_s.block
+                                            ->statement_list);
+        if (result.type == RETURN_STATEMENT_RESULT) {
+            break;
+        } else if (result.type == BREAK_STATEMENT_RESULT) {
+            result.type = compare_labels(result.u.label,
+                                         statement->u.foreach_s.label,
+                                         result.type);
+            break;
+        } else if (result.type == CONTINUE_STATEMENT_RESULT) {
+            result.type = compare_labels(result.u.label,
+                                         statement->u.foreach_s.label,
+                                         result.type);
+            if (result.type == CONTINUE_STATEMENT_RESULT)
+                break;
+        }
+    }
+
+    return result;
+}
+
 static StatementResult
 execute_foreach_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                           Statement *statement)
@@ -281,7 +336,13 @@ execute_foreach_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                                        statement->u.foreach_s.collection);
     stack_count++;
     collection = CRB_peek_stack(inter, 0);
-    
+    if (crb_is_native_iterable(collection)) {
+        result = execute_native_foreach_statement(inter, env, statement,
+                                                  collection->u.object);
+        CRB_shrink_stack(inter, stack_count);
+        return result;
+    }
+
     iterator = CRB_call_method(inter, env, statement->line_number,
                                collection->u.object, ITERATOR_METHOD_NAME,
                                0, NULL);
@@ -289,9 +350,9 @@ execute_foreach_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     stack_count++;
 
     temp.type = CRB_NULL_VALUE;
-    var = assign_to_variable(inter, env, statement->line_number,
-                             statement->u.foreach_s.variable,
-                             &temp);
+    var = crb_assign_to_variable(inter, env, statement->line_number,
+                                 &statement->u.foreach_s.variable,
+                                 &temp);
     for (;;) {
         is_done = CRB_call_method(inter, env, statement->line_number,
                                   iterator.u.object, IS_DONE_METHOD_NAME,
@@ -308,9 +369,10 @@ execute_foreach_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         *var = CRB_call_method(inter, env, statement->line_number,
                                iterator.u.object, CURRENT_ITEM_METHOD_NAME,
                                0, NULL);
+        crb_variable_write_barrier(inter, env, var);
 
         result = crb_execute_statement_list(inter, env,
-                                            statement->u.for_s.block
+                                            statement->u.foreach_s.block
                                             ->statement_list);
         if (result.type == RETURN_STATEMENT_RESULT) {
             break;
@@ -323,6 +385,8 @@ execute_foreach_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             result.type = compare_labels(result.u.label,
                                          statement->u.for_s.label,
                                          result.type);
+            if (result.type == CONTINUE_STATEMENT_RESULT)
+                break;
         }
 
         CRB_call_method(inter, env, statement->line_number,
@@ -340,6 +404,10 @@ execute_return_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 {
     StatementResult result;
 
+    if (statement->u.return_s.is_tail_call) {
+        return crb_eval_tail_call(inter, env,
+                                  statement->u.return_s.return_value);
+    }
     result.type = RETURN_STATEMENT_RESULT;
     if (statement->u.return_s.return_value) {
         result.u.return_value
@@ -382,15 +450,21 @@ execute_try_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
 {
     StatementResult result;
     int stack_pointer_backup;
+    int inline_frame_backup;
+    CRB_LocalEnvironment *top_env_backup;
     RecoveryEnvironment env_backup;
 
     stack_pointer_backup = crb_get_stack_pointer(inter);
+    top_env_backup = inter->top_environment;
+    inline_frame_backup = inter->inline_frame.frame_count;
     env_backup = inter->current_recovery_environment;
     if (setjmp(inter->current_recovery_environment.environment) == 0) {
         result = crb_execute_statement_list(inter, env,
                                             statement->u.try_s.try_block
                                             ->statement_list);
     } else {
+        crb_unwind_local_environment(inter, top_env_backup);
+        inter->inline_frame.frame_count = inline_frame_backup;
         crb_set_stack_pointer(inter, stack_pointer_backup);
         inter->current_recovery_environment = env_backup;
 
@@ -401,8 +475,8 @@ execute_try_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             CRB_push_value(inter, &ex_value);
             inter->current_exception.type = CRB_NULL_VALUE;
 
-            assign_to_variable(inter, env, statement->line_number,
-                               statement->u.try_s.exception, &ex_value);
+            crb_assign_to_variable(inter, env, statement->line_number,
+                                   &statement->u.try_s.exception, &ex_value);
 
             result = crb_execute_statement_list(inter, env,
                                                 statement->u.try_s.catch_block
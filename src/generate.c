@@ -0,0 +1,950 @@
+#include <stdarg.h>
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+#define CODE_ALLOC_SIZE         (256)
+#define LABEL_TABLE_ALLOC_SIZE  (32)
+#define TRY_REGION_ALLOC_SIZE   (8)
+
+/*
+ * parameter
+ *   i: int, d: double, p: pointer, l: label
+ */
+typedef struct {
+    char        *mnemonic;
+    char        *parameter;
+    int         stack_increment;
+} OpcodeInfo;
+
+static OpcodeInfo st_opcode_info[] = {
+    {"dummy", "", 0},
+    {"push_boolean", "i", 1},
+    {"push_int", "i", 1},
+    {"push_double", "d", 1},
+    {"push_string", "p", 1},
+    {"push_regexp", "p", 1},
+    {"push_null", "", 1},
+    {"push_identifier", "p", 1},
+    {"push_closure", "p", 1},
+    {"pop", "i", 0},            /* variable */
+    {"assign_identifier", "p", 0},
+    {"assign_member", "p", -1},
+    {"assign_index", "p", -2},
+    {"not_lvalue", "p", 0},
+    {"add", "p", -1},
+    {"sub", "p", -1},
+    {"mul", "p", -1},
+    {"div", "p", -1},
+    {"mod", "p", -1},
+    {"eq", "p", -1},
+    {"ne", "p", -1},
+    {"gt", "p", -1},
+    {"ge", "p", -1},
+    {"lt", "p", -1},
+    {"le", "p", -1},
+    {"logical_and", "pl", -1},
+    {"logical_or", "pl", -1},
+    {"logical_result", "", 0},
+    {"minus", "p", 0},
+    {"logical_not", "p", 0},
+    {"call", "pi", 0},          /* variable */
+    {"member", "p", 0},
+    {"index", "p", -1},
+    {"new_array", "i", 0},      /* variable */
+    {"inc_dec_identifier", "p", 1},
+    {"inc_dec_member", "p", 0},
+    {"inc_dec_index", "p", -1},
+    {"jump", "l", 0},
+    {"jump_if_false", "pl", -1},
+    {"global", "p", 0},
+    {"foreach_iterator", "p", 1},
+    {"foreach_init", "p", 0},
+    {"foreach_is_done", "pl", 0},
+    {"foreach_current_item", "p", 0},
+    {"foreach_next", "p", 0},
+    {"catch", "p", 1},
+    {"rethrow", "", 0},
+    {"throw", "", -1},
+    {"return", "", -1},
+    {"leave", "i", 0},
+    {"binary_int", "p", -1},    /* quickened by vm.c */
+    {"binary_double", "p", -1},
+    {"concat_string", "p", -1},
+    {"array_size", "p", 0},
+    {"inline_enter", "pil", 0},
+    {"inline_parameter", "i", 1},
+    {"inline_leave", "i", 0},   /* variable */
+    {"inc_dec_local_int", "p", 1},
+    {"tail_call", "pi", 0},
+};
+
+typedef enum {
+    LOOP_CONTROL = 1,
+    TRY_CONTROL,
+    FINALLY_CONTROL
+} ControlType;
+
+/*
+ * The statements enclosing the current position, innermost first.
+ * break, continue and return consult them to find their destination
+ * and the finally blocks to run on the way.
+ */
+typedef struct Control_tag {
+    ControlType type;
+    int         stack_depth;
+    /* LOOP_CONTROL */
+    char        *label;
+    int         break_label;
+    int         continue_label;
+    /* TRY_CONTROL */
+    TryStatement        *try_s;
+    CRB_Boolean in_try_block;
+    int         range_start;
+    int         handler_label;
+    /* FINALLY_CONTROL */
+    int         end_label;
+    struct Control_tag  *outer;
+} Control;
+
+typedef struct {
+    int         code_size;
+    int         code_alloc_size;
+    Code        *code;
+    int         label_count;
+    int         label_alloc_size;
+    int         *label_address;
+    int         try_region_count;
+    int         try_region_alloc_size;
+    TryRegion   *try_region;
+    int         stack_depth;
+    int         max_stack_depth;
+    Control     *control;
+} Generator;
+
+static void generate_expression(CRB_Interpreter *inter, Generator *gen,
+                                Expression *expr);
+static void generate_statement_list(CRB_Interpreter *inter, Generator *gen,
+                                    StatementList *list);
+static CRB_Executable *generate_executable(CRB_Interpreter *inter,
+                                           StatementList *list);
+
+static void
+add_stack_depth(Generator *gen, int increment)
+{
+    gen->stack_depth += increment;
+    if (gen->stack_depth > gen->max_stack_depth) {
+        gen->max_stack_depth = gen->stack_depth;
+    }
+}
+
+static void
+add_code(Generator *gen, Code code)
+{
+    if (gen->code_size == gen->code_alloc_size) {
+        gen->code_alloc_size += CODE_ALLOC_SIZE;
+        gen->code = MEM_realloc(gen->code,
+                                sizeof(Code) * gen->code_alloc_size);
+    }
+    gen->code[gen->code_size] = code;
+    gen->code_size++;
+}
+
+static void
+generate_code(Generator *gen, OpCode opcode, ...)
+{
+    va_list     ap;
+    OpcodeInfo  *info;
+    Code        code;
+    int         i;
+
+    DBG_assert(opcode > 0 && opcode < OPCODE_COUNT_PLUS_1,
+               ("opcode..%d\n", opcode));
+    info = &st_opcode_info[opcode];
+
+    va_start(ap, opcode);
+    code.opcode = opcode;
+    add_code(gen, code);
+    for (i = 0; info->parameter[i] != '\0'; i++) {
+        switch (info->parameter[i]) {
+        case 'i': /* FALLTHRU */
+        case 'l':
+            code.int_value = va_arg(ap, int);
+            break;
+        case 'd':
+            code.double_value = va_arg(ap, double);
+            break;
+        case 'p':
+            code.pointer = va_arg(ap, void*);
+            break;
+        default:
+            DBG_panic(("bad parameter..%c\n", info->parameter[i]));
+        }
+        add_code(gen, code);
+    }
+    va_end(ap);
+
+    add_stack_depth(gen, info->stack_increment);
+}
+
+static int
+get_label(Generator *gen)
+{
+    if (gen->label_count == gen->label_alloc_size) {
+        gen->label_alloc_size += LABEL_TABLE_ALLOC_SIZE;
+        gen->label_address = MEM_realloc(gen->label_address,
+                                         sizeof(int)
+                                         * gen->label_alloc_size);
+    }
+    gen->label_address[gen->label_count] = -1;
+    gen->label_count++;
+
+    return gen->label_count - 1;
+}
+
+static void
+set_label(Generator *gen, int label)
+{
+    gen->label_address[label] = gen->code_size;
+}
+
+static void
+open_try_range(Generator *gen, Control *control)
+{
+    control->range_start = gen->code_size;
+}
+
+static void
+close_try_range(Generator *gen, Control *control)
+{
+    TryRegion *region;
+
+    if (control->range_start == gen->code_size)
+        return;
+
+    if (gen->try_region_count == gen->try_region_alloc_size) {
+        gen->try_region_alloc_size += TRY_REGION_ALLOC_SIZE;
+        gen->try_region = MEM_realloc(gen->try_region,
+                                      sizeof(TryRegion)
+                                      * gen->try_region_alloc_size);
+    }
+    region = &gen->try_region[gen->try_region_count];
+    region->start_pc = control->range_start;
+    region->end_pc = gen->code_size;
+    region->handler_pc = control->handler_label; /* fixed up later */
+    region->stack_depth = control->stack_depth;
+    gen->try_region_count++;
+}
+
+static void
+generate_finally_block(CRB_Interpreter *inter, Generator *gen,
+                       CRB_Block *block)
+{
+    Control     control;
+
+    control.type = FINALLY_CONTROL;
+    control.stack_depth = gen->stack_depth;
+    control.end_label = get_label(gen);
+    control.outer = gen->control;
+    gen->control = &control;
+
+    generate_statement_list(inter, gen, block->statement_list);
+    set_label(gen, control.end_label);
+
+    gen->control = control.outer;
+}
+
+/*
+ * Leaves the statements between the current position and dest,
+ * closing the protected ranges of the try statements on the way
+ * and running their finally blocks.
+ */
+static void
+leave_to(CRB_Interpreter *inter, Generator *gen, Control *dest)
+{
+    Control     *pos;
+    Control     *current;
+
+    current = gen->control;
+    for (pos = current; pos != dest; pos = pos->outer) {
+        if (pos->type != TRY_CONTROL)
+            continue;
+        if (pos->in_try_block) {
+            close_try_range(gen, pos);
+        }
+        if (pos->try_s->finally_block) {
+            gen->control = pos->outer;
+            generate_finally_block(inter, gen, pos->try_s->finally_block);
+        }
+    }
+    gen->control = current;
+}
+
+static void
+reopen_try_ranges(Generator *gen, Control *dest)
+{
+    Control     *pos;
+
+    for (pos = gen->control; pos != dest; pos = pos->outer) {
+        if (pos->type == TRY_CONTROL && pos->in_try_block) {
+            open_try_range(gen, pos);
+        }
+    }
+}
+
+static void
+pop_to(Generator *gen, int stack_depth)
+{
+    if (gen->stack_depth > stack_depth) {
+        generate_code(gen, POP_OP, gen->stack_depth - stack_depth);
+        add_stack_depth(gen, -(gen->stack_depth - stack_depth));
+    }
+}
+
+static void
+generate_assign_expression(CRB_Interpreter *inter, Generator *gen,
+                           Expression *expr)
+{
+    Expression  *left = expr->u.assign_expression.left;
+
+    generate_expression(inter, gen, expr->u.assign_expression.operand);
+
+    if (left->type == IDENTIFIER_EXPRESSION) {
+        generate_code(gen, ASSIGN_IDENTIFIER_OP, expr);
+    } else if (left->type == MEMBER_EXPRESSION) {
+        generate_expression(inter, gen,
+                            left->u.member_expression.expression);
+        generate_code(gen, ASSIGN_MEMBER_OP, expr);
+    } else if (left->type == INDEX_EXPRESSION) {
+        generate_expression(inter, gen, left->u.index_expression.array);
+        generate_expression(inter, gen, left->u.index_expression.index);
+        generate_code(gen, ASSIGN_INDEX_OP, expr);
+    } else {
+        generate_code(gen, NOT_LVALUE_OP, left);
+    }
+}
+
+static void
+generate_binary_expression(CRB_Interpreter *inter, Generator *gen,
+                           Expression *expr)
+{
+    OpCode      opcode;
+
+    generate_expression(inter, gen, expr->u.binary_expression.left);
+    generate_expression(inter, gen, expr->u.binary_expression.right);
+    opcode = crb_binary_opcode(expr);
+    generate_code(gen, opcode, expr);
+}
+
+static void
+generate_logical_and_or_expression(CRB_Interpreter *inter, Generator *gen,
+                                   Expression *expr)
+{
+    int         end_label;
+
+    generate_expression(inter, gen, expr->u.binary_expression.left);
+    end_label = get_label(gen);
+    generate_code(gen,
+                  expr->type == LOGICAL_AND_EXPRESSION
+                  ? LOGICAL_AND_OP : LOGICAL_OR_OP,
+                  expr->u.binary_expression.left, end_label);
+    generate_expression(inter, gen, expr->u.binary_expression.right);
+    generate_code(gen, LOGICAL_RESULT_OP);
+    set_label(gen, end_label);
+}
+
+/*
+ * inline_enter jumps to end_label after calling the function
+ * when it is not the inlined one.
+ */
+static void
+generate_inline_function(CRB_Interpreter *inter, Generator *gen,
+                         Expression *expr, int arg_count)
+{
+    int         end_label;
+
+    end_label = get_label(gen);
+    generate_code(gen, INLINE_ENTER_OP, expr, arg_count, end_label);
+    generate_expression(inter, gen,
+                        expr->u.function_call_expression.inline_body);
+    generate_code(gen, INLINE_LEAVE_OP, arg_count);
+    add_stack_depth(gen, -(arg_count + 1));
+    set_label(gen, end_label);
+}
+
+static int
+generate_function_and_arguments(CRB_Interpreter *inter, Generator *gen,
+                                Expression *expr)
+{
+    ArgumentList        *arg_p;
+    int         arg_count = 0;
+
+    generate_expression(inter, gen, expr->u.function_call_expression.function);
+    for (arg_p = expr->u.function_call_expression.argument;
+         arg_p; arg_p = arg_p->next) {
+        generate_expression(inter, gen, arg_p->expression);
+        arg_count++;
+    }
+
+    return arg_count;
+}
+
+static void
+generate_function_call_expression(CRB_Interpreter *inter, Generator *gen,
+                                  Expression *expr)
+{
+    int         arg_count;
+
+    if (expr->u.function_call_expression.is_array_size) {
+        generate_expression(inter, gen,
+                            expr->u.function_call_expression.function
+                            ->u.member_expression.expression);
+        generate_code(gen, ARRAY_SIZE_OP, expr);
+        return;
+    }
+    arg_count = generate_function_and_arguments(inter, gen, expr);
+    if (expr->u.function_call_expression.inline_function) {
+        generate_inline_function(inter, gen, expr, arg_count);
+        return;
+    }
+    generate_code(gen, CALL_OP, expr, arg_count);
+    add_stack_depth(gen, -arg_count);
+}
+
+static void
+generate_array_expression(CRB_Interpreter *inter, Generator *gen,
+                          ExpressionList *list)
+{
+    ExpressionList *pos;
+    int         size = 0;
+
+    for (pos = list; pos; pos = pos->next) {
+        generate_expression(inter, gen, pos->expression);
+        size++;
+    }
+    generate_code(gen, NEW_ARRAY_OP, size);
+    add_stack_depth(gen, 1 - size);
+}
+
+static void
+generate_inc_dec_expression(CRB_Interpreter *inter, Generator *gen,
+                            Expression *expr)
+{
+    Expression  *operand = expr->u.inc_dec.operand;
+
+    if (expr->u.inc_dec.is_local_int) {
+        generate_code(gen, INC_DEC_LOCAL_INT_OP, expr);
+    } else if (operand->type == IDENTIFIER_EXPRESSION) {
+        generate_code(gen, INC_DEC_IDENTIFIER_OP, expr);
+    } else if (operand->type == INDEX_EXPRESSION) {
+        generate_expression(inter, gen, operand->u.index_expression.array);
+        generate_expression(inter, gen, operand->u.index_expression.index);
+        generate_code(gen, INC_DEC_INDEX_OP, expr);
+    } else if (operand->type == MEMBER_EXPRESSION) {
+        generate_expression(inter, gen,
+                            operand->u.member_expression.expression);
+        generate_code(gen, INC_DEC_MEMBER_OP, expr);
+    } else {
+        generate_code(gen, NOT_LVALUE_OP, operand);
+    }
+}
+
+static void
+generate_closure_expression(CRB_Interpreter *inter, Generator *gen,
+                            Expression *expr)
+{
+    CRB_FunctionDefinition *fd = expr->u.closure.function_definition;
+
+    if (fd->u.crowbar_f.executable == NULL) {
+        fd->u.crowbar_f.executable
+            = generate_executable(inter, fd->u.crowbar_f.block
+                                  ->statement_list);
+    }
+    generate_code(gen, PUSH_CLOSURE_OP, fd);
+}
+
+static void
+generate_expression(CRB_Interpreter *inter, Generator *gen,
+                    Expression *expr)
+{
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:
+        generate_code(gen, PUSH_BOOLEAN_OP, (int)expr->u.boolean_value);
+        break;
+    case INT_EXPRESSION:
+        generate_code(gen, PUSH_INT_OP, expr->u.int_value);
+        break;
+    case DOUBLE_EXPRESSION:
+        generate_code(gen, PUSH_DOUBLE_OP, expr->u.double_value);
+        break;
+    case STRING_EXPRESSION:
+        generate_code(gen, PUSH_STRING_OP, expr->u.string_value);
+        break;
+    case REGEXP_EXPRESSION:
+        generate_code(gen, PUSH_REGEXP_OP, expr->u.regexp_value);
+        break;
+    case IDENTIFIER_EXPRESSION:
+        generate_code(gen, PUSH_IDENTIFIER_OP, expr);
+        break;
+    case COMMA_EXPRESSION:
+        generate_expression(inter, gen, expr->u.comma.left);
+        generate_code(gen, POP_OP, 1);
+        add_stack_depth(gen, -1);
+        generate_expression(inter, gen, expr->u.comma.right);
+        break;
+    case ASSIGN_EXPRESSION:
+        generate_assign_expression(inter, gen, expr);
+        break;
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION:
+        generate_binary_expression(inter, gen, expr);
+        break;
+    case LOGICAL_AND_EXPRESSION:/* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        generate_logical_and_or_expression(inter, gen, expr);
+        break;
+    case MINUS_EXPRESSION:
+        generate_expression(inter, gen, expr->u.minus_expression);
+        generate_code(gen, MINUS_OP, expr->u.minus_expression);
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        generate_expression(inter, gen, expr->u.logical_not);
+        generate_code(gen, LOGICAL_NOT_OP, expr->u.logical_not);
+        break;
+    case FUNCTION_CALL_EXPRESSION:
+        generate_function_call_expression(inter, gen, expr);
+        break;
+    case MEMBER_EXPRESSION:
+        generate_expression(inter, gen, expr->u.member_expression.expression);
+        generate_code(gen, MEMBER_OP, expr);
+        break;
+    case NULL_EXPRESSION:
+        generate_code(gen, PUSH_NULL_OP);
+        break;
+    case ARRAY_EXPRESSION:
+        generate_array_expression(inter, gen, expr->u.array_literal);
+        break;
+    case CLOSURE_EXPRESSION:
+        generate_closure_expression(inter, gen, expr);
+        break;
+    case INDEX_EXPRESSION:
+        generate_expression(inter, gen, expr->u.index_expression.array);
+        generate_expression(inter, gen, expr->u.index_expression.index);
+        generate_code(gen, INDEX_OP, expr);
+        break;
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:
+        generate_inc_dec_expression(inter, gen, expr);
+        break;
+    case INLINE_PARAMETER_EXPRESSION:
+        generate_code(gen, INLINE_PARAMETER_OP, expr->u.inline_parameter);
+        break;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+generate_condition(CRB_Interpreter *inter, Generator *gen,
+                   Expression *condition, int false_label)
+{
+    generate_expression(inter, gen, condition);
+    generate_code(gen, JUMP_IF_FALSE_OP, condition, false_label);
+}
+
+static void
+generate_if_statement(CRB_Interpreter *inter, Generator *gen,
+                      Statement *statement)
+{
+    Elsif       *pos;
+    int         end_label;
+    int         next_label;
+
+    end_label = get_label(gen);
+
+    next_label = get_label(gen);
+    generate_condition(inter, gen, statement->u.if_s.condition, next_label);
+    generate_statement_list(inter, gen,
+                            statement->u.if_s.then_block->statement_list);
+    generate_code(gen, JUMP_OP, end_label);
+    set_label(gen, next_label);
+
+    for (pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+        next_label = get_label(gen);
+        generate_condition(inter, gen, pos->condition, next_label);
+        generate_statement_list(inter, gen, pos->block->statement_list);
+        generate_code(gen, JUMP_OP, end_label);
+        set_label(gen, next_label);
+    }
+    if (statement->u.if_s.else_block) {
+        generate_statement_list(inter, gen,
+                                statement->u.if_s.else_block->statement_list);
+    }
+    set_label(gen, end_label);
+}
+
+static void
+push_loop_control(Generator *gen, Control *control, char *label)
+{
+    control->type = LOOP_CONTROL;
+    control->stack_depth = gen->stack_depth;
+    control->label = label;
+    control->break_label = get_label(gen);
+    control->continue_label = get_label(gen);
+    control->outer = gen->control;
+    gen->control = control;
+}
+
+static void
+generate_while_statement(CRB_Interpreter *inter, Generator *gen,
+                         Statement *statement)
+{
+    Control     control;
+
+    push_loop_control(gen, &control, statement->u.while_s.label);
+
+    set_label(gen, control.continue_label);
+    generate_condition(inter, gen, statement->u.while_s.condition,
+                       control.break_label);
+    generate_statement_list(inter, gen,
+                            statement->u.while_s.block->statement_list);
+    generate_code(gen, JUMP_OP, control.continue_label);
+    set_label(gen, control.break_label);
+
+    gen->control = control.outer;
+}
+
+static void
+generate_for_statement(CRB_Interpreter *inter, Generator *gen,
+                       Statement *statement)
+{
+    Control     control;
+    int         loop_label;
+
+    if (statement->u.for_s.init) {
+        generate_expression(inter, gen, statement->u.for_s.init);
+        generate_code(gen, POP_OP, 1);
+        add_stack_depth(gen, -1);
+    }
+    push_loop_control(gen, &control, statement->u.for_s.label);
+
+    loop_label = get_label(gen);
+    set_label(gen, loop_label);
+    if (statement->u.for_s.condition) {
+        generate_condition(inter, gen, statement->u.for_s.condition,
+                           control.break_label);
+    }
+    generate_statement_list(inter, gen,
+                            statement->u.for_s.block->statement_list);
+    set_label(gen, control.continue_label);
+    if (statement->u.for_s.post) {
+        generate_expression(inter, gen, statement->u.for_s.post);
+        generate_code(gen, POP_OP, 1);
+        add_stack_depth(gen, -1);
+    }
+    generate_code(gen, JUMP_OP, loop_label);
+    set_label(gen, control.break_label);
+
+    gen->control = control.outer;
+}
+
+static void
+generate_foreach_statement(CRB_Interpreter *inter, Generator *gen,
+                           Statement *statement)
+{
+    Control     control;
+    int         loop_label;
+
+    generate_expression(inter, gen, statement->u.foreach_s.collection);
+    generate_code(gen, FOREACH_ITERATOR_OP, statement);
+    generate_code(gen, FOREACH_INIT_OP, statement);
+
+    push_loop_control(gen, &control, statement->u.foreach_s.label);
+
+    loop_label = get_label(gen);
+    set_label(gen, loop_label);
+    generate_code(gen, FOREACH_IS_DONE_OP, statement, control.break_label);
+    generate_code(gen, FOREACH_CURRENT_ITEM_OP, statement);
+    generate_statement_list(inter, gen,
+                            statement->u.foreach_s.block->statement_list);
+    set_label(gen, control.continue_label);
+    generate_code(gen, FOREACH_NEXT_OP, statement);
+    generate_code(gen, JUMP_OP, loop_label);
+    set_label(gen, control.break_label);
+
+    gen->control = control.outer;
+
+    generate_code(gen, POP_OP, 2);
+    add_stack_depth(gen, -2);
+}
+
+static void
+generate_return_statement(CRB_Interpreter *inter, Generator *gen,
+                          Statement *statement)
+{
+    Control     *dest;
+    Expression  *expr;
+    int         arg_count;
+    int         stack_depth = gen->stack_depth;
+
+    if (statement->u.return_s.is_tail_call) {
+        /* see crb_execute_byte_code(). */
+        expr = statement->u.return_s.return_value;
+        arg_count = generate_function_and_arguments(inter, gen, expr);
+        generate_code(gen, TAIL_CALL_OP, expr, arg_count);
+        gen->stack_depth = stack_depth;
+        return;
+    }
+    for (dest = gen->control; dest; dest = dest->outer) {
+        if (dest->type == FINALLY_CONTROL)
+            break;
+    }
+    if (statement->u.return_s.return_value) {
+        generate_expression(inter, gen, statement->u.return_s.return_value);
+    } else {
+        generate_code(gen, PUSH_NULL_OP);
+    }
+    leave_to(inter, gen, dest);
+    if (dest) {
+        /* return in a finally block only ends the finally block. */
+        pop_to(gen, dest->stack_depth);
+        generate_code(gen, JUMP_OP, dest->end_label);
+    } else {
+        generate_code(gen, RETURN_OP);
+    }
+    reopen_try_ranges(gen, dest);
+    gen->stack_depth = stack_depth;
+}
+
+static void
+generate_break_continue(CRB_Interpreter *inter, Generator *gen,
+                        char *label, CRB_Boolean is_break)
+{
+    Control     *dest;
+    int         stack_depth = gen->stack_depth;
+
+    for (dest = gen->control; dest; dest = dest->outer) {
+        if (dest->type == FINALLY_CONTROL)
+            break;
+        if (dest->type == LOOP_CONTROL
+            && (label == NULL
+                || dest->label == label))
+            break;
+    }
+    leave_to(inter, gen, dest);
+    if (dest == NULL) {
+        generate_code(gen, LEAVE_OP,
+                      is_break
+                      ? BREAK_STATEMENT_RESULT : CONTINUE_STATEMENT_RESULT);
+    } else {
+        pop_to(gen, dest->stack_depth);
+        if (dest->type == FINALLY_CONTROL) {
+            generate_code(gen, JUMP_OP, dest->end_label);
+        } else {
+            generate_code(gen, JUMP_OP,
+                          is_break
+                          ? dest->break_label : dest->continue_label);
+        }
+    }
+    reopen_try_ranges(gen, dest);
+    gen->stack_depth = stack_depth;
+}
+
+static void
+generate_try_statement(CRB_Interpreter *inter, Generator *gen,
+                       Statement *statement)
+{
+    Control     control;
+    int         finally_label;
+
+    control.type = TRY_CONTROL;
+    control.stack_depth = gen->stack_depth;
+    control.try_s = &statement->u.try_s;
+    control.in_try_block = CRB_TRUE;
+    control.handler_label = get_label(gen);
+    control.outer = gen->control;
+    gen->control = &control;
+
+    finally_label = get_label(gen);
+    open_try_range(gen, &control);
+    generate_statement_list(inter, gen,
+                            statement->u.try_s.try_block->statement_list);
+    close_try_range(gen, &control);
+    control.in_try_block = CRB_FALSE;
+    generate_code(gen, JUMP_OP, finally_label);
+
+    set_label(gen, control.handler_label);
+    if (statement->u.try_s.catch_block) {
+        generate_code(gen, CATCH_OP, statement);
+        generate_statement_list(inter, gen,
+                                statement->u.try_s.catch_block
+                                ->statement_list);
+        generate_code(gen, POP_OP, 1);
+        add_stack_depth(gen, -1);
+    }
+    gen->control = control.outer;
+
+    set_label(gen, finally_label);
+    if (statement->u.try_s.finally_block) {
+        generate_finally_block(inter, gen, statement->u.try_s.finally_block);
+    }
+    if (!statement->u.try_s.catch_block) {
+        generate_code(gen, RETHROW_OP);
+    }
+}
+
+static void
+generate_statement(CRB_Interpreter *inter, Generator *gen,
+                   Statement *statement)
+{
+    switch (statement->type) {
+    case EXPRESSION_STATEMENT:
+        generate_expression(inter, gen, statement->u.expression_s);
+        generate_code(gen, POP_OP, 1);
+        add_stack_depth(gen, -1);
+        break;
+    case GLOBAL_STATEMENT:
+        generate_code(gen, GLOBAL_OP, statement);
+        break;
+    case IF_STATEMENT:
+        generate_if_statement(inter, gen, statement);
+        break;
+    case WHILE_STATEMENT:
+        generate_while_statement(inter, gen, statement);
+        break;
+    case FOR_STATEMENT:
+        generate_for_statement(inter, gen, statement);
+        break;
+    case FOREACH_STATEMENT:
+        generate_foreach_statement(inter, gen, statement);
+        break;
+    case RETURN_STATEMENT:
+        generate_return_statement(inter, gen, statement);
+        break;
+    case BREAK_STATEMENT:
+        generate_break_continue(inter, gen, statement->u.break_s.label,
+                                CRB_TRUE);
+        break;
+    case CONTINUE_STATEMENT:
+        generate_break_continue(inter, gen, statement->u.continue_s.label,
+                                CRB_FALSE);
+        break;
+    case TRY_STATEMENT:
+        generate_try_statement(inter, gen, statement);
+        break;
+    case THROW_STATEMENT:
+        generate_expression(inter, gen, statement->u.throw_s.exception);
+        generate_code(gen, THROW_OP);
+        break;
+    case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", statement->type));
+    }
+}
+
+static void
+generate_statement_list(CRB_Interpreter *inter, Generator *gen,
+                        StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        generate_statement(inter, gen, pos->statement);
+    }
+}
+
+static void
+fix_labels(Generator *gen)
+{
+    int pc;
+    int i;
+    OpcodeInfo *info;
+
+    for (pc = 0; pc < gen->code_size; ) {
+        info = &st_opcode_info[gen->code[pc].opcode];
+        for (i = 0; info->parameter[i] != '\0'; i++) {
+            if (info->parameter[i] == 'l') {
+                gen->code[pc + 1 + i].int_value
+                    = gen->label_address[gen->code[pc + 1 + i].int_value];
+            }
+        }
+        pc += 1 + strlen(info->parameter);
+    }
+    for (i = 0; i < gen->try_region_count; i++) {
+        gen->try_region[i].handler_pc
+            = gen->label_address[gen->try_region[i].handler_pc];
+    }
+}
+
+static CRB_Executable *
+generate_executable(CRB_Interpreter *inter, StatementList *list)
+{
+    Generator   gen;
+    CRB_Executable *exe;
+
+    gen.code_size = 0;
+    gen.code_alloc_size = 0;
+    gen.code = NULL;
+    gen.label_count = 0;
+    gen.label_alloc_size = 0;
+    gen.label_address = NULL;
+    gen.try_region_count = 0;
+    gen.try_region_alloc_size = 0;
+    gen.try_region = NULL;
+    gen.stack_depth = 0;
+    gen.max_stack_depth = 0;
+    gen.control = NULL;
+
+    generate_statement_list(inter, &gen, list);
+    generate_code(&gen, LEAVE_OP, NORMAL_STATEMENT_RESULT);
+    DBG_assert(gen.stack_depth == 0, ("stack_depth..%d\n", gen.stack_depth));
+    fix_labels(&gen);
+
+    exe = crb_malloc(sizeof(CRB_Executable));
+    exe->code_size = gen.code_size;
+    exe->code = crb_malloc(sizeof(Code) * gen.code_size);
+    memcpy(exe->code, gen.code, sizeof(Code) * gen.code_size);
+    exe->try_region_count = gen.try_region_count;
+    if (gen.try_region_count > 0) {
+        exe->try_region
+            = crb_malloc(sizeof(TryRegion) * gen.try_region_count);
+        memcpy(exe->try_region, gen.try_region,
+               sizeof(TryRegion) * gen.try_region_count);
+    } else {
+        exe->try_region = NULL;
+    }
+    exe->need_stack_size = gen.max_stack_depth;
+
+    MEM_free(gen.code);
+    MEM_free(gen.label_address);
+    MEM_free(gen.try_region);
+
+    return exe;
+}
+
+void
+crb_generate_code(CRB_Interpreter *inter)
+{
+    CRB_FunctionDefinition *pos;
+
+    for (pos = inter->function_list; pos; pos = pos->next) {
+        if (pos->type == CRB_CROWBAR_FUNCTION_DEFINITION
+            && pos->u.crowbar_f.executable == NULL) {
+            pos->u.crowbar_f.executable
+                = generate_executable(inter, pos->u.crowbar_f.block
+                                      ->statement_list);
+        }
+    }
+    inter->executable = generate_executable(inter, inter->statement_list);
+}
@@ -1,24 +1,205 @@
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "MEM.h"
 #include "DBG.h"
 #include "crowbar.h"
 
+static void gc_collect_nursery(CRB_Interpreter *inter);
+static void gc_start_marking(CRB_Interpreter *inter);
+static void gc_mark_slice(CRB_Interpreter *inter);
+static void gc_sweep_next_page(CRB_Interpreter *inter);
+static void gc_sweep_slice(CRB_Interpreter *inter);
+
+#ifdef __GNUC__
+#define PREFETCH(p)     __builtin_prefetch(p)
+#else
+#define PREFETCH(p)
+#endif
+
+/*
+ * Most collections only sweep the nursery. When the heap outgrows
+ * the threshold, the whole heap is marked incrementally, a slice
+ * every HEAP_SLICE_SIZE bytes of allocation, and then swept lazily.
+ */
 static void
 check_gc(CRB_Interpreter *inter)
 {
+    Heap *heap = &inter->heap;
+
 #if 0
     crb_garbage_collect(inter);
 #endif
     
-    if (inter->heap.current_heap_size > inter->heap.current_threshold) {
-        /* fprintf(stderr, "garbage collecting..."); */
+    if (heap->is_marking) {
+        if (heap->current_heap_size > heap->slice_threshold) {
+            gc_mark_slice(inter);
+        }
+        return;
+    }
+    if (heap->is_sweeping) {
+        if (heap->current_heap_size > heap->slice_threshold) {
+            gc_sweep_slice(inter);
+        }
+        return;
+    }
+    if (heap->current_heap_size <= heap->nursery_threshold)
+        return;
+
+    if (heap->current_heap_size <= heap->current_threshold) {
+        gc_collect_nursery(inter);
+        heap->nursery_threshold = heap->current_heap_size + HEAP_NURSERY_SIZE;
+    } else if (heap->pause_budget > 0) {
+        gc_start_marking(inter);
+        gc_mark_slice(inter);
+    } else {
         crb_garbage_collect(inter);
-        /* fprintf(stderr, "done.\n"); */
+    }
+}
+
+static int
+object_index(CRB_Object *obj)
+{
+    return obj - obj->page->object;
+}
+
+static CRB_Boolean
+is_marked(CRB_Object *obj)
+{
+    int idx = object_index(obj);
+
+    return (obj->page->mark[idx / 8] >> (idx % 8)) & 1;
+}
+
+static void
+set_mark(CRB_Object *obj)
+{
+    int idx = object_index(obj);
+
+    obj->page->mark[idx / 8] |= 1 << (idx % 8);
+}
 
-        inter->heap.current_threshold
-            = inter->heap.current_heap_size + HEAP_THRESHOLD_SIZE;
+static void
+clear_mark(CRB_Object *obj)
+{
+    int idx = object_index(obj);
+
+    obj->page->mark[idx / 8] &= ~(1 << (idx % 8));
+}
+
+static void
+add_page(CRB_Interpreter *inter)
+{
+    ObjectPage *page;
+
+    page = MEM_malloc(sizeof(ObjectPage));
+    page->used_count = 0;
+    page->unused_index = 0;
+    page->free_object = NULL;
+    page->is_young = CRB_FALSE;
+    page->sweep_epoch = inter->heap.gc_epoch;
+    memset(page->in_heap, 0, sizeof(page->in_heap));
+    memset(page->mark, 0, sizeof(page->mark));
+    page->next = inter->heap.page;
+    inter->heap.page = page;
+    page->next_free = inter->heap.free_page;
+    inter->heap.free_page = page;
+}
+
+/*
+ * A page leaves the free page list when it gets full. The pages left
+ * from the last marking are swept before a new page is added.
+ */
+static CRB_Object *
+alloc_slot(CRB_Interpreter *inter)
+{
+    Heap *heap = &inter->heap;
+    ObjectPage *page;
+    CRB_Object *obj;
+
+    while (heap->free_page == NULL && heap->is_sweeping) {
+        gc_sweep_next_page(inter);
+    }
+    if (heap->free_page == NULL) {
+        add_page(inter);
     }
+    page = heap->free_page;
+    if (page->free_object) {
+        obj = page->free_object;
+        page->free_object = obj->u.next_free;
+    } else {
+        obj = &page->object[page->unused_index];
+        obj->page = page;
+        page->unused_index++;
+    }
+    page->used_count++;
+    if (page->used_count == OBJECT_PAGE_SIZE) {
+        heap->free_page = page->next_free;
+    }
+
+    return obj;
+}
+
+static void
+free_slot(CRB_Object *obj)
+{
+    ObjectPage *page = obj->page;
+
+    obj->u.next_free = page->free_object;
+    page->free_object = obj;
+    page->used_count--;
+}
+
+/*
+ * An object put into a page which is not swept yet is marked, so that
+ * the sweep keeps it.
+ */
+static void
+chain_object(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    ObjectPage *page = obj->page;
+    int idx = object_index(obj);
+
+    page->in_heap[idx / 8] |= 1 << (idx % 8);
+    if (page->sweep_epoch != inter->heap.gc_epoch) {
+        set_mark(obj);
+    } else {
+        clear_mark(obj);
+    }
+    obj->is_old = CRB_FALSE;
+    obj->is_remembered = CRB_FALSE;
+    if (!page->is_young) {
+        page->is_young = CRB_TRUE;
+        page->next_young = inter->heap.young_page;
+        inter->heap.young_page = page;
+    }
+}
+
+static void
+forget_object(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    Heap *heap = &inter->heap;
+    int i;
+
+    for (i = 0; i < heap->remembered_count; i++) {
+        if (heap->remembered[i] == obj) {
+            heap->remembered_count--;
+            heap->remembered[i] = heap->remembered[heap->remembered_count];
+            break;
+        }
+    }
+    obj->is_remembered = CRB_FALSE;
+}
+
+static void
+unchain_object(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    int idx = object_index(obj);
+
+    if (obj->is_remembered) {
+        forget_object(inter, obj);
+    }
+    obj->page->in_heap[idx / 8] &= ~(1 << (idx % 8));
 }
 
 static CRB_Object *
@@ -27,26 +208,26 @@ alloc_object(CRB_Interpreter *inter, ObjectType type)
     CRB_Object *ret;
 
     check_gc(inter);
-    ret = MEM_malloc(sizeof(CRB_Object));
+    ret = alloc_slot(inter);
     inter->heap.current_heap_size += sizeof(CRB_Object);
     ret->type = type;
-    ret->marked = CRB_FALSE;
-    ret->prev = NULL;
-    ret->next = inter->heap.header;
-    inter->heap.header = ret;
-    if (ret->next) {
-        ret->next->prev = ret;
-    }
+    chain_object(inter, ret);
 
     return ret;
 }
 
 static void
-add_ref_in_native_method(CRB_LocalEnvironment *env, CRB_Object *obj)
+add_ref_in_native_method(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                         CRB_Object *obj)
 {
     RefInNativeFunc *new_ref;
 
-    new_ref = MEM_malloc(sizeof(RefInNativeFunc));
+    if (inter->frame_pool.ref_in_native_method) {
+        new_ref = inter->frame_pool.ref_in_native_method;
+        inter->frame_pool.ref_in_native_method = new_ref->next;
+    } else {
+        new_ref = MEM_malloc(sizeof(RefInNativeFunc));
+    }
     new_ref->object = obj;
     new_ref->next = env->ref_in_native_method;
     env->ref_in_native_method = new_ref;
@@ -71,7 +252,7 @@ CRB_literal_to_crb_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Object *ret;
 
     ret = crb_literal_to_crb_string_i(inter, str);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
@@ -96,7 +277,7 @@ CRB_create_crowbar_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Object *ret;
 
     ret = crb_create_crowbar_string_i(inter, str);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
@@ -134,7 +315,7 @@ CRB_string_substr(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Object *ret;
 
     ret = crb_string_substr_i(inter, env, str, from, len, line_number);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
@@ -160,42 +341,38 @@ CRB_create_array(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Object *ret;
 
     ret = crb_create_array_i(inter, size);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
 
+static void
+realloc_array(CRB_Interpreter *inter, CRB_Object *obj, int new_alloc_size)
+{
+    check_gc(inter);
+    obj->u.array.array = MEM_realloc(obj->u.array.array,
+                                     new_alloc_size * sizeof(CRB_Value));
+    inter->heap.current_heap_size
+        += (new_alloc_size - obj->u.array.alloc_size) * sizeof(CRB_Value);
+    obj->u.array.alloc_size = new_alloc_size;
+}
+
+/*
+ * The allocated size grows geometrically and never shrinks here.
+ * Use CRB_array_shrink_to_fit() to release the unused part.
+ */
 void
 CRB_array_resize(CRB_Interpreter *inter, CRB_Object *obj, int new_size)
 {
     int new_alloc_size;
-    CRB_Boolean need_realloc;
     int i;
 
-    check_gc(inter);
-    
     if (new_size > obj->u.array.alloc_size) {
-        new_alloc_size = obj->u.array.alloc_size * 2;
+        new_alloc_size = obj->u.array.alloc_size * ARRAY_GROWTH_FACTOR;
         if (new_alloc_size < new_size) {
-            new_alloc_size = new_size + ARRAY_ALLOC_SIZE;
-        } else if (new_alloc_size - obj->u.array.alloc_size
-                   > ARRAY_ALLOC_SIZE) {
-            new_alloc_size = obj->u.array.alloc_size + ARRAY_ALLOC_SIZE;
+            new_alloc_size = new_size;
         }
-        need_realloc = CRB_TRUE;
-    } else if (obj->u.array.alloc_size - new_size > ARRAY_ALLOC_SIZE) {
-        new_alloc_size = new_size;
-        need_realloc = CRB_TRUE;
-    } else {
-        need_realloc = CRB_FALSE;
-    }
-    if (need_realloc) {
-        check_gc(inter);
-        obj->u.array.array = MEM_realloc(obj->u.array.array,
-                                         new_alloc_size * sizeof(CRB_Value));
-        inter->heap.current_heap_size
-            += (new_alloc_size - obj->u.array.alloc_size) * sizeof(CRB_Value);
-        obj->u.array.alloc_size = new_alloc_size;
+        realloc_array(inter, obj, new_alloc_size);
     }
     for (i = obj->u.array.size; i < new_size; i++) {
         obj->u.array.array[i].type = CRB_NULL_VALUE;
@@ -203,6 +380,32 @@ CRB_array_resize(CRB_Interpreter *inter, CRB_Object *obj, int new_size)
     obj->u.array.size = new_size;
 }
 
+void
+CRB_array_reserve(CRB_Interpreter *inter, CRB_Object *obj, int alloc_size)
+{
+    DBG_assert(obj->type == ARRAY_OBJECT, ("bad type..%d\n", obj->type));
+
+    if (alloc_size > obj->u.array.alloc_size) {
+        realloc_array(inter, obj, alloc_size);
+    }
+}
+
+void
+CRB_array_shrink_to_fit(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    DBG_assert(obj->type == ARRAY_OBJECT, ("bad type..%d\n", obj->type));
+
+    if (obj->u.array.size == 0) {
+        MEM_free(obj->u.array.array);
+        obj->u.array.array = NULL;
+        inter->heap.current_heap_size
+            -= obj->u.array.alloc_size * sizeof(CRB_Value);
+        obj->u.array.alloc_size = 0;
+    } else if (obj->u.array.size < obj->u.array.alloc_size) {
+        realloc_array(inter, obj, obj->u.array.size);
+    }
+}
+
 void
 CRB_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *v)
 {
@@ -210,6 +413,7 @@ CRB_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *v)
 
     CRB_array_resize(inter, obj, obj->u.array.size + 1);
     obj->u.array.array[obj->u.array.size-1] = *v;
+    crb_write_barrier(inter, obj, v);
 }
 
 void
@@ -232,6 +436,7 @@ CRB_array_insert(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
         obj->u.array.array[i+1] = obj->u.array.array[i];
     }
     obj->u.array.array[pos] = *new_value;
+    crb_write_barrier(inter, obj, new_value);
 }
 
 void
@@ -260,8 +465,9 @@ crb_create_assoc_i(CRB_Interpreter *inter)
     CRB_Object *ret;
 
     ret = alloc_object(inter, ASSOC_OBJECT);
-    ret->u.assoc.member_count = 0;
-    ret->u.assoc.member = NULL;
+    ret->u.assoc.shape = inter->empty_shape;
+    ret->u.assoc.alloc_size = 0;
+    ret->u.assoc.value = NULL;
 
     return ret;
 }
@@ -272,103 +478,450 @@ CRB_create_assoc(CRB_Interpreter *inter, CRB_LocalEnvironment *env)
     CRB_Object *ret;
 
     ret = crb_create_assoc_i(inter);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
 
-CRB_Value *
-CRB_add_assoc_member(CRB_Interpreter *inter, CRB_Object *assoc,
-                     char *name, CRB_Value *value, CRB_Boolean is_final)
+static Shape *
+alloc_shape(int member_count, CRB_Boolean is_shared)
 {
-    AssocMember *member_p;
+    Shape *shape;
+
+    shape = MEM_malloc(sizeof(Shape));
+    shape->member_count = member_count;
+    shape->alloc_size = member_count;
+    shape->member_name = MEM_malloc(sizeof(char*) * member_count);
+    shape->is_final = MEM_malloc(sizeof(CRB_Boolean) * member_count);
+    shape->is_shared = is_shared;
+    shape->hash_size = 0;
+    shape->hash_index = NULL;
+    shape->transition_count = 0;
+    shape->transition = NULL;
+    shape->next = NULL;
+
+    return shape;
+}
 
-    check_gc(inter);
-    member_p = MEM_realloc(assoc->u.assoc.member,
-                           sizeof(AssocMember)
-                           * (assoc->u.assoc.member_count+1));
-    member_p[assoc->u.assoc.member_count].name = name;
-    member_p[assoc->u.assoc.member_count].value = *value;
-    member_p[assoc->u.assoc.member_count].is_final = is_final;
-    assoc->u.assoc.member = member_p;
-    assoc->u.assoc.member_count++;
-    inter->heap.current_heap_size += sizeof(AssocMember);
+static void
+dispose_shape(Shape *shape)
+{
+    MEM_free(shape->member_name);
+    MEM_free(shape->is_final);
+    MEM_free(shape->hash_index);
+    MEM_free(shape->transition);
+    MEM_free(shape);
+}
 
-    return &member_p[assoc->u.assoc.member_count-1].value;
+void
+crb_init_shapes(CRB_Interpreter *inter)
+{
+    inter->empty_shape = alloc_shape(0, CRB_TRUE);
+    inter->shape_list = inter->empty_shape;
 }
 
 void
-CRB_add_assoc_member2(CRB_Interpreter *inter, CRB_Object *assoc,
-                      char *name, CRB_Value *value)
+crb_dispose_shapes(CRB_Interpreter *inter)
+{
+    Shape *temp;
+
+    while (inter->shape_list) {
+        temp = inter->shape_list;
+        inter->shape_list = temp->next;
+        dispose_shape(temp);
+    }
+    inter->empty_shape = NULL;
+}
+
+/*
+ * Symbols are unique, so the hash value is taken from the pointer.
+ */
+static int
+hash_member_name(Shape *shape, char *name)
+{
+    return (int)(((unsigned long)name >> 3) & (shape->hash_size - 1));
+}
+
+static void
+add_hash_index(Shape *shape, int index)
+{
+    int pos;
+
+    pos = hash_member_name(shape, shape->member_name[index]);
+    while (shape->hash_index[pos] >= 0) {
+        pos = (pos + 1) & (shape->hash_size - 1);
+    }
+    shape->hash_index[pos] = index;
+}
+
+/*
+ * Keeps the hash index of an unshared shape at most half full.
+ */
+static void
+rehash_shape(Shape *shape)
 {
     int i;
 
-    if (assoc->u.assoc.member_count > 0) {
-        for (i = 0; i < assoc->u.assoc.member_count; i++) {
-            if (!strcmp(assoc->u.assoc.member[i].name, name)) {
-                break;
-            }
+    if (shape->hash_size >= shape->member_count * 2)
+        return;
+
+    if (shape->hash_size == 0) {
+        shape->hash_size = SHARED_SHAPE_MEMBER_MAX * 2;
+    }
+    while (shape->hash_size < shape->member_count * 2) {
+        shape->hash_size *= 2;
+    }
+    MEM_free(shape->hash_index);
+    shape->hash_index = MEM_malloc(sizeof(int) * shape->hash_size);
+    for (i = 0; i < shape->hash_size; i++) {
+        shape->hash_index[i] = -1;
+    }
+    for (i = 0; i < shape->member_count; i++) {
+        add_hash_index(shape, i);
+    }
+}
+
+static void
+append_unshared_member(Shape *shape, char *name, CRB_Boolean is_final)
+{
+    if (shape->member_count == shape->alloc_size) {
+        shape->alloc_size *= 2;
+        shape->member_name = MEM_realloc(shape->member_name,
+                                         sizeof(char*) * shape->alloc_size);
+        shape->is_final = MEM_realloc(shape->is_final,
+                                      sizeof(CRB_Boolean)
+                                      * shape->alloc_size);
+    }
+    shape->member_name[shape->member_count] = name;
+    shape->is_final[shape->member_count] = is_final;
+    shape->member_count++;
+    if (shape->hash_size >= shape->member_count * 2) {
+        add_hash_index(shape, shape->member_count - 1);
+    } else {
+        rehash_shape(shape);
+    }
+}
+
+/*
+ * Returns the shape which has the members of the given shape
+ * followed by the new member. Shared shapes are reused.
+ */
+static Shape *
+add_shape_member(CRB_Interpreter *inter, Shape *shape,
+                 char *name, CRB_Boolean is_final)
+{
+    Shape *new_shape;
+    int i;
+
+    if (!shape->is_shared) {
+        append_unshared_member(shape, name, is_final);
+        return shape;
+    }
+    for (i = 0; i < shape->transition_count; i++) {
+        if (shape->transition[i].name == name
+            && shape->transition[i].is_final == is_final) {
+            return shape->transition[i].shape;
         }
-        if (i < assoc->u.assoc.member_count) {
-            /* BUGBUG */
-            assoc->u.assoc.member[i].value = *value;
-            return;
+    }
+    new_shape = alloc_shape(shape->member_count + 1,
+                            shape->member_count + 1
+                            <= SHARED_SHAPE_MEMBER_MAX);
+    for (i = 0; i < shape->member_count; i++) {
+        new_shape->member_name[i] = shape->member_name[i];
+        new_shape->is_final[i] = shape->is_final[i];
+    }
+    new_shape->member_name[shape->member_count] = name;
+    new_shape->is_final[shape->member_count] = is_final;
+    if (new_shape->is_shared) {
+        shape->transition = MEM_realloc(shape->transition,
+                                        sizeof(ShapeTransition)
+                                        * (shape->transition_count + 1));
+        shape->transition[shape->transition_count].name = name;
+        shape->transition[shape->transition_count].is_final = is_final;
+        shape->transition[shape->transition_count].shape = new_shape;
+        shape->transition_count++;
+        new_shape->next = inter->shape_list;
+        inter->shape_list = new_shape;
+    } else {
+        rehash_shape(new_shape);
+    }
+
+    return new_shape;
+}
+
+/*
+ * Returns the index of the member, or -1.
+ * The member name must be a symbol.
+ */
+int
+crb_search_shape_member(Shape *shape, char *member_name)
+{
+    int i;
+
+    if (shape->hash_index) {
+        for (i = hash_member_name(shape, member_name);
+             shape->hash_index[i] >= 0;
+             i = (i + 1) & (shape->hash_size - 1)) {
+            if (shape->member_name[shape->hash_index[i]] == member_name)
+                return shape->hash_index[i];
         }
+        return -1;
     }
-    CRB_add_assoc_member(inter, assoc, name, value, CRB_FALSE);
+    for (i = 0; i < shape->member_count; i++) {
+        if (shape->member_name[i] == member_name)
+            return i;
+    }
+    return -1;
 }
 
+/*
+ * Stores the value of the last member of the assoc's shape.
+ */
+static CRB_Value *
+append_assoc_value(CRB_Interpreter *inter, CRB_Object *assoc,
+                   CRB_Value *value)
+{
+    int index;
+    int new_size;
+
+    index = assoc->u.assoc.shape->member_count - 1;
+    if (index >= assoc->u.assoc.alloc_size) {
+        new_size = larger(ASSOC_ALLOC_SIZE, assoc->u.assoc.alloc_size * 2);
+        assoc->u.assoc.value = MEM_realloc(assoc->u.assoc.value,
+                                           sizeof(CRB_Value) * new_size);
+        inter->heap.current_heap_size
+            += sizeof(CRB_Value) * (new_size - assoc->u.assoc.alloc_size);
+        assoc->u.assoc.alloc_size = new_size;
+    }
+    assoc->u.assoc.value[index] = *value;
+    crb_write_barrier(inter, assoc, value);
+
+    return &assoc->u.assoc.value[index];
+}
+
+/*
+ * The name must be a symbol.
+ */
 CRB_Value *
-CRB_search_assoc_member(CRB_Object *assoc, char *member_name)
+crb_add_assoc_member_i(CRB_Interpreter *inter, CRB_Object *assoc,
+                       char *name, CRB_Value *value, CRB_Boolean is_final)
 {
-    CRB_Value *ret = NULL;
-    int i;
+    check_gc(inter);
+    assoc->u.assoc.shape = add_shape_member(inter, assoc->u.assoc.shape,
+                                            name, is_final);
 
-    if (assoc->u.assoc.member_count == 0)
-        return NULL;
+    return append_assoc_value(inter, assoc, value);
+}
 
-    for (i = 0; i < assoc->u.assoc.member_count; i++) {
-        if (!strcmp(assoc->u.assoc.member[i].name, member_name)) {
-            ret = &assoc->u.assoc.member[i].value;
-            break;
-        }
+/*
+ * new_shape must be a transition of the assoc's current shape,
+ * which was taken before.
+ */
+CRB_Value *
+crb_add_assoc_member_with_shape(CRB_Interpreter *inter, CRB_Object *assoc,
+                                Shape *new_shape, CRB_Value *value)
+{
+    DBG_assert(new_shape->member_count
+               == assoc->u.assoc.shape->member_count + 1,
+               ("member_count..%d\n", new_shape->member_count));
+    check_gc(inter);
+    assoc->u.assoc.shape = new_shape;
+
+    return append_assoc_value(inter, assoc, value);
+}
+
+CRB_Value *
+CRB_add_assoc_member(CRB_Interpreter *inter, CRB_Object *assoc,
+                     char *name, CRB_Value *value, CRB_Boolean is_final)
+{
+    return crb_add_assoc_member_i(inter, assoc, CRB_intern(inter, name),
+                                  value, is_final);
+}
+
+void
+CRB_add_assoc_member2(CRB_Interpreter *inter, CRB_Object *assoc,
+                      char *name, CRB_Value *value)
+{
+    CRB_Value *dest;
+    CRB_Boolean is_final; /* dummy */
+
+    name = CRB_intern(inter, name);
+    dest = crb_search_assoc_member_i(assoc, name, &is_final);
+    if (dest) {
+        /* BUGBUG */
+        *dest = *value;
+        crb_write_barrier(inter, assoc, value);
+        return;
     }
+    crb_add_assoc_member_i(inter, assoc, name, value, CRB_FALSE);
+}
 
-    return ret;
+/*
+ * The member name must be a symbol.
+ */
+CRB_Value *
+crb_search_assoc_member_i(CRB_Object *assoc, char *member_name,
+                          CRB_Boolean *is_final)
+{
+    int index;
+
+    index = crb_search_shape_member(assoc->u.assoc.shape, member_name);
+    if (index < 0)
+        return NULL;
+
+    *is_final = assoc->u.assoc.shape->is_final[index];
+    return &assoc->u.assoc.value[index];
+}
+
+CRB_Value *
+CRB_search_assoc_member(CRB_Object *assoc, char *member_name)
+{
+    CRB_Boolean is_final; /* dummy */
+
+    return CRB_search_assoc_member_w(assoc, member_name, &is_final);
 }
 
 CRB_Value *
 CRB_search_assoc_member_w(CRB_Object *assoc, char *member_name,
                           CRB_Boolean *is_final)
 {
-    CRB_Value *ret = NULL;
-    int i;
+    char *symbol;
 
-    if (assoc->u.assoc.member_count == 0)
+    symbol = crb_search_symbol(crb_get_current_interpreter(), member_name);
+    if (symbol == NULL)
         return NULL;
 
-    for (i = 0; i < assoc->u.assoc.member_count; i++) {
-        if (!strcmp(assoc->u.assoc.member[i].name, member_name)) {
-            ret = &assoc->u.assoc.member[i].value;
-            *is_final = assoc->u.assoc.member[i].is_final;
-            break;
-        }
-    }
-    return ret;
+    return crb_search_assoc_member_i(assoc, symbol, is_final);
 }
 
-CRB_Object *
-crb_create_scope_chain(CRB_Interpreter *inter)
+static void
+move_scope_chain_to_heap(CRB_Interpreter *inter, CRB_Object *sc)
+{
+    chain_object(inter, sc);
+    inter->heap.current_heap_size
+        += sizeof(CRB_Object)
+        + sizeof(Slot) * sc->u.scope_chain.slot_alloc_size;
+    sc->u.scope_chain.is_in_heap = CRB_TRUE;
+}
+
+static CRB_Object *
+alloc_scope_chain(CRB_Interpreter *inter, int slot_count, char **slot_name,
+                  CRB_Boolean in_heap)
 {
     CRB_Object *ret;
+    int i;
 
-    ret = alloc_object(inter, SCOPE_CHAIN_OBJECT);
+    if (inter->frame_pool.scope_chain) {
+        ret = inter->frame_pool.scope_chain;
+        inter->frame_pool.scope_chain = ret->u.scope_chain.next;
+    } else {
+        if (in_heap) {
+            check_gc(inter);
+        }
+        ret = alloc_slot(inter);
+        ret->type = SCOPE_CHAIN_OBJECT;
+        ret->u.scope_chain.slot_alloc_size = 0;
+        ret->u.scope_chain.slot = NULL;
+    }
+    if (slot_count > ret->u.scope_chain.slot_alloc_size) {
+        ret->u.scope_chain.slot = MEM_realloc(ret->u.scope_chain.slot,
+                                              sizeof(Slot) * slot_count);
+        ret->u.scope_chain.slot_alloc_size = slot_count;
+    }
+    clear_mark(ret);
+    ret->is_old = CRB_FALSE;
+    ret->is_remembered = CRB_FALSE;
+    ret->u.scope_chain.is_in_heap = CRB_FALSE;
+    if (in_heap) {
+        move_scope_chain_to_heap(inter, ret);
+    }
+    ret->u.scope_chain.slot_count = slot_count;
+    ret->u.scope_chain.slot_name = slot_name;
+    for (i = 0; i < slot_count; i++) {
+        ret->u.scope_chain.slot[i].is_defined = CRB_FALSE;
+    }
+    ret->u.scope_chain.is_captured = CRB_FALSE;
     ret->u.scope_chain.frame = NULL;
     ret->u.scope_chain.next = NULL;
 
     return ret;
 }
 
+CRB_Object *
+crb_create_scope_chain(CRB_Interpreter *inter, int slot_count,
+                       char **slot_name)
+{
+    return alloc_scope_chain(inter, slot_count, slot_name, CRB_TRUE);
+}
+
+/*
+ * The scope chain of a capture-free function lives outside the heap;
+ * the GC reaches it only through its local environment.
+ */
+CRB_Object *
+crb_create_frame_scope_chain(CRB_Interpreter *inter, int slot_count,
+                             char **slot_name)
+{
+    return alloc_scope_chain(inter, slot_count, slot_name, CRB_FALSE);
+}
+
+/*
+ * A closure refers to the scope chain. A native function may capture
+ * the scope chain of a capture-free function, which then moves to the heap.
+ */
+void
+crb_capture_scope_chain(CRB_Interpreter *inter, CRB_Object *sc)
+{
+    if (!sc->u.scope_chain.is_in_heap) {
+        move_scope_chain_to_heap(inter, sc);
+    }
+    sc->u.scope_chain.is_captured = CRB_TRUE;
+}
+
+/*
+ * Called when the function owning the scope chain returns.
+ * Unless a closure captured it, the scope chain goes back to the pool.
+ */
+void
+crb_release_scope_chain(CRB_Interpreter *inter, CRB_Object *sc)
+{
+    if (sc->u.scope_chain.is_captured)
+        return;
+
+    if (sc->u.scope_chain.is_in_heap) {
+        unchain_object(inter, sc);
+        inter->heap.current_heap_size
+            -= sizeof(CRB_Object)
+            + sizeof(Slot) * sc->u.scope_chain.slot_alloc_size;
+    }
+    sc->u.scope_chain.frame = NULL;
+    sc->u.scope_chain.next = inter->frame_pool.scope_chain;
+    inter->frame_pool.scope_chain = sc;
+}
+
+void
+crb_dispose_frame_pool(CRB_Interpreter *inter)
+{
+    FramePool *pool = &inter->frame_pool;
+
+    while (pool->environment) {
+        CRB_LocalEnvironment *temp = pool->environment;
+        pool->environment = temp->next;
+        MEM_free(temp->global_variable);
+        MEM_free(temp);
+    }
+    while (pool->scope_chain) {
+        CRB_Object *temp = pool->scope_chain;
+        pool->scope_chain = temp->u.scope_chain.next;
+        MEM_free(temp->u.scope_chain.slot);
+    }
+    while (pool->ref_in_native_method) {
+        RefInNativeFunc *temp = pool->ref_in_native_method;
+        pool->ref_in_native_method = temp->next;
+        MEM_free(temp);
+    }
+}
+
 CRB_Object *
 crb_create_native_pointer_i(CRB_Interpreter *inter, void *pointer,
                             CRB_NativePointerInfo *info)
@@ -389,7 +942,7 @@ CRB_create_native_pointer(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_Object *ret;
 
     ret = crb_create_native_pointer_i(inter, pointer, info);
-    add_ref_in_native_method(env, ret);
+    add_ref_in_native_method(inter, env, ret);
 
     return ret;
 }
@@ -407,15 +960,37 @@ CRB_check_native_pointer_type(CRB_Object *native_pointer,
     return native_pointer->u.native_pointer.info == info;
 }
 
+/*
+ * The inline frames executed in env, innermost first, are numbered
+ * down from *frame_idx.
+ */
+static int
+count_inline_frames(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                    int *frame_idx)
+{
+    int count = 0;
+
+    while (*frame_idx >= 0
+           && inter->inline_frame.frame[*frame_idx].env == env) {
+        (*frame_idx)--;
+        count++;
+    }
+
+    return count;
+}
+
 static int
-count_stack_trace_depth(CRB_LocalEnvironment *top)
+count_stack_trace_depth(CRB_Interpreter *inter, CRB_LocalEnvironment *top)
 {
     CRB_LocalEnvironment *pos;
     int count = 0;
+    int frame_idx = inter->inline_frame.frame_count - 1;
 
     for (pos = top; pos; pos = pos->next) {
+        count += count_inline_frames(inter, pos, &frame_idx);
         count++;
     }
+    count += count_inline_frames(inter, NULL, &frame_idx);
 
     return count + 1;
 }
@@ -457,6 +1032,34 @@ create_stack_trace_line(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return new_line;
 }
 
+/*
+ * Adds the lines of the inlined functions executed in env,
+ * and returns the line number in env.
+ */
+static int
+add_inline_stack_trace(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                       CRB_Object *stack_trace, int *stack_trace_idx,
+                       int *frame_idx, int line_number)
+{
+    InlineFrame *frame;
+    CRB_Value   value;
+
+    while (*frame_idx >= 0
+           && inter->inline_frame.frame[*frame_idx].env == env) {
+        frame = &inter->inline_frame.frame[*frame_idx];
+        value.type = CRB_ASSOC_VALUE;
+        value.u.object = create_stack_trace_line(inter, env,
+                                                 frame->function->name,
+                                                 line_number);
+        CRB_array_set(inter, env, stack_trace, *stack_trace_idx, &value);
+        line_number = frame->caller_line_number;
+        (*stack_trace_idx)++;
+        (*frame_idx)--;
+    }
+
+    return line_number;
+}
+
 static CRB_Value
 print_stack_trace(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                   int arg_count, CRB_Value *args)
@@ -544,6 +1147,15 @@ print_stack_trace(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return ret;
 }
 
+/*
+ * The stack trace has a line for each local environment from env,
+ * and for the functions inlined in them. A function that returned
+ * by a tail call is not there: its callee took over its local
+ * environment, and is shown as called from the caller of the function.
+ * A function gets its local environment only once its arguments are
+ * evaluated, so an exception raised in an argument does not show
+ * the function, be it native or not.
+ */
 CRB_Object *
 CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                      CRB_Object *message, int line_number)
@@ -555,6 +1167,7 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     int         stack_trace_depth;
     CRB_LocalEnvironment *env_pos;
     int         stack_trace_idx;
+    int         frame_idx;
     CRB_Object  *line; /* CRB_Assoc */
     char        *func_name;
     int         next_line_number;
@@ -574,7 +1187,7 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     CRB_add_assoc_member(inter, ret, EXCEPTION_MEMBER_MESSAGE, &value,
                          CRB_TRUE);
 
-    stack_trace_depth = count_stack_trace_depth(env);
+    stack_trace_depth = count_stack_trace_depth(inter, env);
     stack_trace = crb_create_array_i(inter, stack_trace_depth);
     value.type = CRB_ARRAY_VALUE;
     value.u.object = stack_trace;
@@ -585,8 +1198,14 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                          CRB_TRUE);
 
     next_line_number = line_number;
-    for (env_pos = env, stack_trace_idx = 0; env_pos;
+    stack_trace_idx = 0;
+    frame_idx = inter->inline_frame.frame_count - 1;
+    for (env_pos = env; env_pos;
          env_pos = env_pos->next, stack_trace_idx++) {
+        next_line_number
+            = add_inline_stack_trace(inter, env_pos, stack_trace,
+                                     &stack_trace_idx, &frame_idx,
+                                     next_line_number);
         if (env_pos->current_function_name) {
             func_name = env_pos->current_function_name;
         } else {
@@ -600,7 +1219,9 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                       &value);
         next_line_number = env_pos->caller_line_number;
     }
-    
+    next_line_number = add_inline_stack_trace(inter, NULL, stack_trace,
+                                              &stack_trace_idx, &frame_idx,
+                                              next_line_number);
     line = create_stack_trace_line(inter, env, "top_level",
                                    next_line_number);
     value.type = CRB_ASSOC_VALUE;
@@ -619,7 +1240,7 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     value.u.closure.environment = NULL; /* to stop marking by GC */
 
     scope_chain.type = CRB_SCOPE_CHAIN_VALUE;
-    scope_chain.u.object = crb_create_scope_chain(inter);
+    scope_chain.u.object = crb_create_scope_chain(inter, 0, NULL);
     scope_chain.u.object->u.scope_chain.frame = ret;
     CRB_push_value(inter, &scope_chain);
     stack_count++;
@@ -634,91 +1255,265 @@ CRB_create_exception(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     return ret;
 }
 
-static void gc_mark_value(CRB_Value *v);
+static CRB_Object *
+value_to_object(CRB_Value *v)
+{
+    if (crb_is_object_value(v->type)) {
+        return v->u.object;
+    } else if (v->type == CRB_CLOSURE_VALUE) {
+        return v->u.closure.environment;
+    } else if (v->type == CRB_FAKE_METHOD_VALUE) {
+        return v->u.fake_method.object;
+    }
+    return NULL;
+}
 
 static void
-gc_mark(CRB_Object *obj)
+push_gray(Heap *heap, CRB_Object *obj, int index)
 {
-    if (obj == NULL)
-        return;
+    if (heap->gray_count == heap->gray_alloc_size) {
+        heap->gray_alloc_size = larger(GRAY_LIST_ALLOC_SIZE,
+                                       heap->gray_alloc_size * 2);
+        heap->gray = MEM_realloc(heap->gray,
+                                 sizeof(GrayEntry) * heap->gray_alloc_size);
+    }
+    heap->gray[heap->gray_count].object = obj;
+    heap->gray[heap->gray_count].index = index;
+    heap->gray_count++;
+}
 
-    if (obj->marked)
+/*
+ * A marked object is gray while it is in the gray list, and black
+ * after its references are shaded. Strings and native pointers refer
+ * to no object, so they become black at once. The references of
+ * a pushed object are prefetched for its scan.
+ */
+static void
+gc_shade(CRB_Interpreter *inter, CRB_Object *obj, CRB_Boolean is_minor)
+{
+    if (obj == NULL || (is_minor && obj->is_old) || is_marked(obj))
         return;
 
-    obj->marked = CRB_TRUE;
-
+    set_mark(obj);
     if (obj->type == ARRAY_OBJECT) {
-        int i;
-        for (i = 0; i < obj->u.array.size; i++) {
-            gc_mark_value(&obj->u.array.array[i]);
-        }
+        PREFETCH(obj->u.array.array);
     } else if (obj->type == ASSOC_OBJECT) {
-        int i;
-        for (i = 0; i < obj->u.assoc.member_count; i++) {
-            gc_mark_value(&obj->u.assoc.member[i].value);
-        }
+        PREFETCH(obj->u.assoc.value);
     } else if (obj->type == SCOPE_CHAIN_OBJECT) {
-        gc_mark(obj->u.scope_chain.frame);
-        gc_mark(obj->u.scope_chain.next);
+        PREFETCH(obj->u.scope_chain.slot);
+    } else {
+        return;
     }
+    push_gray(&inter->heap, obj, 0);
 }
 
 static void
-gc_reset_mark(CRB_Object *obj)
+gc_shade_value(CRB_Interpreter *inter, CRB_Value *v, CRB_Boolean is_minor)
 {
-    obj->marked = CRB_FALSE;
+    gc_shade(inter, value_to_object(v), is_minor);
 }
 
 static void
-gc_mark_value(CRB_Value *v)
+remember_object(CRB_Interpreter *inter, CRB_Object *obj)
 {
-    if (crb_is_object_value(v->type)) {
-        gc_mark(v->u.object);
-    } else if (v->type == CRB_CLOSURE_VALUE) {
-        if (v->u.closure.environment) {
-            gc_mark(v->u.closure.environment);
+    Heap *heap = &inter->heap;
+
+    if (heap->remembered_count == heap->remembered_alloc_size) {
+        heap->remembered_alloc_size += REMEMBERED_SET_ALLOC_SIZE;
+        heap->remembered = MEM_realloc(heap->remembered,
+                                       sizeof(CRB_Object*)
+                                       * heap->remembered_alloc_size);
+    }
+    heap->remembered[heap->remembered_count] = obj;
+    heap->remembered_count++;
+    obj->is_remembered = CRB_TRUE;
+}
+
+/*
+ * Called after the value is stored into obj. While the heap is being
+ * marked, the stored object is shaded, so that no black object refers
+ * to a white one. An old object which gets a young object goes to
+ * the remembered set.
+ */
+void
+crb_write_barrier(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *value)
+{
+    CRB_Object *target;
+
+    target = value_to_object(value);
+    if (target == NULL)
+        return;
+
+    if (inter->heap.is_marking) {
+        gc_shade(inter, target, CRB_FALSE);
+    }
+    if (obj->is_old && !obj->is_remembered && !target->is_old) {
+        remember_object(inter, obj);
+    }
+}
+
+/*
+ * Called after the value is stored into a variable of env, which may be
+ * in any scope chain of env or in its frame.
+ */
+void
+crb_variable_write_barrier(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                           CRB_Value *value)
+{
+    CRB_Object *target;
+    CRB_Object *sc;
+
+    if (env == NULL)
+        return;
+
+    target = value_to_object(value);
+    if (target == NULL)
+        return;
+
+    if (inter->heap.is_marking) {
+        gc_shade(inter, target, CRB_FALSE);
+    }
+    if (target->is_old)
+        return;
+
+    for (sc = env->variable; sc; sc = sc->u.scope_chain.next) {
+        if (sc->is_old && !sc->is_remembered) {
+            remember_object(inter, sc);
+        }
+        if (sc->u.scope_chain.frame && sc->u.scope_chain.frame->is_old
+            && !sc->u.scope_chain.frame->is_remembered) {
+            remember_object(inter, sc->u.scope_chain.frame);
         }
-    } else if (v->type == CRB_FAKE_METHOD_VALUE) {
-        gc_mark(v->u.fake_method.object);
     }
 }
 
+/*
+ * A minor collection does not trace the old generation. The old objects
+ * which may refer to young ones are scanned from the remembered set.
+ * A large array is scanned GC_ARRAY_CHUNK_SIZE elements at a time;
+ * the rest of it goes back to the gray list.
+ */
 static void
-gc_mark_ref_in_native_method(CRB_LocalEnvironment *env)
+gc_scan_object(CRB_Interpreter *inter, CRB_Object *obj, int index,
+               CRB_Boolean is_minor)
 {
-    RefInNativeFunc *ref;
+    int end;
+    int i;
+
+    if (obj->type == ARRAY_OBJECT) {
+        end = obj->u.array.size;
+        if (end - index > GC_ARRAY_CHUNK_SIZE) {
+            end = index + GC_ARRAY_CHUNK_SIZE;
+            push_gray(&inter->heap, obj, end);
+        }
+        for (i = index; i < end; i++) {
+            gc_shade_value(inter, &obj->u.array.array[i], is_minor);
+        }
+    } else if (obj->type == ASSOC_OBJECT) {
+        for (i = 0; i < obj->u.assoc.shape->member_count; i++) {
+            gc_shade_value(inter, &obj->u.assoc.value[i], is_minor);
+        }
+    } else if (obj->type == SCOPE_CHAIN_OBJECT) {
+        for (i = 0; i < obj->u.scope_chain.slot_count; i++) {
+            if (obj->u.scope_chain.slot[i].is_defined) {
+                gc_shade_value(inter, &obj->u.scope_chain.slot[i].value,
+                               is_minor);
+            }
+        }
+        gc_shade(inter, obj->u.scope_chain.frame, is_minor);
+        gc_shade(inter, obj->u.scope_chain.next, is_minor);
+    }
+}
+
+static clock_t
+gc_deadline(long budget)
+{
+    return clock() + (clock_t)(budget * ((double)CLOCKS_PER_SEC / 1000000));
+}
 
-    for (ref = env->ref_in_native_method; ref; ref = ref->next) {
-        gc_mark(ref->object);
+/*
+ * Scans the gray objects until none is left or, if budget is positive,
+ * until budget microseconds have passed. Returns CRB_TRUE when
+ * the gray list became empty.
+ */
+static CRB_Boolean
+gc_scan_gray_list(CRB_Interpreter *inter, CRB_Boolean is_minor, long budget)
+{
+    Heap *heap = &inter->heap;
+    clock_t deadline = 0;
+    GrayEntry entry;
+    int count = 0;
+
+    if (budget > 0) {
+        deadline = gc_deadline(budget);
     }
+    while (heap->gray_count > 0) {
+        heap->gray_count--;
+        entry = heap->gray[heap->gray_count];
+        gc_scan_object(inter, entry.object, entry.index, is_minor);
+        count++;
+        if (budget > 0 && count % GC_SLICE_CHECK_COUNT == 0
+            && clock() >= deadline) {
+            return heap->gray_count == 0;
+        }
+    }
+    return CRB_TRUE;
 }
 
+/*
+ * The roots have no write barrier. The scope chain of a capture-free
+ * function is outside the heap and is scanned again on each call.
+ */
 static void
-gc_mark_objects(CRB_Interpreter *inter)
+gc_shade_roots(CRB_Interpreter *inter, CRB_Boolean is_minor)
 {
-    CRB_Object *obj;
     Variable *v;
     CRB_LocalEnvironment *lv;
+    RefInNativeFunc *ref;
     int i;
 
-    for (obj = inter->heap.header; obj; obj = obj->next) {
-        gc_reset_mark(obj);
-    }
-    
     for (v = inter->variable; v; v = v->next) {
-        gc_mark_value(&v->value);
+        gc_shade_value(inter, &v->value, is_minor);
     }
     
     for (lv = inter->top_environment; lv; lv = lv->next) {
-        gc_mark(lv->variable);
-        gc_mark_ref_in_native_method(lv);
+        if (lv->variable && !lv->variable->u.scope_chain.is_in_heap) {
+            clear_mark(lv->variable);
+        }
+        gc_shade(inter, lv->variable, is_minor);
+        for (ref = lv->ref_in_native_method; ref; ref = ref->next) {
+            gc_shade(inter, ref->object, is_minor);
+        }
     }
 
     for (i = 0; i < inter->stack.stack_pointer; i++) {
-        gc_mark_value(&inter->stack.stack[i]);
+        gc_shade_value(inter, &inter->stack.stack[i], is_minor);
+    }
+
+    gc_shade_value(inter, &inter->current_exception, is_minor);
+}
+
+static void
+gc_scan_remembered_set(CRB_Interpreter *inter)
+{
+    int i;
+
+    for (i = 0; i < inter->heap.remembered_count; i++) {
+        inter->heap.remembered[i]->is_remembered = CRB_FALSE;
+        gc_scan_object(inter, inter->heap.remembered[i], 0, CRB_TRUE);
     }
+    inter->heap.remembered_count = 0;
+}
 
-    gc_mark_value(&inter->current_exception);
+static void
+gc_forget_remembered_set(CRB_Interpreter *inter)
+{
+    int i;
+
+    for (i = 0; i < inter->heap.remembered_count; i++) {
+        inter->heap.remembered[i]->is_remembered = CRB_FALSE;
+    }
+    inter->heap.remembered_count = 0;
 }
 
 static void
@@ -739,10 +1534,16 @@ gc_dispose_object(CRB_Interpreter *inter, CRB_Object *obj)
         break;
     case ASSOC_OBJECT:
         inter->heap.current_heap_size
-            -= sizeof(AssocMember) * obj->u.assoc.member_count;
-        MEM_free(obj->u.assoc.member);
+            -= sizeof(CRB_Value) * obj->u.assoc.alloc_size;
+        if (!obj->u.assoc.shape->is_shared) {
+            dispose_shape(obj->u.assoc.shape);
+        }
+        MEM_free(obj->u.assoc.value);
         break;
     case SCOPE_CHAIN_OBJECT:
+        inter->heap.current_heap_size
+            -= sizeof(Slot) * obj->u.scope_chain.slot_alloc_size;
+        MEM_free(obj->u.scope_chain.slot);
         break;
     case NATIVE_POINTER_OBJECT:
         if (obj->u.native_pointer.info->finalizer) {
@@ -754,37 +1555,254 @@ gc_dispose_object(CRB_Interpreter *inter, CRB_Object *obj)
         DBG_assert(0, ("bad type..%d\n", obj->type));
     }
     inter->heap.current_heap_size -= sizeof(CRB_Object);
-    MEM_free(obj);
+    free_slot(obj);
 }
 
+/*
+ * The survivors of the nursery are promoted to the old generation.
+ * Only the pages which got a young object since the last minor
+ * collection are swept.
+ */
 static void
-gc_sweep_objects(CRB_Interpreter *inter)
+gc_sweep_nursery(CRB_Interpreter *inter)
 {
+    Heap *heap = &inter->heap;
+    ObjectPage *page;
     CRB_Object *obj;
-    CRB_Object *tmp;
+    CRB_Boolean was_full;
+    int i;
 
-    for (obj = inter->heap.header; obj; ) {
-        if (!obj->marked) {
-            if (obj->prev) {
-                obj->prev->next = obj->next;
+    for (page = heap->young_page; page; page = page->next_young) {
+        was_full = (page->used_count == OBJECT_PAGE_SIZE);
+        for (i = 0; i < page->unused_index; i++) {
+            if (!((page->in_heap[i / 8] >> (i % 8)) & 1))
+                continue;
+            obj = &page->object[i];
+            if (obj->is_old)
+                continue;
+            if ((page->mark[i / 8] >> (i % 8)) & 1) {
+                obj->is_old = CRB_TRUE;
             } else {
-                inter->heap.header = obj->next;
+                page->in_heap[i / 8] &= ~(1 << (i % 8));
+                gc_dispose_object(inter, obj);
             }
-            if (obj->next) {
-                obj->next->prev = obj->prev;
+        }
+        memset(page->mark, 0, sizeof(page->mark));
+        page->is_young = CRB_FALSE;
+        if (was_full && page->used_count < OBJECT_PAGE_SIZE) {
+            page->next_free = heap->free_page;
+            heap->free_page = page;
+        }
+    }
+    heap->young_page = NULL;
+}
+
+/*
+ * The survivors of the nursery are promoted as soon as the marking
+ * finishes, before the barrier may store young objects into them.
+ */
+static void
+gc_promote_survivors(CRB_Interpreter *inter)
+{
+    ObjectPage *page;
+    int i;
+
+    for (page = inter->heap.young_page; page; page = page->next_young) {
+        for (i = 0; i < page->unused_index; i++) {
+            if (((page->in_heap[i / 8] & page->mark[i / 8]) >> (i % 8)) & 1) {
+                page->object[i].is_old = CRB_TRUE;
+            }
+        }
+        page->is_young = CRB_FALSE;
+    }
+    inter->heap.young_page = NULL;
+}
+
+/*
+ * Only the dead objects are touched.
+ */
+static void
+gc_sweep_page(CRB_Interpreter *inter, ObjectPage *page)
+{
+    unsigned char dead;
+    int i;
+    int j;
+
+    for (i = 0; i < OBJECT_PAGE_SIZE / 8; i++) {
+        dead = page->in_heap[i] & ~page->mark[i];
+        page->in_heap[i] &= page->mark[i];
+        for (j = 0; dead; j++, dead >>= 1) {
+            if (dead & 1) {
+                gc_dispose_object(inter, &page->object[i * 8 + j]);
             }
-            tmp = obj->next;
-            gc_dispose_object(inter, obj);
-            obj = tmp;
-        } else {
-            obj = obj->next;
         }
     }
+    memset(page->mark, 0, sizeof(page->mark));
+    page->sweep_epoch = inter->heap.gc_epoch;
+}
+
+static void
+gc_finish_sweeping(CRB_Interpreter *inter)
+{
+    Heap *heap = &inter->heap;
+
+    heap->is_sweeping = CRB_FALSE;
+    heap->current_threshold
+        = heap->current_heap_size
+        + larger(HEAP_THRESHOLD_SIZE, heap->current_heap_size);
+    heap->nursery_threshold = heap->current_heap_size + HEAP_NURSERY_SIZE;
+}
+
+/*
+ * The pages added since the marking finished need no sweep. An empty
+ * page is released unless a young object was put into it meanwhile.
+ */
+static void
+gc_sweep_next_page(CRB_Interpreter *inter)
+{
+    Heap *heap = &inter->heap;
+    ObjectPage *page = *heap->sweep_link;
+
+    if (page == NULL) {
+        gc_finish_sweeping(inter);
+        return;
+    }
+    if (page->sweep_epoch != heap->gc_epoch) {
+        gc_sweep_page(inter, page);
+        if (page->used_count == 0 && !page->is_young) {
+            *heap->sweep_link = page->next;
+            MEM_free(page);
+            return;
+        }
+        if (page->used_count < OBJECT_PAGE_SIZE) {
+            page->next_free = heap->free_page;
+            heap->free_page = page;
+        }
+    }
+    heap->sweep_link = &page->next;
+}
+
+/*
+ * Sweeps until all the pages are swept or, if budget is positive,
+ * until budget microseconds have passed.
+ */
+static void
+gc_sweep_pages(CRB_Interpreter *inter, long budget)
+{
+    clock_t deadline = 0;
+
+    if (budget > 0) {
+        deadline = gc_deadline(budget);
+    }
+    while (inter->heap.is_sweeping) {
+        gc_sweep_next_page(inter);
+        if (budget > 0 && clock() >= deadline)
+            break;
+    }
+}
+
+static void
+gc_sweep_slice(CRB_Interpreter *inter)
+{
+    gc_sweep_pages(inter, inter->heap.pause_budget);
+    inter->heap.slice_threshold
+        = inter->heap.current_heap_size + HEAP_SLICE_SIZE;
+}
+
+static void
+gc_collect_nursery(CRB_Interpreter *inter)
+{
+    gc_shade_roots(inter, CRB_TRUE);
+    gc_scan_remembered_set(inter);
+    gc_scan_gray_list(inter, CRB_TRUE, 0);
+    gc_sweep_nursery(inter);
+}
+
+/*
+ * Minor collections wait until the marking finishes, and the objects
+ * allocated meanwhile are white.
+ */
+static void
+gc_start_marking(CRB_Interpreter *inter)
+{
+    inter->heap.is_marking = CRB_TRUE;
+    gc_shade_roots(inter, CRB_FALSE);
+}
+
+/*
+ * The marking finishes with a scan of the roots. Then every page
+ * waits for the sweep, and the pause does not depend on the size
+ * of the heap.
+ */
+static void
+gc_finish_marking(CRB_Interpreter *inter)
+{
+    Heap *heap = &inter->heap;
+
+    gc_shade_roots(inter, CRB_FALSE);
+    gc_scan_gray_list(inter, CRB_FALSE, 0);
+    gc_forget_remembered_set(inter);
+    gc_promote_survivors(inter);
+    heap->is_marking = CRB_FALSE;
+    heap->gc_epoch++;
+    heap->free_page = NULL;
+    heap->sweep_link = &heap->page;
+    heap->is_sweeping = CRB_TRUE;
+    heap->slice_threshold = heap->current_heap_size + HEAP_SLICE_SIZE;
+}
+
+static void
+gc_mark_slice(CRB_Interpreter *inter)
+{
+    if (gc_scan_gray_list(inter, CRB_FALSE, inter->heap.pause_budget)) {
+        gc_finish_marking(inter);
+    } else {
+        inter->heap.slice_threshold
+            = inter->heap.current_heap_size + HEAP_SLICE_SIZE;
+    }
+}
+
+/*
+ * The marks of an unfinished incremental marking are dropped, so that
+ * everything unreachable now is collected.
+ */
+static void
+gc_cancel_marking(CRB_Interpreter *inter)
+{
+    ObjectPage *page;
+
+    for (page = inter->heap.page; page; page = page->next) {
+        memset(page->mark, 0, sizeof(page->mark));
+    }
+    inter->heap.gray_count = 0;
+    inter->heap.is_marking = CRB_FALSE;
 }
 
 void
 crb_garbage_collect(CRB_Interpreter *inter)
 {
-    gc_mark_objects(inter);
-    gc_sweep_objects(inter);
-}
\ No newline at end of file
+    if (inter->heap.is_marking) {
+        gc_cancel_marking(inter);
+    }
+    gc_sweep_pages(inter, 0);
+    gc_finish_marking(inter);
+    gc_sweep_pages(inter, 0);
+}
+
+void
+crb_dispose_object_pages(CRB_Interpreter *inter)
+{
+    ObjectPage *temp;
+
+    while (inter->heap.page) {
+        temp = inter->heap.page;
+        inter->heap.page = temp->next;
+        MEM_free(temp);
+    }
+}
+
+void
+CRB_set_gc_pause_budget(CRB_Interpreter *inter, long usec)
+{
+    inter->heap.pause_budget = usec;
+}
@@ -19,6 +19,10 @@ CRB_create_interpreter(void)
     interpreter->execute_storage = MEM_open_storage(0);
     interpreter->variable = NULL;
     interpreter->function_list = NULL;
+    interpreter->function_table.size = 0;
+    interpreter->function_table.count = 0;
+    interpreter->function_table.entry = NULL;
+    interpreter->function_version = 1;
     interpreter->statement_list = NULL;
     interpreter->current_line_number = 1;
     interpreter->stack.stack_alloc_size = 0;
@@ -27,11 +31,43 @@ CRB_create_interpreter(void)
         = MEM_malloc(sizeof(CRB_Value) * STACK_ALLOC_SIZE);
     interpreter->heap.current_heap_size = 0;
     interpreter->heap.current_threshold = HEAP_THRESHOLD_SIZE;
-    interpreter->heap.header = NULL;
+    interpreter->heap.nursery_threshold = HEAP_NURSERY_SIZE;
+    interpreter->heap.page = NULL;
+    interpreter->heap.free_page = NULL;
+    interpreter->heap.young_page = NULL;
+    interpreter->heap.remembered_count = 0;
+    interpreter->heap.remembered_alloc_size = 0;
+    interpreter->heap.remembered = NULL;
+    interpreter->heap.is_marking = CRB_FALSE;
+    interpreter->heap.is_sweeping = CRB_FALSE;
+    interpreter->heap.gc_epoch = 0;
+    interpreter->heap.sweep_link = NULL;
+    interpreter->heap.pause_budget = GC_PAUSE_BUDGET;
+    interpreter->heap.gray_count = 0;
+    interpreter->heap.gray_alloc_size = 0;
+    interpreter->heap.gray = NULL;
+    interpreter->frame_pool.environment = NULL;
+    interpreter->frame_pool.scope_chain = NULL;
+    interpreter->frame_pool.ref_in_native_method = NULL;
+    interpreter->inline_frame.frame_count = 0;
+    interpreter->inline_frame.frame_alloc_size = 0;
+    interpreter->inline_frame.frame = NULL;
+    crb_init_symbol_table(interpreter);
+    crb_intern_fake_method_names(interpreter);
+    crb_init_shapes(interpreter);
+    interpreter->member_cache_hit_count = 0;
+    interpreter->member_cache_miss_count = 0;
     interpreter->top_environment = NULL;
     interpreter->current_exception.type = CRB_NULL_VALUE;
     interpreter->input_mode = CRB_FILE_INPUT_MODE;
     interpreter->regexp_literals = NULL;
+#ifdef AST_WALKER
+    interpreter->execute_mode = AST_WALK_EXECUTE_MODE;
+#else
+    interpreter->execute_mode = BYTE_CODE_EXECUTE_MODE;
+#endif
+    interpreter->executable = NULL;
+    crb_init_optimize_setting(interpreter);
 
 #ifdef EUC_SOURCE
     interpreter->source_encoding = EUC_ENCODING;
@@ -87,6 +123,8 @@ show_error_stack_trace(CRB_Interpreter *inter)
         }
         CRB_call_function(inter, NULL, 0, func, 0, NULL);
     } else {
+        crb_unwind_local_environment(inter, NULL);
+        inter->inline_frame.frame_count = 0;
         fprintf(stderr, "Exception occured in print_stack_trace.\n");
         show_error_stack_trace(inter);
     }
@@ -96,13 +134,24 @@ static void do_compile(CRB_Interpreter *inter)
 {
     extern int yyparse(void);
     int error_code;
+    StatementList *last_statement;
+    CRB_FunctionDefinition *last_function = inter->function_list;
 
+    for (last_statement = inter->statement_list;
+         last_statement && last_statement->next;
+         last_statement = last_statement->next)
+        ;
     if ((error_code = setjmp(inter->current_recovery_environment.environment))
         == 0) {
         if (yyparse()) {
             fprintf(stderr, "Error ! Error ! Error !\n");
             exit(1);
         }
+        crb_resolve_variables(inter);
+        crb_optimize(inter, last_statement, last_function);
+        if (inter->execute_mode == BYTE_CODE_EXECUTE_MODE) {
+            crb_generate_code(inter);
+        }
     } else {
         show_error_stack_trace(inter);
 
@@ -182,14 +231,21 @@ CRB_interpret(CRB_Interpreter *interpreter)
     if ((error_code = setjmp(interpreter
                              ->current_recovery_environment.environment))
         == 0) {
-        result = crb_execute_statement_list(interpreter, NULL,
-                                            interpreter->statement_list);
+        if (interpreter->execute_mode == BYTE_CODE_EXECUTE_MODE) {
+            result = crb_execute_byte_code(interpreter, NULL,
+                                           interpreter->executable);
+        } else {
+            result = crb_execute_statement_list(interpreter, NULL,
+                                                interpreter->statement_list);
+        }
         if (result.type != NORMAL_STATEMENT_RESULT) {
             crb_runtime_error(interpreter, NULL, 0,
                               BREAK_OR_CONTINUE_REACHED_TOPLEVEL_ERR,
                               CRB_MESSAGE_ARGUMENT_END);
         }
     } else {
+        crb_unwind_local_environment(interpreter, NULL);
+        interpreter->inline_frame.frame_count = 0;
         show_error_stack_trace(interpreter);
 
         crb_set_stack_pointer(interpreter, 0);
@@ -220,8 +276,16 @@ CRB_dispose_interpreter(CRB_Interpreter *interpreter)
     crb_garbage_collect(interpreter);
     DBG_assert(interpreter->heap.current_heap_size == 0,
                ("%d bytes leaked.\n", interpreter->heap.current_heap_size));
+    MEM_free(interpreter->heap.remembered);
+    MEM_free(interpreter->heap.gray);
     MEM_free(interpreter->stack.stack);
+    MEM_free(interpreter->inline_frame.frame);
     crb_dispose_regexp_literals(interpreter);
+    crb_dispose_frame_pool(interpreter);
+    crb_dispose_object_pages(interpreter);
+    crb_dispose_shapes(interpreter);
+    crb_dispose_function_table(interpreter);
+    crb_dispose_symbol_table(interpreter);
     MEM_dispose_storage(interpreter->interpreter_storage);
 }
 
@@ -232,13 +296,11 @@ CRB_add_native_function(CRB_Interpreter *interpreter,
     CRB_FunctionDefinition *fd;
 
     fd = crb_malloc(sizeof(CRB_FunctionDefinition));
-    fd->name = name;
+    fd->name = CRB_intern(interpreter, name);
     fd->type = CRB_NATIVE_FUNCTION_DEFINITION;
     fd->is_closure = CRB_FALSE;
     fd->u.native_f.proc = proc;
-    fd->next = interpreter->function_list;
-
-    interpreter->function_list = fd;
+    crb_add_function(interpreter, fd);
 
     return fd;
 }
\ No newline at end of file
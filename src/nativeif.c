@@ -39,6 +39,7 @@ CRB_array_set(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     DBG_assert(obj->type == ARRAY_OBJECT,
                ("obj->type..%d\n", obj->type));
     obj->u.array.array[index] = *value;
+    crb_write_barrier(inter, obj, value);
 }
 
 CRB_Value
@@ -49,6 +50,7 @@ CRB_create_closure(CRB_LocalEnvironment *env, CRB_FunctionDefinition *fd)
     ret.type = CRB_CLOSURE_VALUE;
     ret.u.closure.function = fd;
     ret.u.closure.environment = env->variable;
+    crb_capture_scope_chain(crb_get_current_interpreter(), env->variable);
 
     return ret;
 }
@@ -0,0 +1,2183 @@
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+#define OPTIMIZE_MAX_ROUND      (8)
+#define INLINE_MAX_SIZE         (16)
+
+typedef struct Optimizer_tag Optimizer;
+
+/*
+ * A pass visits every expression after its operands and every
+ * statement after its blocks. The statement visitor may replace
+ * the statement at *link, and returns the link to continue from.
+ */
+typedef struct {
+    void (*prepare)(Optimizer *opt);
+    void (*expression)(Optimizer *opt, Expression *expr);
+    StatementList **(*statement)(Optimizer *opt, StatementList **link);
+} OptimizePassInfo;
+
+/*
+ * A final variable assigned a literal by a statement of the outermost
+ * block of a function (or of the top level), and never assigned
+ * elsewhere. function is NULL for a global variable.
+ */
+typedef struct {
+    CRB_FunctionDefinition      *function;
+    int                         index;
+    char                        *name;
+    Statement                   *definition;
+    int                         assign_count;
+    CRB_Boolean                 is_defined;
+    CRB_Boolean                 precedes_call;
+} FinalConstant;
+
+/*
+ * The loop being proven to access array[index] within its bounds.
+ */
+typedef struct {
+    int                         function_count;
+    IdentifierExpression        *index;
+    IdentifierExpression        *array;
+    Expression                  *size_call;
+    Expression                  *post;
+    CRB_Boolean                 is_proven;
+    int                         access_count;
+    int                         access_alloc_size;
+    Expression                  **access;
+} LoopProof;
+
+typedef enum {
+    UNKNOWN_STATIC_TYPE = 1,
+    INT_STATIC_TYPE,
+    DOUBLE_STATIC_TYPE,
+    BOOLEAN_STATIC_TYPE,
+    STRING_STATIC_TYPE
+} StaticType;
+
+/*
+ * The types of the local variables of the function being analyzed
+ * at a point of it.
+ */
+typedef struct {
+    CRB_Boolean is_reachable;
+    StaticType  *type;
+} TypeState;
+
+/*
+ * The states in which the iteration of a loop is left by break
+ * and by continue statements.
+ */
+typedef struct TypeLoop_tag {
+    char                *label;
+    TypeState           break_state;
+    TypeState           continue_state;
+    struct TypeLoop_tag *outer;
+} TypeLoop;
+
+typedef struct {
+    int                 variable_count;
+    CRB_Boolean         *is_unstable;
+    CRB_Boolean         is_recording;
+    TypeLoop            *loop;
+} TypeInference;
+
+struct Optimizer_tag {
+    CRB_Interpreter     *inter;
+    CRB_OptimizePass    pass;
+    OptimizePassInfo    *info;
+    StatementList       *last_statement;
+    CRB_FunctionDefinition      *last_function;
+    int                 function_count;
+    int                 function_alloc_size;
+    CRB_FunctionDefinition      **function;
+    int                 block_depth;
+    int                 try_depth;
+    int                 foreach_depth;
+    int                 constant_count;
+    FinalConstant       *constant;
+    CRB_Boolean         is_call_seen;
+    char                *size_name;
+    LoopProof           loop;
+    TypeInference       types;
+    CRB_Boolean         is_changed;
+};
+
+static void walk_expression(Optimizer *opt, Expression *expr);
+static void walk_statement_list(Optimizer *opt, StatementList **link);
+
+static void
+count_rewrite(Optimizer *opt)
+{
+    opt->is_changed = CRB_TRUE;
+    opt->inter->optimize.rewrite_count[opt->pass]++;
+}
+
+static void
+walk_function(Optimizer *opt, CRB_FunctionDefinition *fd)
+{
+    int block_depth = opt->block_depth;
+    int try_depth = opt->try_depth;
+    int foreach_depth = opt->foreach_depth;
+
+    if (opt->function_count == opt->function_alloc_size) {
+        opt->function_alloc_size += 8;
+        opt->function
+            = MEM_realloc(opt->function,
+                          sizeof(CRB_FunctionDefinition*)
+                          * opt->function_alloc_size);
+    }
+    opt->function[opt->function_count] = fd;
+    opt->function_count++;
+    opt->block_depth = 0;
+    opt->try_depth = 0;
+    opt->foreach_depth = 0;
+
+    walk_statement_list(opt, &fd->u.crowbar_f.block->statement_list);
+
+    opt->block_depth = block_depth;
+    opt->try_depth = try_depth;
+    opt->foreach_depth = foreach_depth;
+    opt->function_count--;
+}
+
+static void
+walk_block(Optimizer *opt, CRB_Block *block)
+{
+    if (block == NULL)
+        return;
+
+    opt->block_depth++;
+    walk_statement_list(opt, &block->statement_list);
+    opt->block_depth--;
+}
+
+/*
+ * Assigned identifiers and called identifiers are not visited,
+ * so that the expression visitors see only the values read.
+ */
+static void
+walk_expression(Optimizer *opt, Expression *expr)
+{
+    ArgumentList        *arg_pos;
+    ExpressionList      *expr_pos;
+
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:       /* FALLTHRU */
+    case IDENTIFIER_EXPRESSION:
+        break;
+    case COMMA_EXPRESSION:
+        walk_expression(opt, expr->u.comma.left);
+        walk_expression(opt, expr->u.comma.right);
+        break;
+    case ASSIGN_EXPRESSION:
+        if (expr->u.assign_expression.left->type != IDENTIFIER_EXPRESSION) {
+            walk_expression(opt, expr->u.assign_expression.left);
+        }
+        walk_expression(opt, expr->u.assign_expression.operand);
+        break;
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION: /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        walk_expression(opt, expr->u.binary_expression.left);
+        walk_expression(opt, expr->u.binary_expression.right);
+        break;
+    case MINUS_EXPRESSION:
+        walk_expression(opt, expr->u.minus_expression);
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        walk_expression(opt, expr->u.logical_not);
+        break;
+    case FUNCTION_CALL_EXPRESSION:
+        if (expr->u.function_call_expression.function->type
+            != IDENTIFIER_EXPRESSION) {
+            walk_expression(opt, expr->u.function_call_expression.function);
+        }
+        for (arg_pos = expr->u.function_call_expression.argument; arg_pos;
+             arg_pos = arg_pos->next) {
+            walk_expression(opt, arg_pos->expression);
+        }
+        break;
+    case MEMBER_EXPRESSION:
+        walk_expression(opt, expr->u.member_expression.expression);
+        break;
+    case ARRAY_EXPRESSION:
+        for (expr_pos = expr->u.array_literal; expr_pos;
+             expr_pos = expr_pos->next) {
+            walk_expression(opt, expr_pos->expression);
+        }
+        break;
+    case INDEX_EXPRESSION:
+        walk_expression(opt, expr->u.index_expression.array);
+        walk_expression(opt, expr->u.index_expression.index);
+        break;
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:
+        if (expr->u.inc_dec.operand->type != IDENTIFIER_EXPRESSION) {
+            walk_expression(opt, expr->u.inc_dec.operand);
+        }
+        break;
+    case CLOSURE_EXPRESSION:
+        walk_function(opt, expr->u.closure.function_definition);
+        break;
+    case INLINE_PARAMETER_EXPRESSION:
+        break;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+    if (opt->info->expression) {
+        opt->info->expression(opt, expr);
+    }
+}
+
+static void
+walk_statement(Optimizer *opt, Statement *statement)
+{
+    Elsif *pos;
+
+    switch (statement->type) {
+    case EXPRESSION_STATEMENT:
+        walk_expression(opt, statement->u.expression_s);
+        break;
+    case GLOBAL_STATEMENT:
+        break;
+    case IF_STATEMENT:
+        walk_expression(opt, statement->u.if_s.condition);
+        walk_block(opt, statement->u.if_s.then_block);
+        for (pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+            walk_expression(opt, pos->condition);
+            walk_block(opt, pos->block);
+        }
+        walk_block(opt, statement->u.if_s.else_block);
+        break;
+    case WHILE_STATEMENT:
+        walk_expression(opt, statement->u.while_s.condition);
+        walk_block(opt, statement->u.while_s.block);
+        break;
+    case FOR_STATEMENT:
+        if (statement->u.for_s.init) {
+            walk_expression(opt, statement->u.for_s.init);
+        }
+        if (statement->u.for_s.condition) {
+            walk_expression(opt, statement->u.for_s.condition);
+        }
+        if (statement->u.for_s.post) {
+            walk_expression(opt, statement->u.for_s.post);
+        }
+        walk_block(opt, statement->u.for_s.block);
+        break;
+    case FOREACH_STATEMENT:
+        walk_expression(opt, statement->u.foreach_s.collection);
+        opt->foreach_depth++;
+        walk_block(opt, statement->u.foreach_s.block);
+        opt->foreach_depth--;
+        break;
+    case RETURN_STATEMENT:
+        if (statement->u.return_s.return_value) {
+            walk_expression(opt, statement->u.return_s.return_value);
+        }
+        break;
+    case BREAK_STATEMENT:       /* FALLTHRU */
+    case CONTINUE_STATEMENT:
+        break;
+    case TRY_STATEMENT:
+        opt->try_depth++;
+        walk_block(opt, statement->u.try_s.try_block);
+        walk_block(opt, statement->u.try_s.catch_block);
+        walk_block(opt, statement->u.try_s.finally_block);
+        opt->try_depth--;
+        break;
+    case THROW_STATEMENT:
+        walk_expression(opt, statement->u.throw_s.exception);
+        break;
+    case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", statement->type));
+    }
+}
+
+static void
+walk_statement_list(Optimizer *opt, StatementList **link)
+{
+    while (*link) {
+        walk_statement(opt, (*link)->statement);
+        if (opt->info->statement) {
+            link = opt->info->statement(opt, link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+}
+
+/*
+ * Only the current compilation is walked. The functions of the earlier
+ * ones may already have their bytecode, which refers to their nodes.
+ */
+static void
+walk_program(Optimizer *opt)
+{
+    CRB_FunctionDefinition *pos;
+
+    if (opt->last_statement) {
+        walk_statement_list(opt, &opt->last_statement->next);
+    } else {
+        walk_statement_list(opt, &opt->inter->statement_list);
+    }
+    for (pos = opt->inter->function_list; pos != opt->last_function;
+         pos = pos->next) {
+        if (pos->type == CRB_CROWBAR_FUNCTION_DEFINITION) {
+            walk_function(opt, pos);
+        }
+    }
+}
+
+static CRB_Boolean
+is_literal(Expression *expr)
+{
+    return expr->type == BOOLEAN_EXPRESSION
+        || expr->type == INT_EXPRESSION
+        || expr->type == DOUBLE_EXPRESSION
+        || expr->type == STRING_EXPRESSION
+        || expr->type == NULL_EXPRESSION;
+}
+
+static void
+replace_with_literal(Expression *expr, Expression *literal)
+{
+    int line_number = expr->line_number;
+
+    *expr = *literal;
+    expr->line_number = line_number;
+}
+
+static void
+replace_with_boolean(Expression *expr, CRB_Boolean value)
+{
+    expr->type = BOOLEAN_EXPRESSION;
+    expr->u.boolean_value = value;
+}
+
+/**********************************************************************
+ * constant propagation
+ **********************************************************************/
+static FinalConstant *
+search_constant(Optimizer *opt, IdentifierExpression *identifier)
+{
+    CRB_FunctionDefinition *fd;
+    int i;
+
+    if (identifier->depth >= 0) {
+        fd = opt->function[opt->function_count - 1 - identifier->depth];
+    } else if (opt->function_count == 0 || identifier->global_index >= 0) {
+        fd = NULL;
+    } else {
+        return NULL;
+    }
+    for (i = 0; i < opt->constant_count; i++) {
+        if (opt->constant[i].function != fd)
+            continue;
+        if (fd ? opt->constant[i].index == identifier->index
+            : opt->constant[i].name == identifier->name) {
+            return &opt->constant[i];
+        }
+    }
+    return NULL;
+}
+
+static CRB_Boolean
+is_final_definition(Statement *statement)
+{
+    Expression *expr;
+
+    if (statement->type != EXPRESSION_STATEMENT)
+        return CRB_FALSE;
+    expr = statement->u.expression_s;
+
+    return expr->type == ASSIGN_EXPRESSION
+        && expr->u.assign_expression.is_final
+        && expr->u.assign_expression.left->type == IDENTIFIER_EXPRESSION;
+}
+
+static void
+collect_call(Optimizer *opt, Expression *expr)
+{
+    if (expr->type == FUNCTION_CALL_EXPRESSION && opt->function_count == 0) {
+        opt->is_call_seen = CRB_TRUE;
+    }
+}
+
+static StatementList **
+collect_definition(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+    IdentifierExpression *identifier;
+    FinalConstant *constant;
+
+    if (opt->block_depth > 0 || !is_final_definition(statement))
+        return &(*link)->next;
+
+    identifier = &statement->u.expression_s->u.assign_expression.left
+        ->u.identifier;
+    if (opt->function_count > 0 && identifier->depth != 0)
+        return &(*link)->next;
+
+    opt->constant = MEM_realloc(opt->constant,
+                                sizeof(FinalConstant)
+                                * (opt->constant_count + 1));
+    constant = &opt->constant[opt->constant_count];
+    opt->constant_count++;
+    constant->function = opt->function_count > 0
+        ? opt->function[opt->function_count - 1] : NULL;
+    constant->index = identifier->index;
+    constant->name = identifier->name;
+    constant->definition = statement;
+    constant->assign_count = 0;
+    constant->is_defined = CRB_FALSE;
+    constant->precedes_call = !opt->is_call_seen;
+
+    return &(*link)->next;
+}
+
+static void
+count_assignment(Optimizer *opt, IdentifierExpression *identifier)
+{
+    FinalConstant *constant;
+
+    constant = search_constant(opt, identifier);
+    if (constant) {
+        constant->assign_count++;
+    }
+}
+
+static void
+count_assign_expression(Optimizer *opt, Expression *expr)
+{
+    if (expr->type == ASSIGN_EXPRESSION
+        && expr->u.assign_expression.left->type == IDENTIFIER_EXPRESSION) {
+        count_assignment(opt, &expr->u.assign_expression.left->u.identifier);
+    } else if ((expr->type == INCREMENT_EXPRESSION
+                || expr->type == DECREMENT_EXPRESSION)
+               && expr->u.inc_dec.operand->type == IDENTIFIER_EXPRESSION) {
+        count_assignment(opt, &expr->u.inc_dec.operand->u.identifier);
+    }
+}
+
+static StatementList **
+count_assign_statement(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+
+    if (statement->type == FOREACH_STATEMENT) {
+        count_assignment(opt, &statement->u.foreach_s.variable);
+    } else if (statement->type == TRY_STATEMENT
+               && statement->u.try_s.catch_block) {
+        count_assignment(opt, &statement->u.try_s.exception);
+    }
+
+    return &(*link)->next;
+}
+
+static OptimizePassInfo st_collect_definition_info = {
+    NULL, collect_call, collect_definition
+};
+
+static OptimizePassInfo st_count_assignment_info = {
+    NULL, count_assign_expression, count_assign_statement
+};
+
+static void
+prepare_constant_propagation(Optimizer *opt)
+{
+    OptimizePassInfo *info = opt->info;
+
+    opt->constant_count = 0;
+    opt->is_call_seen = CRB_FALSE;
+    opt->info = &st_collect_definition_info;
+    walk_program(opt);
+    opt->info = &st_count_assignment_info;
+    walk_program(opt);
+    opt->info = info;
+}
+
+/*
+ * A global read in a function is replaced only when no function can
+ * have been called before the top level defines it.
+ */
+static void
+propagate_constant(Optimizer *opt, Expression *expr)
+{
+    FinalConstant *constant;
+    Expression *value;
+
+    if (expr->type != IDENTIFIER_EXPRESSION)
+        return;
+
+    constant = search_constant(opt, &expr->u.identifier);
+    if (constant == NULL || constant->assign_count != 1)
+        return;
+    if (constant->function == NULL && opt->function_count > 0) {
+        if (!constant->precedes_call)
+            return;
+    } else if (!constant->is_defined) {
+        return;
+    }
+    value = constant->definition->u.expression_s->u.assign_expression.operand;
+    if (!is_literal(value))
+        return;
+
+    replace_with_literal(expr, value);
+    count_rewrite(opt);
+}
+
+static StatementList **
+define_constant(Optimizer *opt, StatementList **link)
+{
+    int i;
+
+    if (opt->block_depth > 0 || !is_final_definition((*link)->statement))
+        return &(*link)->next;
+
+    for (i = 0; i < opt->constant_count; i++) {
+        if (opt->constant[i].definition == (*link)->statement) {
+            opt->constant[i].is_defined = CRB_TRUE;
+        }
+    }
+    return &(*link)->next;
+}
+
+/**********************************************************************
+ * constant folding
+ **********************************************************************/
+static void
+fold_string_concatenation(Optimizer *opt, Expression *expr)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    CRB_Value   v;
+    CRB_Char    *right_str = NULL;
+    CRB_Char    *str;
+
+    if (!is_literal(right))
+        return;
+
+    if (right->type != STRING_EXPRESSION) {
+        if (right->type == BOOLEAN_EXPRESSION) {
+            v.type = CRB_BOOLEAN_VALUE;
+            v.u.boolean_value = right->u.boolean_value;
+        } else if (right->type == INT_EXPRESSION) {
+            v.type = CRB_INT_VALUE;
+            v.u.int_value = right->u.int_value;
+        } else if (right->type == DOUBLE_EXPRESSION) {
+            v.type = CRB_DOUBLE_VALUE;
+            v.u.double_value = right->u.double_value;
+        } else {
+            v.type = CRB_NULL_VALUE;
+        }
+        right_str = CRB_value_to_string(opt->inter, NULL,
+                                        right->line_number, &v);
+    }
+    str = crb_malloc(sizeof(CRB_Char)
+                     * (CRB_wcslen(left->u.string_value)
+                        + CRB_wcslen(right_str ? right_str
+                                     : right->u.string_value) + 1));
+    CRB_wcscpy(str, left->u.string_value);
+    CRB_wcscat(str, right_str ? right_str : right->u.string_value);
+    if (right_str) {
+        MEM_free(right_str);
+    }
+    expr->type = STRING_EXPRESSION;
+    expr->u.string_value = str;
+    count_rewrite(opt);
+}
+
+static void
+fold_comparison(Optimizer *opt, Expression *expr)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    int         cmp;
+
+    if (left->type == BOOLEAN_EXPRESSION
+        && right->type == BOOLEAN_EXPRESSION) {
+        if (expr->type != EQ_EXPRESSION && expr->type != NE_EXPRESSION)
+            return;
+        cmp = left->u.boolean_value != right->u.boolean_value;
+    } else if (left->type == STRING_EXPRESSION
+               && right->type == STRING_EXPRESSION) {
+        cmp = CRB_wcscmp(left->u.string_value, right->u.string_value);
+    } else if ((left->type == NULL_EXPRESSION
+                || right->type == NULL_EXPRESSION)
+               && is_literal(left) && is_literal(right)) {
+        if (expr->type != EQ_EXPRESSION && expr->type != NE_EXPRESSION)
+            return;
+        cmp = left->type != right->type;
+    } else {
+        return;
+    }
+
+    if (expr->type == EQ_EXPRESSION) {
+        replace_with_boolean(expr, cmp == 0);
+    } else if (expr->type == NE_EXPRESSION) {
+        replace_with_boolean(expr, cmp != 0);
+    } else if (expr->type == GT_EXPRESSION) {
+        replace_with_boolean(expr, cmp > 0);
+    } else if (expr->type == GE_EXPRESSION) {
+        replace_with_boolean(expr, cmp >= 0);
+    } else if (expr->type == LT_EXPRESSION) {
+        replace_with_boolean(expr, cmp < 0);
+    } else if (expr->type == LE_EXPRESSION) {
+        replace_with_boolean(expr, cmp <= 0);
+    } else {
+        return;
+    }
+    count_rewrite(opt);
+}
+
+static CRB_Boolean
+is_numeric_literal(Expression *expr)
+{
+    return expr->type == INT_EXPRESSION || expr->type == DOUBLE_EXPRESSION;
+}
+
+/*
+ * Numeric operations are folded by the evaluator, as the parser does
+ * for numeric literals, except an integer division by zero, which is
+ * left to be reported at runtime.
+ */
+static void
+fold_numeric_operation(Optimizer *opt, Expression *expr)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    CRB_Value   v;
+
+    if ((expr->type == DIV_EXPRESSION || expr->type == MOD_EXPRESSION)
+        && left->type == INT_EXPRESSION && right->type == INT_EXPRESSION
+        && right->u.int_value == 0)
+        return;
+
+    v = crb_eval_binary_expression(opt->inter, NULL, expr->type, left, right);
+    if (v.type == CRB_INT_VALUE) {
+        expr->type = INT_EXPRESSION;
+        expr->u.int_value = v.u.int_value;
+    } else if (v.type == CRB_DOUBLE_VALUE) {
+        expr->type = DOUBLE_EXPRESSION;
+        expr->u.double_value = v.u.double_value;
+    } else {
+        DBG_assert(v.type == CRB_BOOLEAN_VALUE, ("v.type..%d\n", v.type));
+        replace_with_boolean(expr, v.u.boolean_value);
+    }
+    count_rewrite(opt);
+}
+
+/*
+ * The right operand is dropped only when it would not be evaluated;
+ * otherwise it must be a boolean literal, as it is checked at runtime.
+ */
+static void
+fold_logical_operation(Optimizer *opt, Expression *expr)
+{
+    Expression  *left = expr->u.binary_expression.left;
+    Expression  *right = expr->u.binary_expression.right;
+    CRB_Boolean short_circuit_value;
+
+    if (left->type != BOOLEAN_EXPRESSION)
+        return;
+
+    short_circuit_value = (expr->type == LOGICAL_OR_EXPRESSION);
+    if (left->u.boolean_value == short_circuit_value) {
+        replace_with_boolean(expr, short_circuit_value);
+    } else if (right->type == BOOLEAN_EXPRESSION) {
+        replace_with_boolean(expr, right->u.boolean_value);
+    } else {
+        return;
+    }
+    count_rewrite(opt);
+}
+
+static void
+fold_constant(Optimizer *opt, Expression *expr)
+{
+    Expression *operand;
+
+    switch (expr->type) {
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION:
+        if (is_numeric_literal(expr->u.binary_expression.left)
+            && is_numeric_literal(expr->u.binary_expression.right)) {
+            fold_numeric_operation(opt, expr);
+        } else if (expr->type == ADD_EXPRESSION
+                   && (expr->u.binary_expression.left->type
+                       == STRING_EXPRESSION)) {
+            fold_string_concatenation(opt, expr);
+        } else {
+            fold_comparison(opt, expr);
+        }
+        break;
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        fold_logical_operation(opt, expr);
+        break;
+    case MINUS_EXPRESSION:
+        operand = expr->u.minus_expression;
+        if (operand->type == INT_EXPRESSION) {
+            expr->type = INT_EXPRESSION;
+            expr->u.int_value = -operand->u.int_value;
+            count_rewrite(opt);
+        } else if (operand->type == DOUBLE_EXPRESSION) {
+            expr->type = DOUBLE_EXPRESSION;
+            expr->u.double_value = -operand->u.double_value;
+            count_rewrite(opt);
+        }
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        operand = expr->u.logical_not;
+        if (operand->type == BOOLEAN_EXPRESSION) {
+            replace_with_boolean(expr, !operand->u.boolean_value);
+            count_rewrite(opt);
+        }
+        break;
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case IDENTIFIER_EXPRESSION: /* FALLTHRU */
+    case COMMA_EXPRESSION:      /* FALLTHRU */
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case MEMBER_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:       /* FALLTHRU */
+    case ARRAY_EXPRESSION:      /* FALLTHRU */
+    case INDEX_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:  /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:
+        break;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+}
+
+/**********************************************************************
+ * dead branch elimination
+ **********************************************************************/
+/*
+ * Replaces the statement at *link with the statements of block,
+ * which have been optimized already.
+ */
+static StatementList **
+replace_statement(Optimizer *opt, StatementList **link, CRB_Block *block)
+{
+    StatementList *next = (*link)->next;
+    StatementList *pos;
+
+    count_rewrite(opt);
+    if (block == NULL || block->statement_list == NULL) {
+        *link = next;
+        return link;
+    }
+    *link = block->statement_list;
+    for (pos = *link; pos->next; pos = pos->next)
+        ;
+    pos->next = next;
+
+    return &pos->next;
+}
+
+static StatementList **
+eliminate_dead_if(Optimizer *opt, StatementList **link)
+{
+    IfStatement *if_s = &(*link)->statement->u.if_s;
+    Elsif       **elsif_p;
+    Expression  *condition;
+
+    for (elsif_p = &if_s->elsif_list; *elsif_p; ) {
+        condition = (*elsif_p)->condition;
+        if (condition->type != BOOLEAN_EXPRESSION) {
+            elsif_p = &(*elsif_p)->next;
+        } else if (condition->u.boolean_value) {
+            if_s->else_block = (*elsif_p)->block;
+            *elsif_p = NULL;
+            count_rewrite(opt);
+        } else {
+            *elsif_p = (*elsif_p)->next;
+            count_rewrite(opt);
+        }
+    }
+
+    condition = if_s->condition;
+    if (condition->type != BOOLEAN_EXPRESSION)
+        return &(*link)->next;
+
+    if (condition->u.boolean_value) {
+        return replace_statement(opt, link, if_s->then_block);
+    } else if (if_s->elsif_list) {
+        if_s->condition = if_s->elsif_list->condition;
+        if_s->then_block = if_s->elsif_list->block;
+        if_s->elsif_list = if_s->elsif_list->next;
+        count_rewrite(opt);
+        return &(*link)->next;
+    } else {
+        return replace_statement(opt, link, if_s->else_block);
+    }
+}
+
+static StatementList **
+eliminate_dead_branch(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+
+    if (statement->type == IF_STATEMENT) {
+        return eliminate_dead_if(opt, link);
+    } else if (statement->type == WHILE_STATEMENT
+               && statement->u.while_s.condition->type == BOOLEAN_EXPRESSION
+               && !statement->u.while_s.condition->u.boolean_value) {
+        return replace_statement(opt, link, NULL);
+    }
+    return &(*link)->next;
+}
+
+/**********************************************************************
+ * unused expression elimination
+ **********************************************************************/
+static CRB_Boolean
+is_pure(Expression *expr)
+{
+    ExpressionList *pos;
+
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:       /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:
+        return CRB_TRUE;
+    case COMMA_EXPRESSION:
+        return is_pure(expr->u.comma.left) && is_pure(expr->u.comma.right);
+    case ARRAY_EXPRESSION:
+        for (pos = expr->u.array_literal; pos; pos = pos->next) {
+            if (!is_pure(pos->expression))
+                return CRB_FALSE;
+        }
+        return CRB_TRUE;
+    case IDENTIFIER_EXPRESSION: /* FALLTHRU */
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION: /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION: /* FALLTHRU */
+    case MINUS_EXPRESSION:      /* FALLTHRU */
+    case LOGICAL_NOT_EXPRESSION:        /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case MEMBER_EXPRESSION:     /* FALLTHRU */
+    case INDEX_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:
+        return CRB_FALSE;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+    return CRB_FALSE;
+}
+
+static StatementList **
+eliminate_unused_expression(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+
+    if (statement->type == EXPRESSION_STATEMENT
+        && is_pure(statement->u.expression_s)) {
+        return replace_statement(opt, link, NULL);
+    }
+    return &(*link)->next;
+}
+
+/**********************************************************************
+ * loop optimization
+ **********************************************************************/
+static CRB_Boolean
+is_size_call(Optimizer *opt, Expression *expr)
+{
+    Expression *function;
+
+    if (expr->type != FUNCTION_CALL_EXPRESSION
+        || expr->u.function_call_expression.argument != NULL)
+        return CRB_FALSE;
+    function = expr->u.function_call_expression.function;
+
+    return function->type == MEMBER_EXPRESSION
+        && function->u.member_expression.member_name == opt->size_name;
+}
+
+static void
+mark_array_size(Optimizer *opt, Expression *expr)
+{
+    if (is_size_call(opt, expr)
+        && !expr->u.function_call_expression.is_array_size) {
+        expr->u.function_call_expression.is_array_size = CRB_TRUE;
+        count_rewrite(opt);
+    }
+}
+
+static OptimizePassInfo st_mark_array_size_info = {
+    NULL, mark_array_size, NULL
+};
+
+static CRB_Boolean
+is_same_variable(Expression *expr, IdentifierExpression *identifier)
+{
+    return expr->type == IDENTIFIER_EXPRESSION
+        && expr->u.identifier.name == identifier->name
+        && expr->u.identifier.depth == identifier->depth;
+}
+
+static void
+disprove_assignment(Optimizer *opt, Expression *expr)
+{
+    if (is_same_variable(expr, opt->loop.index)
+        || is_same_variable(expr, opt->loop.array)) {
+        opt->loop.is_proven = CRB_FALSE;
+    }
+}
+
+/*
+ * Arrays are resized only by calls, so a loop without calls keeps
+ * the size of its array, unless the array variable is assigned.
+ * Closures in the loop are not called, and are not looked into.
+ */
+static void
+prove_loop_expression(Optimizer *opt, Expression *expr)
+{
+    LoopProof *loop = &opt->loop;
+
+    if (opt->function_count != loop->function_count || expr == loop->post)
+        return;
+
+    if (expr->type == FUNCTION_CALL_EXPRESSION) {
+        if (expr != loop->size_call) {
+            loop->is_proven = CRB_FALSE;
+        }
+    } else if (expr->type == ASSIGN_EXPRESSION) {
+        disprove_assignment(opt, expr->u.assign_expression.left);
+    } else if (expr->type == INCREMENT_EXPRESSION
+               || expr->type == DECREMENT_EXPRESSION) {
+        disprove_assignment(opt, expr->u.inc_dec.operand);
+    } else if (expr->type == INDEX_EXPRESSION
+               && is_same_variable(expr->u.index_expression.array,
+                                   loop->array)
+               && is_same_variable(expr->u.index_expression.index,
+                                   loop->index)) {
+        if (loop->access_count == loop->access_alloc_size) {
+            loop->access_alloc_size += 8;
+            loop->access = MEM_realloc(loop->access,
+                                       sizeof(Expression*)
+                                       * loop->access_alloc_size);
+        }
+        loop->access[loop->access_count] = expr;
+        loop->access_count++;
+    }
+}
+
+/*
+ * foreach may call the iterator methods of an assoc, and a try lets
+ * the loop go on after a runtime error called the create method of
+ * an exception class. Either can run script code that resizes the
+ * array, so neither is allowed in the loop.
+ */
+static StatementList **
+prove_loop_statement(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+
+    if ((statement->type == FOREACH_STATEMENT
+         || statement->type == TRY_STATEMENT)
+        && opt->function_count == opt->loop.function_count) {
+        opt->loop.is_proven = CRB_FALSE;
+    }
+    return &(*link)->next;
+}
+
+static OptimizePassInfo st_prove_loop_info = {
+    NULL, prove_loop_expression, prove_loop_statement
+};
+
+/*
+ * Recognizes for (i = <int >= 0>; i < a.size(); i++ or i += 1)
+ * over local variables of a function without closures, where nothing
+ * else can assign i or a.
+ */
+static CRB_Boolean
+is_induction_loop(Optimizer *opt, ForStatement *for_s)
+{
+    CRB_FunctionDefinition *fd;
+    Expression *init = for_s->init;
+    Expression *condition = for_s->condition;
+    Expression *post = for_s->post;
+    Expression *array;
+
+    if (opt->function_count == 0)
+        return CRB_FALSE;
+    fd = opt->function[opt->function_count - 1];
+    if (!fd->u.crowbar_f.is_capture_free)
+        return CRB_FALSE;
+
+    if (init == NULL || init->type != ASSIGN_EXPRESSION
+        || init->u.assign_expression.operator != NORMAL_ASSIGN
+        || init->u.assign_expression.left->type != IDENTIFIER_EXPRESSION
+        || init->u.assign_expression.left->u.identifier.depth != 0
+        || init->u.assign_expression.operand->type != INT_EXPRESSION
+        || init->u.assign_expression.operand->u.int_value < 0)
+        return CRB_FALSE;
+    opt->loop.index = &init->u.assign_expression.left->u.identifier;
+
+    if (condition == NULL || condition->type != LT_EXPRESSION
+        || !is_same_variable(condition->u.binary_expression.left,
+                             opt->loop.index)
+        || !is_size_call(opt, condition->u.binary_expression.right))
+        return CRB_FALSE;
+    opt->loop.size_call = condition->u.binary_expression.right;
+    array = opt->loop.size_call->u.function_call_expression.function
+        ->u.member_expression.expression;
+    if (array->type != IDENTIFIER_EXPRESSION
+        || array->u.identifier.depth != 0
+        || array->u.identifier.name == opt->loop.index->name)
+        return CRB_FALSE;
+    opt->loop.array = &array->u.identifier;
+
+    if (post == NULL)
+        return CRB_FALSE;
+    if (post->type == INCREMENT_EXPRESSION) {
+        if (!is_same_variable(post->u.inc_dec.operand, opt->loop.index))
+            return CRB_FALSE;
+    } else if (post->type == ASSIGN_EXPRESSION) {
+        if (post->u.assign_expression.operator != ADD_ASSIGN
+            || !is_same_variable(post->u.assign_expression.left,
+                                 opt->loop.index)
+            || post->u.assign_expression.operand->type != INT_EXPRESSION
+            || post->u.assign_expression.operand->u.int_value != 1)
+            return CRB_FALSE;
+    } else {
+        return CRB_FALSE;
+    }
+    opt->loop.post = post;
+
+    return CRB_TRUE;
+}
+
+static void
+elide_bounds_checks(Optimizer *opt, ForStatement *for_s)
+{
+    OptimizePassInfo *info = opt->info;
+    int i;
+
+    if (!is_induction_loop(opt, for_s))
+        return;
+
+    opt->loop.function_count = opt->function_count;
+    opt->loop.is_proven = CRB_TRUE;
+    opt->loop.access_count = 0;
+    opt->info = &st_prove_loop_info;
+    walk_expression(opt, for_s->condition);
+    walk_expression(opt, for_s->post);
+    walk_block(opt, for_s->block);
+    opt->info = info;
+
+    if (!opt->loop.is_proven)
+        return;
+    for (i = 0; i < opt->loop.access_count; i++) {
+        if (!opt->loop.access[i]->u.index_expression.is_in_bounds) {
+            opt->loop.access[i]->u.index_expression.is_in_bounds = CRB_TRUE;
+            count_rewrite(opt);
+        }
+    }
+}
+
+static StatementList **
+optimize_loop(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+    OptimizePassInfo *info = opt->info;
+
+    if (statement->type == FOR_STATEMENT && statement->u.for_s.condition) {
+        opt->info = &st_mark_array_size_info;
+        walk_expression(opt, statement->u.for_s.condition);
+        opt->info = info;
+        elide_bounds_checks(opt, &statement->u.for_s);
+    } else if (statement->type == WHILE_STATEMENT) {
+        opt->info = &st_mark_array_size_info;
+        walk_expression(opt, statement->u.while_s.condition);
+        opt->info = info;
+    }
+    return &(*link)->next;
+}
+
+/*
+ * Inline expansion.
+ * A function whose body is a single return statement is inlined when
+ * the returned expression reads nothing but its parameters and makes
+ * no call, so that it can be neither recursive nor capturing.
+ * The arguments stay on the stack as for a call, and the copied body
+ * reads them through an inline frame, which also keeps the function
+ * in stack traces.
+ */
+static int
+inline_body_size(Expression *expr, int param_count)
+{
+    ExpressionList      *pos;
+    int         size;
+    int         sub;
+
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:
+        return 1;
+    case IDENTIFIER_EXPRESSION:
+        if (expr->u.identifier.depth != 0
+            || expr->u.identifier.index >= param_count)
+            return -1;
+        return 1;
+    case COMMA_EXPRESSION:
+        size = inline_body_size(expr->u.comma.left, param_count);
+        sub = inline_body_size(expr->u.comma.right, param_count);
+        break;
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION: /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        size = inline_body_size(expr->u.binary_expression.left,
+                                param_count);
+        sub = inline_body_size(expr->u.binary_expression.right,
+                               param_count);
+        break;
+    case MINUS_EXPRESSION:
+        size = inline_body_size(expr->u.minus_expression, param_count);
+        sub = 0;
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        size = inline_body_size(expr->u.logical_not, param_count);
+        sub = 0;
+        break;
+    case MEMBER_EXPRESSION:
+        size = inline_body_size(expr->u.member_expression.expression,
+                                param_count);
+        sub = 0;
+        break;
+    case INDEX_EXPRESSION:
+        size = inline_body_size(expr->u.index_expression.array,
+                                param_count);
+        sub = inline_body_size(expr->u.index_expression.index,
+                               param_count);
+        break;
+    case ARRAY_EXPRESSION:
+        size = 0;
+        sub = 0;
+        for (pos = expr->u.array_literal; pos && sub >= 0; pos = pos->next) {
+            sub = inline_body_size(pos->expression, param_count);
+            size += sub;
+        }
+        break;
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:  /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:
+        return -1;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+        return -1;
+    }
+    if (size < 0 || sub < 0)
+        return -1;
+
+    return size + sub + 1;
+}
+
+static Expression *
+copy_inline_body(Expression *expr)
+{
+    Expression          *copy;
+    ExpressionList      *pos;
+    ExpressionList      **tail;
+
+    copy = crb_malloc(sizeof(Expression));
+    *copy = *expr;
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:
+        break;
+    case IDENTIFIER_EXPRESSION:
+        copy->type = INLINE_PARAMETER_EXPRESSION;
+        copy->u.inline_parameter = expr->u.identifier.index;
+        break;
+    case COMMA_EXPRESSION:
+        copy->u.comma.left = copy_inline_body(expr->u.comma.left);
+        copy->u.comma.right = copy_inline_body(expr->u.comma.right);
+        break;
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION: /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        copy->u.binary_expression.left
+            = copy_inline_body(expr->u.binary_expression.left);
+        copy->u.binary_expression.right
+            = copy_inline_body(expr->u.binary_expression.right);
+        copy->u.binary_expression.quickening = BINARY_NOT_QUICKENED;
+        break;
+    case MINUS_EXPRESSION:
+        copy->u.minus_expression = copy_inline_body(expr->u.minus_expression);
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        copy->u.logical_not = copy_inline_body(expr->u.logical_not);
+        break;
+    case MEMBER_EXPRESSION:
+        copy->u.member_expression.expression
+            = copy_inline_body(expr->u.member_expression.expression);
+        copy->u.member_expression.cache.entry_count = 0;
+        copy->u.member_expression.cache.hit_count = 0;
+        copy->u.member_expression.cache.miss_count = 0;
+        break;
+    case INDEX_EXPRESSION:
+        copy->u.index_expression.array
+            = copy_inline_body(expr->u.index_expression.array);
+        copy->u.index_expression.index
+            = copy_inline_body(expr->u.index_expression.index);
+        copy->u.index_expression.is_in_bounds = CRB_FALSE;
+        break;
+    case ARRAY_EXPRESSION:
+        tail = &copy->u.array_literal;
+        for (pos = expr->u.array_literal; pos; pos = pos->next) {
+            *tail = crb_malloc(sizeof(ExpressionList));
+            (*tail)->expression = copy_inline_body(pos->expression);
+            tail = &(*tail)->next;
+        }
+        *tail = NULL;
+        break;
+    case ASSIGN_EXPRESSION:     /* FALLTHRU */
+    case FUNCTION_CALL_EXPRESSION:      /* FALLTHRU */
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:  /* FALLTHRU */
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+
+    return copy;
+}
+
+static Expression *
+inline_return_value(CRB_FunctionDefinition *fd, int arg_count)
+{
+    CRB_ParameterList   *param;
+    int         param_count = 0;
+    StatementList       *list;
+    Expression  *value;
+    int         size;
+
+    for (param = fd->u.crowbar_f.parameter; param; param = param->next) {
+        param_count++;
+    }
+    if (param_count != arg_count)
+        return NULL;
+
+    list = fd->u.crowbar_f.block->statement_list;
+    if (list == NULL || list->next != NULL
+        || list->statement->type != RETURN_STATEMENT)
+        return NULL;
+
+    value = list->statement->u.return_s.return_value;
+    if (value == NULL)
+        return NULL;
+
+    size = inline_body_size(value, param_count);
+    if (size < 0 || size > INLINE_MAX_SIZE)
+        return NULL;
+
+    return value;
+}
+
+static void
+inline_function_call(Optimizer *opt, Expression *expr)
+{
+    FunctionCallExpression      *call;
+    IdentifierExpression        *identifier;
+    CRB_FunctionDefinition      *fd;
+    ArgumentList        *arg_pos;
+    int         arg_count = 0;
+    Expression  *value;
+
+    if (expr->type != FUNCTION_CALL_EXPRESSION)
+        return;
+
+    call = &expr->u.function_call_expression;
+    if (call->inline_function || call->is_array_size
+        || call->function->type != IDENTIFIER_EXPRESSION)
+        return;
+
+    identifier = &call->function->u.identifier;
+    if (identifier->depth >= 0
+        || (opt->function_count > 0 && identifier->global_index >= 0))
+        return;
+
+    fd = crb_search_function(opt->inter, identifier->name);
+    if (fd == NULL || fd->type != CRB_CROWBAR_FUNCTION_DEFINITION
+        || fd->is_closure)
+        return;
+
+    for (arg_pos = call->argument; arg_pos; arg_pos = arg_pos->next) {
+        arg_count++;
+    }
+    value = inline_return_value(fd, arg_count);
+    if (value == NULL)
+        return;
+
+    call->inline_function = fd;
+    call->inline_body = copy_inline_body(value);
+    count_rewrite(opt);
+}
+
+/**********************************************************************
+ * type inference
+ **********************************************************************/
+/*
+ * The types of the local variables are followed through the body
+ * of each function without closures, where nothing but the function
+ * itself assigns them, so that binary expressions and increments
+ * on proven operands are specialized before their first evaluation.
+ * A variable assigned in a try statement or declared final is left
+ * unknown. The top level is not analyzed, since any call may assign
+ * a global variable.
+ */
+static void
+init_type_state(Optimizer *opt, TypeState *state, CRB_Boolean is_reachable)
+{
+    int i;
+
+    state->is_reachable = is_reachable;
+    state->type = MEM_malloc(sizeof(StaticType) * opt->types.variable_count);
+    for (i = 0; i < opt->types.variable_count; i++) {
+        state->type[i] = UNKNOWN_STATIC_TYPE;
+    }
+}
+
+static void
+copy_type_state(Optimizer *opt, TypeState *dest, TypeState *src)
+{
+    dest->is_reachable = src->is_reachable;
+    memcpy(dest->type, src->type,
+           sizeof(StaticType) * opt->types.variable_count);
+}
+
+/*
+ * Returns whether dest has changed.
+ */
+static CRB_Boolean
+join_type_state(Optimizer *opt, TypeState *dest, TypeState *src)
+{
+    CRB_Boolean is_changed = CRB_FALSE;
+    int i;
+
+    if (!src->is_reachable)
+        return CRB_FALSE;
+
+    if (!dest->is_reachable) {
+        copy_type_state(opt, dest, src);
+        return CRB_TRUE;
+    }
+    for (i = 0; i < opt->types.variable_count; i++) {
+        if (dest->type[i] != src->type[i]
+            && dest->type[i] != UNKNOWN_STATIC_TYPE) {
+            dest->type[i] = UNKNOWN_STATIC_TYPE;
+            is_changed = CRB_TRUE;
+        }
+    }
+    return is_changed;
+}
+
+static int
+local_variable_index(Optimizer *opt, IdentifierExpression *identifier)
+{
+    if (identifier->depth != 0
+        || identifier->index >= opt->types.variable_count
+        || opt->types.is_unstable[identifier->index])
+        return -1;
+
+    return identifier->index;
+}
+
+static void
+mark_unstable(Optimizer *opt, IdentifierExpression *identifier)
+{
+    if (identifier->depth == 0
+        && identifier->index < opt->types.variable_count) {
+        opt->types.is_unstable[identifier->index] = CRB_TRUE;
+    }
+}
+
+static void
+mark_unstable_expression(Optimizer *opt, Expression *expr)
+{
+    if (expr->type == ASSIGN_EXPRESSION
+        && expr->u.assign_expression.left->type == IDENTIFIER_EXPRESSION) {
+        mark_unstable(opt, &expr->u.assign_expression.left->u.identifier);
+    }
+}
+
+static StatementList **
+mark_unstable_statement(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+
+    if (statement->type == FOREACH_STATEMENT) {
+        mark_unstable(opt, &statement->u.foreach_s.variable);
+    } else if (statement->type == TRY_STATEMENT
+               && statement->u.try_s.catch_block) {
+        mark_unstable(opt, &statement->u.try_s.exception);
+    }
+    return &(*link)->next;
+}
+
+static OptimizePassInfo st_mark_unstable_info = {
+    NULL, mark_unstable_expression, mark_unstable_statement
+};
+
+/*
+ * An increment bypasses the check of a final variable.
+ */
+static void
+find_final_assignment(Optimizer *opt, Expression *expr)
+{
+    if (expr->type == ASSIGN_EXPRESSION
+        && expr->u.assign_expression.is_final) {
+        mark_unstable_expression(opt, expr);
+    }
+}
+
+static StatementList **
+find_try_statement(Optimizer *opt, StatementList **link)
+{
+    Statement *statement = (*link)->statement;
+    OptimizePassInfo *info = opt->info;
+
+    if (statement->type == TRY_STATEMENT) {
+        opt->info = &st_mark_unstable_info;
+        walk_block(opt, statement->u.try_s.try_block);
+        walk_block(opt, statement->u.try_s.catch_block);
+        walk_block(opt, statement->u.try_s.finally_block);
+        mark_unstable_statement(opt, link);
+        opt->info = info;
+    }
+    return &(*link)->next;
+}
+
+static OptimizePassInfo st_find_unstable_info = {
+    NULL, find_final_assignment, find_try_statement
+};
+
+static CRB_Boolean
+is_comparison(ExpressionType type)
+{
+    return type == EQ_EXPRESSION || type == NE_EXPRESSION
+        || type == GT_EXPRESSION || type == GE_EXPRESSION
+        || type == LT_EXPRESSION || type == LE_EXPRESSION;
+}
+
+static CRB_Boolean
+is_numeric_type(StaticType type)
+{
+    return type == INT_STATIC_TYPE || type == DOUBLE_STATIC_TYPE;
+}
+
+/*
+ * The type of the result when the operation does not fail.
+ */
+static StaticType
+binary_result_type(ExpressionType operator, StaticType left, StaticType right)
+{
+    if (is_comparison(operator))
+        return BOOLEAN_STATIC_TYPE;
+
+    if (left == INT_STATIC_TYPE && right == INT_STATIC_TYPE)
+        return INT_STATIC_TYPE;
+    if (is_numeric_type(left) && is_numeric_type(right))
+        return DOUBLE_STATIC_TYPE;
+    if (left == STRING_STATIC_TYPE && operator == ADD_EXPRESSION)
+        return STRING_STATIC_TYPE;
+
+    return UNKNOWN_STATIC_TYPE;
+}
+
+static ExpressionType
+assignment_operator_type(AssignmentOperator operator)
+{
+    switch (operator) {
+    case ADD_ASSIGN:
+        return ADD_EXPRESSION;
+    case SUB_ASSIGN:
+        return SUB_EXPRESSION;
+    case MUL_ASSIGN:
+        return MUL_EXPRESSION;
+    case DIV_ASSIGN:
+        return DIV_EXPRESSION;
+    case MOD_ASSIGN:
+        return MOD_EXPRESSION;
+    case NORMAL_ASSIGN:         /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case..%d\n", operator));
+    }
+    return EXPRESSION_TYPE_COUNT_PLUS_1;
+}
+
+static void
+specialize_binary_expression(Optimizer *opt, Expression *expr,
+                             StaticType left, StaticType right)
+{
+    BinaryQuickening quickening;
+
+    if (!opt->types.is_recording
+        || expr->u.binary_expression.quickening != BINARY_NOT_QUICKENED)
+        return;
+
+    if (left == INT_STATIC_TYPE && right == INT_STATIC_TYPE) {
+        quickening = BINARY_INT_INT;
+    } else if (left == DOUBLE_STATIC_TYPE && right == DOUBLE_STATIC_TYPE) {
+        quickening = BINARY_DOUBLE_DOUBLE;
+    } else if (left == STRING_STATIC_TYPE && expr->type == ADD_EXPRESSION) {
+        quickening = BINARY_STRING_CONCAT;
+    } else {
+        return;
+    }
+    expr->u.binary_expression.quickening = quickening;
+    count_rewrite(opt);
+}
+
+static StaticType infer_expression(Optimizer *opt, Expression *expr,
+                                   TypeState *state);
+
+static StaticType
+infer_assign_expression(Optimizer *opt, Expression *expr, TypeState *state)
+{
+    Expression  *left = expr->u.assign_expression.left;
+    StaticType  type;
+    int         index = -1;
+
+    type = infer_expression(opt, expr->u.assign_expression.operand, state);
+    if (left->type == IDENTIFIER_EXPRESSION) {
+        index = local_variable_index(opt, &left->u.identifier);
+    } else if (left->type == MEMBER_EXPRESSION) {
+        infer_expression(opt, left->u.member_expression.expression, state);
+    } else if (left->type == INDEX_EXPRESSION) {
+        infer_expression(opt, left->u.index_expression.array, state);
+        infer_expression(opt, left->u.index_expression.index, state);
+    }
+    if (index < 0)
+        return type;
+
+    if (expr->u.assign_expression.operator == NORMAL_ASSIGN) {
+        state->type[index] = type;
+    } else {
+        state->type[index]
+            = binary_result_type(assignment_operator_type(expr->u
+                                                          .assign_expression
+                                                          .operator),
+                                 state->type[index], type);
+    }
+    return type;
+}
+
+static void
+infer_logical_operand(Optimizer *opt, Expression *expr, TypeState *state)
+{
+    TypeState   operand_state;
+
+    init_type_state(opt, &operand_state, CRB_TRUE);
+    copy_type_state(opt, &operand_state, state);
+    infer_expression(opt, expr, &operand_state);
+    join_type_state(opt, state, &operand_state);
+    MEM_free(operand_state.type);
+}
+
+/*
+ * An increment succeeds only on an int, so a local variable known
+ * to be defined holds an int after it.
+ */
+static StaticType
+infer_inc_dec_expression(Optimizer *opt, Expression *expr, TypeState *state)
+{
+    Expression  *operand = expr->u.inc_dec.operand;
+    int         index;
+
+    if (operand->type != IDENTIFIER_EXPRESSION) {
+        infer_expression(opt, operand, state);
+        return INT_STATIC_TYPE;
+    }
+    index = local_variable_index(opt, &operand->u.identifier);
+    if (index < 0 || state->type[index] == UNKNOWN_STATIC_TYPE)
+        return INT_STATIC_TYPE;
+
+    if (state->type[index] == INT_STATIC_TYPE && opt->types.is_recording
+        && !expr->u.inc_dec.is_local_int) {
+        expr->u.inc_dec.is_local_int = CRB_TRUE;
+        count_rewrite(opt);
+    }
+    state->type[index] = INT_STATIC_TYPE;
+
+    return INT_STATIC_TYPE;
+}
+
+static StaticType
+infer_expression(Optimizer *opt, Expression *expr, TypeState *state)
+{
+    StaticType          left;
+    StaticType          right;
+    ArgumentList        *arg_pos;
+    ExpressionList      *expr_pos;
+    int                 index;
+
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:
+        return BOOLEAN_STATIC_TYPE;
+    case INT_EXPRESSION:
+        return INT_STATIC_TYPE;
+    case DOUBLE_EXPRESSION:
+        return DOUBLE_STATIC_TYPE;
+    case STRING_EXPRESSION:
+        return STRING_STATIC_TYPE;
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:
+        break;
+    case IDENTIFIER_EXPRESSION:
+        index = local_variable_index(opt, &expr->u.identifier);
+        if (index >= 0)
+            return state->type[index];
+        break;
+    case COMMA_EXPRESSION:
+        infer_expression(opt, expr->u.comma.left, state);
+        return infer_expression(opt, expr->u.comma.right, state);
+    case ASSIGN_EXPRESSION:
+        return infer_assign_expression(opt, expr, state);
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION:
+        left = infer_expression(opt, expr->u.binary_expression.left, state);
+        right = infer_expression(opt, expr->u.binary_expression.right, state);
+        specialize_binary_expression(opt, expr, left, right);
+        return binary_result_type(expr->type, left, right);
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        infer_expression(opt, expr->u.binary_expression.left, state);
+        infer_logical_operand(opt, expr->u.binary_expression.right, state);
+        return BOOLEAN_STATIC_TYPE;
+    case MINUS_EXPRESSION:
+        left = infer_expression(opt, expr->u.minus_expression, state);
+        if (is_numeric_type(left))
+            return left;
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        infer_expression(opt, expr->u.logical_not, state);
+        return BOOLEAN_STATIC_TYPE;
+    case FUNCTION_CALL_EXPRESSION:
+        infer_expression(opt, expr->u.function_call_expression.function,
+                         state);
+        for (arg_pos = expr->u.function_call_expression.argument; arg_pos;
+             arg_pos = arg_pos->next) {
+            infer_expression(opt, arg_pos->expression, state);
+        }
+        break;
+    case MEMBER_EXPRESSION:
+        infer_expression(opt, expr->u.member_expression.expression, state);
+        break;
+    case ARRAY_EXPRESSION:
+        for (expr_pos = expr->u.array_literal; expr_pos;
+             expr_pos = expr_pos->next) {
+            infer_expression(opt, expr_pos->expression, state);
+        }
+        break;
+    case INDEX_EXPRESSION:
+        infer_expression(opt, expr->u.index_expression.array, state);
+        infer_expression(opt, expr->u.index_expression.index, state);
+        break;
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:
+        return infer_inc_dec_expression(opt, expr, state);
+    case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:
+        break;
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+    return UNKNOWN_STATIC_TYPE;
+}
+
+static void infer_statement(Optimizer *opt, Statement *statement,
+                            TypeState *state);
+
+static void
+infer_block(Optimizer *opt, CRB_Block *block, TypeState *state)
+{
+    StatementList *pos;
+
+    if (block == NULL)
+        return;
+
+    for (pos = block->statement_list; pos && state->is_reachable;
+         pos = pos->next) {
+        infer_statement(opt, pos->statement, state);
+    }
+}
+
+static void
+infer_if_statement(Optimizer *opt, IfStatement *if_s, TypeState *state)
+{
+    TypeState   result;
+    TypeState   branch;
+    Elsif       *pos;
+
+    init_type_state(opt, &result, CRB_FALSE);
+    init_type_state(opt, &branch, CRB_TRUE);
+
+    infer_expression(opt, if_s->condition, state);
+    copy_type_state(opt, &branch, state);
+    infer_block(opt, if_s->then_block, &branch);
+    join_type_state(opt, &result, &branch);
+    for (pos = if_s->elsif_list; pos; pos = pos->next) {
+        infer_expression(opt, pos->condition, state);
+        copy_type_state(opt, &branch, state);
+        infer_block(opt, pos->block, &branch);
+        join_type_state(opt, &result, &branch);
+    }
+    infer_block(opt, if_s->else_block, state);
+    join_type_state(opt, &result, state);
+    copy_type_state(opt, state, &result);
+
+    MEM_free(result.type);
+    MEM_free(branch.type);
+}
+
+/*
+ * A break or continue that the innermost loop does not take
+ * may reach any loop up to the labeled one.
+ */
+static void
+infer_jump(Optimizer *opt, char *label, CRB_Boolean is_break,
+           TypeState *state)
+{
+    TypeLoop *pos;
+
+    for (pos = opt->types.loop; pos; pos = pos->outer) {
+        if (label == NULL || pos->label == label) {
+            join_type_state(opt, is_break
+                            ? &pos->break_state : &pos->continue_state,
+                            state);
+            break;
+        }
+        join_type_state(opt, &pos->break_state, state);
+        join_type_state(opt, &pos->continue_state, state);
+    }
+    state->is_reachable = CRB_FALSE;
+}
+
+/*
+ * Runs an iteration of the loop from head, setting exit to the state
+ * in which the loop ends, and joins the state at the end of the
+ * iteration into head. Returns whether head has changed.
+ */
+static CRB_Boolean
+infer_loop_iteration(Optimizer *opt, Statement *statement,
+                     TypeState *head, TypeState *exit)
+{
+    TypeLoop    *loop = opt->types.loop;
+    TypeState   state;
+    CRB_Block   *block;
+    int         index;
+    CRB_Boolean is_changed;
+
+    init_type_state(opt, &state, CRB_TRUE);
+    copy_type_state(opt, &state, head);
+    loop->break_state.is_reachable = CRB_FALSE;
+    loop->continue_state.is_reachable = CRB_FALSE;
+
+    if (statement->type == WHILE_STATEMENT) {
+        infer_expression(opt, statement->u.while_s.condition, &state);
+        copy_type_state(opt, exit, &state);
+        block = statement->u.while_s.block;
+    } else if (statement->type == FOR_STATEMENT) {
+        if (statement->u.for_s.condition) {
+            infer_expression(opt, statement->u.for_s.condition, &state);
+            copy_type_state(opt, exit, &state);
+        } else {
+            exit->is_reachable = CRB_FALSE;
+        }
+        block = statement->u.for_s.block;
+    } else {
+        DBG_assert(statement->type == FOREACH_STATEMENT,
+                   ("statement->type..%d\n", statement->type));
+        copy_type_state(opt, exit, &state);
+        index = local_variable_index(opt, &statement->u.foreach_s.variable);
+        if (index >= 0) {
+            state.type[index] = UNKNOWN_STATIC_TYPE;
+        }
+        block = statement->u.foreach_s.block;
+    }
+    infer_block(opt, block, &state);
+    join_type_state(opt, &state, &loop->continue_state);
+    if (statement->type == FOR_STATEMENT && statement->u.for_s.post
+        && state.is_reachable) {
+        infer_expression(opt, statement->u.for_s.post, &state);
+    }
+    is_changed = join_type_state(opt, head, &state);
+    MEM_free(state.type);
+
+    return is_changed;
+}
+
+/*
+ * The loop is iterated until the state at its head stops changing,
+ * and then once more to record the specializations.
+ */
+static void
+infer_loop(Optimizer *opt, Statement *statement, char *label,
+           TypeState *state)
+{
+    TypeLoop    loop;
+    TypeState   head;
+    TypeState   exit;
+    CRB_Boolean is_recording = opt->types.is_recording;
+
+    if (statement->type == FOR_STATEMENT && statement->u.for_s.init) {
+        infer_expression(opt, statement->u.for_s.init, state);
+    } else if (statement->type == FOREACH_STATEMENT) {
+        infer_expression(opt, statement->u.foreach_s.collection, state);
+    }
+
+    loop.label = label;
+    init_type_state(opt, &loop.break_state, CRB_FALSE);
+    init_type_state(opt, &loop.continue_state, CRB_FALSE);
+    loop.outer = opt->types.loop;
+    opt->types.loop = &loop;
+    init_type_state(opt, &head, CRB_TRUE);
+    copy_type_state(opt, &head, state);
+    init_type_state(opt, &exit, CRB_FALSE);
+
+    opt->types.is_recording = CRB_FALSE;
+    while (infer_loop_iteration(opt, statement, &head, &exit))
+        ;
+    if (is_recording) {
+        opt->types.is_recording = CRB_TRUE;
+        infer_loop_iteration(opt, statement, &head, &exit);
+    }
+    opt->types.loop = loop.outer;
+
+    copy_type_state(opt, state, &exit);
+    join_type_state(opt, state, &loop.break_state);
+
+    MEM_free(loop.break_state.type);
+    MEM_free(loop.continue_state.type);
+    MEM_free(head.type);
+    MEM_free(exit.type);
+}
+
+/*
+ * The variables assigned in a try statement are unstable, so the
+ * others keep the types they have before it.
+ */
+static void
+infer_try_statement(Optimizer *opt, TryStatement *try_s, TypeState *state)
+{
+    TypeState   block_state;
+
+    init_type_state(opt, &block_state, CRB_TRUE);
+    copy_type_state(opt, &block_state, state);
+    infer_block(opt, try_s->try_block, &block_state);
+    copy_type_state(opt, &block_state, state);
+    infer_block(opt, try_s->catch_block, &block_state);
+    copy_type_state(opt, &block_state, state);
+    infer_block(opt, try_s->finally_block, &block_state);
+    MEM_free(block_state.type);
+}
+
+static void
+infer_statement(Optimizer *opt, Statement *statement, TypeState *state)
+{
+    switch (statement->type) {
+    case EXPRESSION_STATEMENT:
+        infer_expression(opt, statement->u.expression_s, state);
+        break;
+    case GLOBAL_STATEMENT:
+        break;
+    case IF_STATEMENT:
+        infer_if_statement(opt, &statement->u.if_s, state);
+        break;
+    case WHILE_STATEMENT:
+        infer_loop(opt, statement, statement->u.while_s.label, state);
+        break;
+    case FOR_STATEMENT:
+        infer_loop(opt, statement, statement->u.for_s.label, state);
+        break;
+    case FOREACH_STATEMENT:
+        infer_loop(opt, statement, statement->u.foreach_s.label, state);
+        break;
+    case RETURN_STATEMENT:
+        if (statement->u.return_s.return_value) {
+            infer_expression(opt, statement->u.return_s.return_value, state);
+        }
+        state->is_reachable = CRB_FALSE;
+        break;
+    case BREAK_STATEMENT:
+        infer_jump(opt, statement->u.break_s.label, CRB_TRUE, state);
+        break;
+    case CONTINUE_STATEMENT:
+        infer_jump(opt, statement->u.continue_s.label, CRB_FALSE, state);
+        break;
+    case TRY_STATEMENT:
+        infer_try_statement(opt, &statement->u.try_s, state);
+        break;
+    case THROW_STATEMENT:
+        infer_expression(opt, statement->u.throw_s.exception, state);
+        state->is_reachable = CRB_FALSE;
+        break;
+    case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", statement->type));
+    }
+}
+
+static void
+infer_types(Optimizer *opt)
+{
+    OptimizePassInfo *info = opt->info;
+    CRB_FunctionDefinition *pos;
+    TypeState state;
+    int i;
+
+    for (pos = opt->inter->function_list; pos != opt->last_function;
+         pos = pos->next) {
+        if (pos->type != CRB_CROWBAR_FUNCTION_DEFINITION
+            || !pos->u.crowbar_f.is_capture_free
+            || pos->u.crowbar_f.local_variable_count <= 0)
+            continue;
+
+        opt->types.variable_count = pos->u.crowbar_f.local_variable_count;
+        opt->types.is_unstable
+            = MEM_malloc(sizeof(CRB_Boolean) * opt->types.variable_count);
+        for (i = 0; i < opt->types.variable_count; i++) {
+            opt->types.is_unstable[i] = CRB_FALSE;
+        }
+        opt->info = &st_find_unstable_info;
+        walk_function(opt, pos);
+        opt->info = info;
+
+        opt->types.is_recording = CRB_TRUE;
+        opt->types.loop = NULL;
+        init_type_state(opt, &state, CRB_TRUE);
+        infer_block(opt, pos->u.crowbar_f.block, &state);
+        MEM_free(state.type);
+        MEM_free(opt->types.is_unstable);
+    }
+}
+
+/**********************************************************************
+ * tail call
+ **********************************************************************/
+/*
+ * A returned call reuses the local environment of the function,
+ * unless the return is in a try statement, whose handlers must stay
+ * in effect, or in a foreach statement, which keeps its iterator on
+ * the stack. An inlined call needs no local environment.
+ */
+static StatementList **
+mark_tail_call(Optimizer *opt, StatementList **link)
+{
+    ReturnStatement *return_s;
+    Expression *value;
+    CRB_Boolean is_tail_call;
+
+    if ((*link)->statement->type != RETURN_STATEMENT)
+        return &(*link)->next;
+
+    return_s = &(*link)->statement->u.return_s;
+    value = return_s->return_value;
+    is_tail_call = opt->function_count > 0
+        && opt->try_depth == 0 && opt->foreach_depth == 0
+        && value != NULL && value->type == FUNCTION_CALL_EXPRESSION
+        && !value->u.function_call_expression.is_array_size
+        && value->u.function_call_expression.inline_function == NULL;
+    if (return_s->is_tail_call != is_tail_call) {
+        return_s->is_tail_call = is_tail_call;
+        count_rewrite(opt);
+    }
+    return &(*link)->next;
+}
+
+static OptimizePassInfo st_pass_info[] = {
+    {NULL, NULL, NULL},         /* dummy */
+    {prepare_constant_propagation, propagate_constant, define_constant},
+    {NULL, fold_constant, NULL},
+    {NULL, NULL, eliminate_dead_branch},
+    {NULL, NULL, eliminate_unused_expression},
+    {NULL, NULL, optimize_loop},
+    {NULL, inline_function_call, NULL},
+    {infer_types, NULL, NULL},
+    {NULL, NULL, mark_tail_call},
+};
+
+void
+crb_init_optimize_setting(CRB_Interpreter *inter)
+{
+    int i;
+
+    for (i = 0; i < CRB_OPTIMIZE_PASS_COUNT_PLUS_1; i++) {
+        inter->optimize.is_enabled[i] = CRB_TRUE;
+        inter->optimize.rewrite_count[i] = 0;
+    }
+}
+
+/*
+ * Runs the enabled passes over the current compilation until none of
+ * them rewrites anything. last_statement is the last top level statement
+ * and last_function the first function of the previous compilations.
+ */
+void
+crb_optimize(CRB_Interpreter *inter, StatementList *last_statement,
+             CRB_FunctionDefinition *last_function)
+{
+    Optimizer   opt;
+    int         round;
+    int         pass;
+
+    opt.inter = inter;
+    opt.last_statement = last_statement;
+    opt.last_function = last_function;
+    opt.function_count = 0;
+    opt.function_alloc_size = 0;
+    opt.function = NULL;
+    opt.block_depth = 0;
+    opt.try_depth = 0;
+    opt.foreach_depth = 0;
+    opt.constant_count = 0;
+    opt.constant = NULL;
+    opt.is_call_seen = CRB_FALSE;
+    opt.size_name = CRB_intern(inter, "size");
+    opt.loop.access_alloc_size = 0;
+    opt.loop.access = NULL;
+
+    for (round = 0; round < OPTIMIZE_MAX_ROUND; round++) {
+        opt.is_changed = CRB_FALSE;
+        for (pass = CRB_CONSTANT_PROPAGATION_PASS;
+             pass < CRB_OPTIMIZE_PASS_COUNT_PLUS_1; pass++) {
+            if (!inter->optimize.is_enabled[pass])
+                continue;
+            opt.pass = pass;
+            opt.info = &st_pass_info[pass];
+            if (opt.info->prepare) {
+                opt.info->prepare(&opt);
+            }
+            if (opt.info->expression || opt.info->statement) {
+                walk_program(&opt);
+            }
+        }
+        if (!opt.is_changed)
+            break;
+    }
+    MEM_free(opt.function);
+    MEM_free(opt.constant);
+    MEM_free(opt.loop.access);
+}
+
+void
+CRB_set_optimize_pass(CRB_Interpreter *inter, CRB_OptimizePass pass,
+                      CRB_Boolean enabled)
+{
+    DBG_assert(pass > 0 && pass < CRB_OPTIMIZE_PASS_COUNT_PLUS_1,
+               ("pass..%d\n", pass));
+    inter->optimize.is_enabled[pass] = enabled;
+}
+
+int
+CRB_get_optimize_statistics(CRB_Interpreter *inter, CRB_OptimizePass pass)
+{
+    DBG_assert(pass > 0 && pass < CRB_OPTIMIZE_PASS_COUNT_PLUS_1,
+               ("pass..%d\n", pass));
+    return inter->optimize.rewrite_count[pass];
+}
@@ -0,0 +1,411 @@
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+typedef enum {
+    COLLECT_PHASE = 1,
+    ANNOTATE_PHASE
+} ResolvePhase;
+
+/*
+ * A scope is a crowbar function being resolved. Its variables become
+ * the slots of the frame, in order: the name of a named closure,
+ * the parameters, and the local variables.
+ */
+typedef struct Scope_tag {
+    ResolvePhase        phase;
+    int                 variable_count;
+    char                **variable;
+    int                 global_count;
+    char                **global;
+    CRB_Boolean         has_closure;
+    struct Scope_tag    *outer;
+} Scope;
+
+static void resolve_function(CRB_FunctionDefinition *fd, Scope *outer);
+static void resolve_statement_list(Scope *scope, StatementList *list);
+
+static void
+add_name(int *count, char ***names, char *name)
+{
+    *names = MEM_realloc(*names, sizeof(char*) * (*count + 1));
+    (*names)[*count] = name;
+    (*count)++;
+}
+
+static int
+search_name(int count, char **names, char *name)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (names[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * An assigned name is a local variable unless an enclosing function
+ * already has it.
+ */
+static void
+declare_variable(Scope *scope, char *name)
+{
+    Scope *pos;
+
+    for (pos = scope; pos; pos = pos->outer) {
+        if (search_name(pos->variable_count, pos->variable, name) >= 0)
+            return;
+    }
+    add_name(&scope->variable_count, &scope->variable, name);
+}
+
+static void
+resolve_identifier(Scope *scope, IdentifierExpression *identifier)
+{
+    Scope       *pos;
+    int         depth;
+    int         index;
+
+    identifier->global_index = search_name(scope->global_count, scope->global,
+                                           identifier->name);
+    for (pos = scope, depth = 0; pos; pos = pos->outer, depth++) {
+        index = search_name(pos->variable_count, pos->variable,
+                            identifier->name);
+        if (index >= 0) {
+            identifier->depth = depth;
+            identifier->index = index;
+            return;
+        }
+    }
+    identifier->depth = -1;
+}
+
+/*
+ * Identifiers at the top level are global, so only closures are resolved
+ * there (scope is NULL).
+ */
+static void
+resolve_variable(Scope *scope, IdentifierExpression *identifier)
+{
+    if (scope == NULL)
+        return;
+
+    if (scope->phase == COLLECT_PHASE) {
+        declare_variable(scope, identifier->name);
+    } else {
+        resolve_identifier(scope, identifier);
+    }
+}
+
+static void
+resolve_expression(Scope *scope, Expression *expr)
+{
+    ArgumentList        *arg_pos;
+    ExpressionList      *expr_pos;
+
+    switch (expr->type) {
+    case BOOLEAN_EXPRESSION:    /* FALLTHRU */
+    case INT_EXPRESSION:        /* FALLTHRU */
+    case DOUBLE_EXPRESSION:     /* FALLTHRU */
+    case STRING_EXPRESSION:     /* FALLTHRU */
+    case REGEXP_EXPRESSION:     /* FALLTHRU */
+    case NULL_EXPRESSION:
+        break;
+    case IDENTIFIER_EXPRESSION:
+        if (scope && scope->phase == ANNOTATE_PHASE) {
+            resolve_identifier(scope, &expr->u.identifier);
+        }
+        break;
+    case COMMA_EXPRESSION:
+        resolve_expression(scope, expr->u.comma.left);
+        resolve_expression(scope, expr->u.comma.right);
+        break;
+    case ASSIGN_EXPRESSION:
+        if (scope && scope->phase == COLLECT_PHASE
+            && expr->u.assign_expression.operator == NORMAL_ASSIGN
+            && (expr->u.assign_expression.left->type
+                == IDENTIFIER_EXPRESSION)) {
+            declare_variable(scope,
+                             expr->u.assign_expression.left
+                             ->u.identifier.name);
+        }
+        resolve_expression(scope, expr->u.assign_expression.left);
+        resolve_expression(scope, expr->u.assign_expression.operand);
+        break;
+    case ADD_EXPRESSION:        /* FALLTHRU */
+    case SUB_EXPRESSION:        /* FALLTHRU */
+    case MUL_EXPRESSION:        /* FALLTHRU */
+    case DIV_EXPRESSION:        /* FALLTHRU */
+    case MOD_EXPRESSION:        /* FALLTHRU */
+    case EQ_EXPRESSION: /* FALLTHRU */
+    case NE_EXPRESSION: /* FALLTHRU */
+    case GT_EXPRESSION: /* FALLTHRU */
+    case GE_EXPRESSION: /* FALLTHRU */
+    case LT_EXPRESSION: /* FALLTHRU */
+    case LE_EXPRESSION: /* FALLTHRU */
+    case LOGICAL_AND_EXPRESSION:        /* FALLTHRU */
+    case LOGICAL_OR_EXPRESSION:
+        resolve_expression(scope, expr->u.binary_expression.left);
+        resolve_expression(scope, expr->u.binary_expression.right);
+        break;
+    case MINUS_EXPRESSION:
+        resolve_expression(scope, expr->u.minus_expression);
+        break;
+    case LOGICAL_NOT_EXPRESSION:
+        resolve_expression(scope, expr->u.logical_not);
+        break;
+    case FUNCTION_CALL_EXPRESSION:
+        resolve_expression(scope, expr->u.function_call_expression.function);
+        for (arg_pos = expr->u.function_call_expression.argument; arg_pos;
+             arg_pos = arg_pos->next) {
+            resolve_expression(scope, arg_pos->expression);
+        }
+        break;
+    case MEMBER_EXPRESSION:
+        resolve_expression(scope, expr->u.member_expression.expression);
+        break;
+    case ARRAY_EXPRESSION:
+        for (expr_pos = expr->u.array_literal; expr_pos;
+             expr_pos = expr_pos->next) {
+            resolve_expression(scope, expr_pos->expression);
+        }
+        break;
+    case INDEX_EXPRESSION:
+        resolve_expression(scope, expr->u.index_expression.array);
+        resolve_expression(scope, expr->u.index_expression.index);
+        break;
+    case INCREMENT_EXPRESSION:  /* FALLTHRU */
+    case DECREMENT_EXPRESSION:
+        resolve_expression(scope, expr->u.inc_dec.operand);
+        break;
+    case CLOSURE_EXPRESSION:
+        if (scope) {
+            scope->has_closure = CRB_TRUE;
+        }
+        /* the closure sees the complete variables of the outer scope. */
+        if (scope == NULL || scope->phase == ANNOTATE_PHASE) {
+            resolve_function(expr->u.closure.function_definition, scope);
+        }
+        break;
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
+    case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case. type..%d\n", expr->type));
+    }
+}
+
+static void
+resolve_global_statement(Scope *scope, Statement *statement)
+{
+    IdentifierList *pos;
+
+    if (scope == NULL)
+        return;
+
+    for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
+        if (scope->phase == COLLECT_PHASE) {
+            if (search_name(scope->global_count, scope->global,
+                            pos->name) < 0) {
+                add_name(&scope->global_count, &scope->global, pos->name);
+            }
+        } else {
+            pos->global_index = search_name(scope->global_count,
+                                            scope->global, pos->name);
+        }
+    }
+}
+
+static void
+resolve_if_statement(Scope *scope, Statement *statement)
+{
+    Elsif *pos;
+
+    resolve_expression(scope, statement->u.if_s.condition);
+    resolve_statement_list(scope,
+                           statement->u.if_s.then_block->statement_list);
+    for (pos = statement->u.if_s.elsif_list; pos; pos = pos->next) {
+        resolve_expression(scope, pos->condition);
+        resolve_statement_list(scope, pos->block->statement_list);
+    }
+    if (statement->u.if_s.else_block) {
+        resolve_statement_list(scope,
+                               statement->u.if_s.else_block->statement_list);
+    }
+}
+
+static void
+resolve_for_statement(Scope *scope, Statement *statement)
+{
+    if (statement->u.for_s.init) {
+        resolve_expression(scope, statement->u.for_s.init);
+    }
+    if (statement->u.for_s.condition) {
+        resolve_expression(scope, statement->u.for_s.condition);
+    }
+    if (statement->u.for_s.post) {
+        resolve_expression(scope, statement->u.for_s.post);
+    }
+    resolve_statement_list(scope, statement->u.for_s.block->statement_list);
+}
+
+static void
+resolve_try_statement(Scope *scope, Statement *statement)
+{
+    resolve_statement_list(scope,
+                           statement->u.try_s.try_block->statement_list);
+    if (statement->u.try_s.catch_block) {
+        resolve_variable(scope, &statement->u.try_s.exception);
+        resolve_statement_list(scope,
+                               statement->u.try_s.catch_block
+                               ->statement_list);
+    }
+    if (statement->u.try_s.finally_block) {
+        resolve_statement_list(scope,
+                               statement->u.try_s.finally_block
+                               ->statement_list);
+    }
+}
+
+static void
+resolve_statement(Scope *scope, Statement *statement)
+{
+    switch (statement->type) {
+    case EXPRESSION_STATEMENT:
+        resolve_expression(scope, statement->u.expression_s);
+        break;
+    case GLOBAL_STATEMENT:
+        resolve_global_statement(scope, statement);
+        break;
+    case IF_STATEMENT:
+        resolve_if_statement(scope, statement);
+        break;
+    case WHILE_STATEMENT:
+        resolve_expression(scope, statement->u.while_s.condition);
+        resolve_statement_list(scope,
+                               statement->u.while_s.block->statement_list);
+        break;
+    case FOR_STATEMENT:
+        resolve_for_statement(scope, statement);
+        break;
+    case FOREACH_STATEMENT:
+        resolve_expression(scope, statement->u.foreach_s.collection);
+        resolve_variable(scope, &statement->u.foreach_s.variable);
+        resolve_statement_list(scope,
+                               statement->u.foreach_s.block->statement_list);
+        break;
+    case RETURN_STATEMENT:
+        if (statement->u.return_s.return_value) {
+            resolve_expression(scope, statement->u.return_s.return_value);
+        }
+        break;
+    case BREAK_STATEMENT:       /* FALLTHRU */
+    case CONTINUE_STATEMENT:
+        break;
+    case TRY_STATEMENT:
+        resolve_try_statement(scope, statement);
+        break;
+    case THROW_STATEMENT:
+        resolve_expression(scope, statement->u.throw_s.exception);
+        break;
+    case STATEMENT_TYPE_COUNT_PLUS_1:   /* FALLTHRU */
+    default:
+        DBG_assert(0, ("bad case...%d", statement->type));
+    }
+}
+
+static void
+resolve_statement_list(Scope *scope, StatementList *list)
+{
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        resolve_statement(scope, pos->statement);
+    }
+}
+
+/*
+ * A name declared by a global statement is searched at runtime,
+ * because the statement may be executed after an assignment.
+ */
+static void
+remove_global_names(Scope *scope, int fixed_count)
+{
+    int src_idx;
+    int dest_idx;
+
+    for (src_idx = dest_idx = fixed_count; src_idx < scope->variable_count;
+         src_idx++) {
+        if (search_name(scope->global_count, scope->global,
+                        scope->variable[src_idx]) < 0) {
+            scope->variable[dest_idx] = scope->variable[src_idx];
+            dest_idx++;
+        }
+    }
+    scope->variable_count = dest_idx;
+}
+
+static void
+resolve_function(CRB_FunctionDefinition *fd, Scope *outer)
+{
+    Scope               scope;
+    CRB_ParameterList   *param_p;
+    int                 fixed_count;
+
+    if (fd->u.crowbar_f.local_variable_count >= 0)
+        return;
+
+    scope.variable_count = 0;
+    scope.variable = NULL;
+    scope.global_count = 0;
+    scope.global = NULL;
+    scope.has_closure = CRB_FALSE;
+    scope.outer = outer;
+
+    /* see crb_call_function_on_stack(). */
+    if (fd->is_closure && fd->name) {
+        add_name(&scope.variable_count, &scope.variable, fd->name);
+    }
+    for (param_p = fd->u.crowbar_f.parameter; param_p;
+         param_p = param_p->next) {
+        add_name(&scope.variable_count, &scope.variable, param_p->name);
+    }
+    fixed_count = scope.variable_count;
+
+    scope.phase = COLLECT_PHASE;
+    resolve_statement_list(&scope, fd->u.crowbar_f.block->statement_list);
+    remove_global_names(&scope, fixed_count);
+
+    scope.phase = ANNOTATE_PHASE;
+    resolve_statement_list(&scope, fd->u.crowbar_f.block->statement_list);
+
+    fd->u.crowbar_f.local_variable_count = scope.variable_count;
+    fd->u.crowbar_f.global_variable_count = scope.global_count;
+    /* see crb_create_frame_scope_chain(). */
+    fd->u.crowbar_f.is_capture_free = !scope.has_closure;
+    if (scope.variable_count > 0) {
+        fd->u.crowbar_f.local_variable
+            = crb_malloc(sizeof(char*) * scope.variable_count);
+        memcpy(fd->u.crowbar_f.local_variable, scope.variable,
+               sizeof(char*) * scope.variable_count);
+    }
+
+    MEM_free(scope.variable);
+    MEM_free(scope.global);
+}
+
+void
+crb_resolve_variables(CRB_Interpreter *inter)
+{
+    CRB_FunctionDefinition *pos;
+
+    for (pos = inter->function_list; pos; pos = pos->next) {
+        if (pos->type == CRB_CROWBAR_FUNCTION_DEFINITION) {
+            resolve_function(pos, NULL);
+        }
+    }
+    resolve_statement_list(NULL, inter->statement_list);
+}
@@ -58,13 +58,7 @@ crb_close_string_literal(void)
 char *
 crb_create_identifier(char *str)
 {
-    char *new_str;
-
-    new_str = crb_malloc(strlen(str) + 1);
-
-    strcpy(new_str, str);
-
-    return new_str;
+    return CRB_intern(crb_get_current_interpreter(), str);
 }
 
 static char st_regexp_start_char;
@@ -0,0 +1,127 @@
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+#define SYMBOL_TABLE_INITIAL_SIZE       (256)
+
+/*
+ * Every identifier of an interpreter is stored once in its symbol table,
+ * so that names can be compared by pointer.
+ */
+void
+crb_init_symbol_table(CRB_Interpreter *inter)
+{
+    int i;
+
+    inter->symbol_table.bucket_size = SYMBOL_TABLE_INITIAL_SIZE;
+    inter->symbol_table.symbol_count = 0;
+    inter->symbol_table.bucket
+        = MEM_malloc(sizeof(Symbol*) * SYMBOL_TABLE_INITIAL_SIZE);
+    for (i = 0; i < SYMBOL_TABLE_INITIAL_SIZE; i++) {
+        inter->symbol_table.bucket[i] = NULL;
+    }
+}
+
+void
+crb_dispose_symbol_table(CRB_Interpreter *inter)
+{
+    MEM_free(inter->symbol_table.bucket);
+    inter->symbol_table.bucket = NULL;
+}
+
+static unsigned int
+hash_name(char *name)
+{
+    unsigned int hash_value = 0;
+
+    for (; *name; name++) {
+        hash_value = hash_value * 31 + (unsigned char)*name;
+    }
+
+    return hash_value;
+}
+
+static Symbol *
+search_symbol(SymbolTable *table, char *name, unsigned int hash_value)
+{
+    Symbol *pos;
+
+    for (pos = table->bucket[hash_value % table->bucket_size]; pos;
+         pos = pos->next) {
+        if (pos->hash_value == hash_value && !strcmp(pos->name, name))
+            return pos;
+    }
+
+    return NULL;
+}
+
+static void
+extend_symbol_table(SymbolTable *table)
+{
+    int new_size;
+    Symbol **new_bucket;
+    Symbol *pos;
+    Symbol *next;
+    int i;
+
+    new_size = table->bucket_size * 2;
+    new_bucket = MEM_malloc(sizeof(Symbol*) * new_size);
+    for (i = 0; i < new_size; i++) {
+        new_bucket[i] = NULL;
+    }
+    for (i = 0; i < table->bucket_size; i++) {
+        for (pos = table->bucket[i]; pos; pos = next) {
+            next = pos->next;
+            pos->next = new_bucket[pos->hash_value % new_size];
+            new_bucket[pos->hash_value % new_size] = pos;
+        }
+    }
+    MEM_free(table->bucket);
+    table->bucket = new_bucket;
+    table->bucket_size = new_size;
+}
+
+/*
+ * Returns the symbol of the name, or NULL if the name is not interned.
+ */
+char *
+crb_search_symbol(CRB_Interpreter *inter, char *name)
+{
+    Symbol *sym;
+
+    sym = search_symbol(&inter->symbol_table, name, hash_name(name));
+    if (sym == NULL)
+        return NULL;
+
+    return sym->name;
+}
+
+char *
+CRB_intern(CRB_Interpreter *inter, char *name)
+{
+    SymbolTable *table = &inter->symbol_table;
+    unsigned int hash_value;
+    Symbol *sym;
+    int index;
+
+    hash_value = hash_name(name);
+    sym = search_symbol(table, name, hash_value);
+    if (sym) {
+        return sym->name;
+    }
+    if (table->symbol_count >= table->bucket_size) {
+        extend_symbol_table(table);
+    }
+    sym = MEM_storage_malloc(inter->interpreter_storage, sizeof(Symbol));
+    sym->name = MEM_storage_malloc(inter->interpreter_storage,
+                                   strlen(name) + 1);
+    strcpy(sym->name, name);
+    sym->hash_value = hash_value;
+    index = hash_value % table->bucket_size;
+    sym->next = table->bucket[index];
+    table->bucket[index] = sym;
+    table->symbol_count++;
+
+    return sym->name;
+}
@@ -18,16 +18,131 @@ crb_set_current_interpreter(CRB_Interpreter *inter)
     st_current_interpreter = inter;
 }
 
+#define FUNCTION_TABLE_INITIAL_SIZE     (256)
+
+/*
+ * Function names are symbols, so the hash value is taken from the pointer.
+ */
+static int
+hash_function_name(FunctionTable *table, char *name)
+{
+    return (int)(((unsigned long)name >> 3) & (table->size - 1));
+}
+
+static void
+put_function(FunctionTable *table, CRB_FunctionDefinition *fd)
+{
+    int pos;
+
+    for (pos = hash_function_name(table, fd->name); table->entry[pos];
+         pos = (pos + 1) & (table->size - 1)) {
+        if (table->entry[pos]->name == fd->name) {
+            table->entry[pos] = fd;
+            return;
+        }
+    }
+    table->entry[pos] = fd;
+    table->count++;
+}
+
+/*
+ * Keeps the function table at most half full.
+ */
+static void
+extend_function_table(FunctionTable *table)
+{
+    CRB_FunctionDefinition **old_entry = table->entry;
+    int old_size = table->size;
+    int i;
+
+    if (table->size == 0) {
+        table->size = FUNCTION_TABLE_INITIAL_SIZE;
+    } else {
+        table->size *= 2;
+    }
+    table->entry = MEM_malloc(sizeof(CRB_FunctionDefinition*) * table->size);
+    for (i = 0; i < table->size; i++) {
+        table->entry[i] = NULL;
+    }
+    table->count = 0;
+    for (i = 0; i < old_size; i++) {
+        if (old_entry[i]) {
+            put_function(table, old_entry[i]);
+        }
+    }
+    MEM_free(old_entry);
+}
+
+/*
+ * A function added later hides the one of the same name,
+ * so cached functions are invalidated.
+ */
+void
+crb_add_function(CRB_Interpreter *inter, CRB_FunctionDefinition *fd)
+{
+    FunctionTable *table = &inter->function_table;
+
+    fd->next = inter->function_list;
+    inter->function_list = fd;
+
+    if ((table->count + 1) * 2 > table->size) {
+        extend_function_table(table);
+    }
+    put_function(table, fd);
+    inter->function_version++;
+}
+
+void
+crb_dispose_function_table(CRB_Interpreter *inter)
+{
+    MEM_free(inter->function_table.entry);
+    inter->function_table.entry = NULL;
+    inter->function_table.size = 0;
+    inter->function_table.count = 0;
+}
+
+/*
+ * The name must be a symbol.
+ */
 CRB_FunctionDefinition *
-CRB_search_function(CRB_Interpreter *inter, char *name)
+crb_search_function(CRB_Interpreter *inter, char *name)
 {
-    CRB_FunctionDefinition *pos;
+    FunctionTable *table = &inter->function_table;
+    int pos;
 
-    for (pos = inter->function_list; pos; pos = pos->next) {
-        if (!strcmp(pos->name, name))
-            break;
+    if (table->size == 0)
+        return NULL;
+
+    for (pos = hash_function_name(table, name); table->entry[pos];
+         pos = (pos + 1) & (table->size - 1)) {
+        if (table->entry[pos]->name == name)
+            return table->entry[pos];
+    }
+    return NULL;
+}
+
+/*
+ * A variable of the name of a function shadows the function where
+ * the identifier was cached to the function.
+ */
+void
+crb_variable_added(CRB_Interpreter *inter, char *name)
+{
+    if (crb_search_function(inter, name)) {
+        inter->function_version++;
     }
-    return pos;
+}
+
+CRB_FunctionDefinition *
+CRB_search_function(CRB_Interpreter *inter, char *name)
+{
+    char *symbol;
+
+    symbol = crb_search_symbol(inter, name);
+    if (symbol == NULL)
+        return NULL;
+
+    return crb_search_function(inter, symbol);
 }
 
 CRB_FunctionDefinition *
@@ -36,7 +151,7 @@ crb_search_function_in_compile(char *name)
     CRB_Interpreter *inter;
 
     inter = crb_get_current_interpreter();
-    return CRB_search_function(inter, name);
+    return crb_search_function(inter, name);
 }
 
 void *
@@ -61,34 +176,54 @@ crb_execute_malloc(CRB_Interpreter *inter, size_t size)
     return p;
 }
 
-CRB_Value *
-CRB_search_local_variable(CRB_LocalEnvironment *env, char *identifier)
+static CRB_Value *
+search_scope_chain(CRB_Object *sc, char *identifier, CRB_Boolean *is_final)
 {
-    CRB_Value *value;
-    CRB_Object  *sc; /* scope chain */
+    int i;
 
-    if (env == NULL)
+    for (i = 0; i < sc->u.scope_chain.slot_count; i++) {
+        if (sc->u.scope_chain.slot[i].is_defined
+            && sc->u.scope_chain.slot_name[i] == identifier) {
+            *is_final = sc->u.scope_chain.slot[i].is_final;
+            return &sc->u.scope_chain.slot[i].value;
+        }
+    }
+    if (sc->u.scope_chain.frame == NULL)
         return NULL;
 
-    DBG_assert(env->variable->type == SCOPE_CHAIN_OBJECT,
-               ("type..%d\n", env->variable->type));
+    return crb_search_assoc_member_i(sc->u.scope_chain.frame, identifier,
+                                     is_final);
+}
 
-    for (sc = env->variable; sc; sc = sc->u.scope_chain.next) {
-        DBG_assert(sc->type == SCOPE_CHAIN_OBJECT,
-                   ("sc->type..%d\n", sc->type));
-        value = CRB_search_assoc_member(sc->u.scope_chain.frame, identifier);
-        if (value)
-            break;
-    }
+CRB_Value *
+CRB_search_local_variable(CRB_LocalEnvironment *env, char *identifier)
+{
+    CRB_Boolean is_final; /* dummy */
 
-    return value;
+    return CRB_search_local_variable_w(env, identifier, &is_final);
 }
 
 CRB_Value *
 CRB_search_local_variable_w(CRB_LocalEnvironment *env, char *identifier,
                             CRB_Boolean *is_final)
 {
-    CRB_Value *value;
+    char *symbol;
+
+    symbol = crb_search_symbol(crb_get_current_interpreter(), identifier);
+    if (symbol == NULL)
+        return NULL;
+
+    return crb_search_local_variable(env, symbol, is_final);
+}
+
+/*
+ * The identifier must be a symbol.
+ */
+CRB_Value *
+crb_search_local_variable(CRB_LocalEnvironment *env, char *identifier,
+                          CRB_Boolean *is_final)
+{
+    CRB_Value *value = NULL;
     CRB_Object  *sc; /* scope chain */
 
     if (env == NULL)
@@ -100,8 +235,7 @@ CRB_search_local_variable_w(CRB_LocalEnvironment *env, char *identifier,
     for (sc = env->variable; sc; sc = sc->u.scope_chain.next) {
         DBG_assert(sc->type == SCOPE_CHAIN_OBJECT,
                    ("sc->type..%d\n", sc->type));
-        value = CRB_search_assoc_member_w(sc->u.scope_chain.frame, identifier,
-                                          is_final);
+        value = search_scope_chain(sc, identifier, is_final);
         if (value)
             break;
     }
@@ -109,45 +243,73 @@ CRB_search_local_variable_w(CRB_LocalEnvironment *env, char *identifier,
     return value;
 }
 
-CRB_Value *
-CRB_search_global_variable(CRB_Interpreter *inter, char *identifier)
+/*
+ * Returns the slot the identifier was resolved to, or NULL when the slot
+ * is not defined yet or a variable added at runtime may shadow it.
+ * The caller then falls back to searching by name.
+ */
+Slot *
+crb_search_slot(CRB_LocalEnvironment *env, IdentifierExpression *identifier)
 {
-    Variable    *pos;
+    CRB_Object  *sc;
+    Slot        *slot;
+    int         i;
 
-    for (pos = inter->variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, identifier))
-            break;
-    }
-    if (pos == NULL) {
+    if (identifier->depth < 0)
         return NULL;
-    } else {
-        return &pos->value;
+
+    sc = env->variable;
+    for (i = 0; i < identifier->depth; i++) {
+        if (sc->u.scope_chain.frame)
+            return NULL;
+        sc = sc->u.scope_chain.next;
     }
+    DBG_assert(identifier->index < sc->u.scope_chain.slot_count,
+               ("index..%d, slot_count..%d\n",
+                identifier->index, sc->u.scope_chain.slot_count));
+    slot = &sc->u.scope_chain.slot[identifier->index];
+    if (!slot->is_defined)
+        return NULL;
+
+    return slot;
 }
 
+/*
+ * The identifier must be a symbol.
+ */
 Variable *
 crb_search_global_variable(CRB_Interpreter *inter, char *identifier)
 {
     Variable    *pos;
 
     for (pos = inter->variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, identifier))
+        if (pos->name == identifier)
             return pos;
     }
 
     return NULL;
 }
 
+CRB_Value *
+CRB_search_global_variable(CRB_Interpreter *inter, char *identifier)
+{
+    CRB_Boolean is_final; /* dummy */
+
+    return CRB_search_global_variable_w(inter, identifier, &is_final);
+}
+
 CRB_Value *
 CRB_search_global_variable_w(CRB_Interpreter *inter, char *identifier,
                              CRB_Boolean *is_final)
 {
+    char        *symbol;
     Variable    *pos;
 
-    for (pos = inter->variable; pos; pos = pos->next) {
-        if (!strcmp(pos->name, identifier))
-            break;
-    }
+    symbol = crb_search_symbol(inter, identifier);
+    if (symbol == NULL)
+        return NULL;
+
+    pos = crb_search_global_variable(inter, symbol);
     if (pos == NULL) {
         return NULL;
     } else {
@@ -162,16 +324,62 @@ CRB_add_local_variable(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
                        CRB_Boolean is_final)
 {
     CRB_Value *ret;
+    CRB_Value frame;
+
+    CRB_Object *sc;
+    int i;
 
     DBG_assert(env->variable->type == SCOPE_CHAIN_OBJECT,
                ("type..%d\n", env->variable->type));
 
-    ret = CRB_add_assoc_member(inter, env->variable->u.scope_chain.frame,
-                               identifier, value, is_final);
+    identifier = CRB_intern(inter, identifier);
+    sc = env->variable;
+    for (i = 0; i < sc->u.scope_chain.slot_count; i++) {
+        if (!sc->u.scope_chain.slot[i].is_defined
+            && sc->u.scope_chain.slot_name[i] == identifier) {
+            sc->u.scope_chain.slot[i].is_defined = CRB_TRUE;
+            sc->u.scope_chain.slot[i].is_final = is_final;
+            sc->u.scope_chain.slot[i].value = *value;
+            crb_write_barrier(inter, sc, value);
+            return &sc->u.scope_chain.slot[i].value;
+        }
+    }
+    if (sc->u.scope_chain.frame == NULL) {
+        frame.type = CRB_ASSOC_VALUE;
+        frame.u.object = crb_create_assoc_i(inter);
+        sc->u.scope_chain.frame = frame.u.object;
+        crb_write_barrier(inter, sc, &frame);
+    }
+    ret = crb_add_assoc_member_i(inter, sc->u.scope_chain.frame,
+                                 identifier, value, is_final);
+    crb_variable_added(inter, identifier);
 
     return ret;
 }
 
+/*
+ * Adds a local variable for an identifier which was not found.
+ */
+CRB_Value *
+crb_define_local_variable(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                          IdentifierExpression *identifier, CRB_Value *value,
+                          CRB_Boolean is_final)
+{
+    Slot *slot;
+
+    if (identifier->depth != 0) {
+        return CRB_add_local_variable(inter, env, identifier->name, value,
+                                      is_final);
+    }
+    slot = &env->variable->u.scope_chain.slot[identifier->index];
+    slot->is_defined = CRB_TRUE;
+    slot->is_final = is_final;
+    slot->value = *value;
+    crb_write_barrier(inter, env->variable, value);
+
+    return &slot->value;
+}
+
 CRB_Value *
 CRB_add_global_variable(CRB_Interpreter *inter, char *identifier,
                         CRB_Value *value, CRB_Boolean is_final)
@@ -180,11 +388,11 @@ CRB_add_global_variable(CRB_Interpreter *inter, char *identifier,
 
     new_variable = crb_execute_malloc(inter, sizeof(Variable));
     new_variable->is_final = is_final;
-    new_variable->name = crb_execute_malloc(inter, strlen(identifier) + 1);
-    strcpy(new_variable->name, identifier);
+    new_variable->name = CRB_intern(inter, identifier);
     new_variable->next = inter->variable;
     inter->variable = new_variable;
     new_variable->value = *value;
+    crb_variable_added(inter, new_variable->name);
 
     return &new_variable->value;
 }
@@ -262,6 +470,7 @@ crb_get_operator_string(ExpressionType type)
     case INCREMENT_EXPRESSION:  /* FALLTHRU */
     case DECREMENT_EXPRESSION:  /* FALLTHRU */
     case CLOSURE_EXPRESSION:    /* FALLTHRU */
+    case INLINE_PARAMETER_EXPRESSION:   /* FALLTHRU */
     case EXPRESSION_TYPE_COUNT_PLUS_1:  /* FALLTHRU */
     default:
         DBG_assert(0, ("bad expression type..%d\n", type));
@@ -436,7 +645,7 @@ CRB_value_to_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
     case CRB_ASSOC_VALUE:
         CRB_mbstowcs("(", wc_buf);
         crb_vstr_append_string(&vstr, wc_buf);
-        for (i = 0; i < value->u.object->u.assoc.member_count; i++) {
+        for (i = 0; i < value->u.object->u.assoc.shape->member_count; i++) {
             CRB_Char *new_str;
             if (i > 0) {
                 CRB_mbstowcs(", ", wc_buf);
@@ -444,7 +653,8 @@ CRB_value_to_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             }
             new_str
                 = CRB_mbstowcs_alloc(inter, env, line_number,
-                                     value->u.object->u.assoc.member[i].name);
+                                     value->u.object->u.assoc.shape
+                                     ->member_name[i]);
             DBG_assert(new_str != NULL, ("new_str is null.\n"));
             crb_vstr_append_string(&vstr, new_str);
             MEM_free(new_str);
@@ -453,7 +663,7 @@ CRB_value_to_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
             crb_vstr_append_string(&vstr, wc_buf);
             new_str = CRB_value_to_string(inter, env, line_number,
                                           &value->u.object
-                                          ->u.assoc.member[i].value);
+                                          ->u.assoc.value[i]);
             crb_vstr_append_string(&vstr, new_str);
             MEM_free(new_str);
         }
@@ -0,0 +1,517 @@
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+#define STACK_TOP(inter) \
+  (&(inter)->stack.stack[(inter)->stack.stack_pointer - 1])
+
+/*
+ * The space for need_stack_size values is reserved on entry,
+ * so pushes in the loop need no check.
+ */
+static void
+push(CRB_Interpreter *inter, CRB_Value *value)
+{
+    inter->stack.stack[inter->stack.stack_pointer] = *value;
+    inter->stack.stack_pointer++;
+}
+
+static void
+ensure_stack_size(CRB_Interpreter *inter, int need_stack_size)
+{
+    if (inter->stack.stack_pointer + need_stack_size
+        > inter->stack.stack_alloc_size) {
+        inter->stack.stack_alloc_size
+            = inter->stack.stack_pointer + need_stack_size + STACK_ALLOC_SIZE;
+        inter->stack.stack
+            = MEM_realloc(inter->stack.stack,
+                          sizeof(CRB_Value) * inter->stack.stack_alloc_size);
+    }
+}
+
+static void
+new_array(CRB_Interpreter *inter, int size)
+{
+    CRB_Value   v;
+    int         i;
+
+    v.type = CRB_ARRAY_VALUE;
+    v.u.object = crb_create_array_i(inter, size);
+    for (i = 0; i < size; i++) {
+        v.u.object->u.array.array[i]
+            = inter->stack.stack[inter->stack.stack_pointer - size + i];
+    }
+    inter->stack.stack_pointer -= size;
+    push(inter, &v);
+}
+
+/*
+ * Maps the quickening of a binary expression to its opcode.
+ */
+OpCode
+crb_binary_opcode(Expression *expr)
+{
+    switch (expr->u.binary_expression.quickening) {
+    case BINARY_INT_INT:
+        return BINARY_INT_OP;
+    case BINARY_DOUBLE_DOUBLE:
+        return BINARY_DOUBLE_OP;
+    case BINARY_STRING_CONCAT:
+        return CONCAT_STRING_OP;
+    case BINARY_NOT_QUICKENED:  /* FALLTHRU */
+    case BINARY_GENERIC:
+        break;
+    default:
+        DBG_assert(0, ("bad case..%d\n",
+                       expr->u.binary_expression.quickening));
+    }
+    return ADD_OP + (expr->type - ADD_EXPRESSION);
+}
+
+static StatementResult
+execute_code(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+             CRB_Executable *exe, volatile int *pc_p)
+{
+    Code        *code = exe->code;
+    int         pc = *pc_p;
+    CRB_Value   v;
+    CRB_Value   *vp;
+    CRB_Object  *obj;
+    Expression  *expr;
+    Statement   *statement;
+    StatementResult result;
+
+    for (;;) {
+        *pc_p = pc;
+        switch (code[pc].opcode) {
+        case PUSH_BOOLEAN_OP:
+            v.type = CRB_BOOLEAN_VALUE;
+            v.u.boolean_value = code[pc+1].int_value;
+            push(inter, &v);
+            pc += 2;
+            break;
+        case PUSH_INT_OP:
+            v.type = CRB_INT_VALUE;
+            v.u.int_value = code[pc+1].int_value;
+            push(inter, &v);
+            pc += 2;
+            break;
+        case PUSH_DOUBLE_OP:
+            v.type = CRB_DOUBLE_VALUE;
+            v.u.double_value = code[pc+1].double_value;
+            push(inter, &v);
+            pc += 2;
+            break;
+        case PUSH_STRING_OP:
+            v.type = CRB_STRING_VALUE;
+            v.u.object = crb_literal_to_crb_string_i(inter,
+                                                     code[pc+1].pointer);
+            push(inter, &v);
+            pc += 2;
+            break;
+        case PUSH_REGEXP_OP:
+            v.type = CRB_NATIVE_POINTER_VALUE;
+            v.u.object = crb_create_native_pointer_i(inter,
+                                                     code[pc+1].pointer,
+                                                     crb_get_regexp_info());
+            push(inter, &v);
+            pc += 2;
+            break;
+        case PUSH_NULL_OP:
+            v.type = CRB_NULL_VALUE;
+            push(inter, &v);
+            pc++;
+            break;
+        case PUSH_IDENTIFIER_OP:
+            crb_eval_identifier(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case PUSH_CLOSURE_OP:
+            v.type = CRB_CLOSURE_VALUE;
+            v.u.closure.function = code[pc+1].pointer;
+            v.u.closure.environment = env ? env->variable : NULL;
+            if (env) {
+                crb_capture_scope_chain(inter, env->variable);
+            }
+            push(inter, &v);
+            pc += 2;
+            break;
+        case POP_OP:
+            inter->stack.stack_pointer -= code[pc+1].int_value;
+            pc += 2;
+            break;
+        case ASSIGN_IDENTIFIER_OP:
+            crb_assign_to_identifier(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case ASSIGN_MEMBER_OP:
+            crb_assign_to_member(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case ASSIGN_INDEX_OP:
+            crb_assign_to_array_element(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case NOT_LVALUE_OP:
+            expr = code[pc+1].pointer;
+            crb_runtime_error(inter, env, expr->line_number, NOT_LVALUE_ERR,
+                              CRB_MESSAGE_ARGUMENT_END);
+            break;
+        case ADD_OP:    /* FALLTHRU */
+        case SUB_OP:    /* FALLTHRU */
+        case MUL_OP:    /* FALLTHRU */
+        case DIV_OP:    /* FALLTHRU */
+        case MOD_OP:    /* FALLTHRU */
+        case EQ_OP:     /* FALLTHRU */
+        case NE_OP:     /* FALLTHRU */
+        case GT_OP:     /* FALLTHRU */
+        case GE_OP:     /* FALLTHRU */
+        case LT_OP:     /* FALLTHRU */
+        case LE_OP:
+            expr = code[pc+1].pointer;
+            if (expr->u.binary_expression.quickening
+                == BINARY_NOT_QUICKENED) {
+                crb_quicken_binary_expression(inter, expr);
+            }
+            if (crb_binary_opcode(expr) != code[pc].opcode) {
+                code[pc].opcode = crb_binary_opcode(expr);
+                break;
+            }
+            crb_binary_operation(inter, env, expr->type,
+                                 expr->u.binary_expression.left,
+                                 expr->u.binary_expression.right);
+            pc += 2;
+            break;
+        case BINARY_INT_OP:
+            expr = code[pc+1].pointer;
+            if (!crb_binary_int_operation(inter, env, expr)) {
+                expr->u.binary_expression.quickening = BINARY_GENERIC;
+                code[pc].opcode = crb_binary_opcode(expr);
+                break;
+            }
+            pc += 2;
+            break;
+        case BINARY_DOUBLE_OP:
+            expr = code[pc+1].pointer;
+            if (!crb_binary_double_operation(inter, env, expr)) {
+                expr->u.binary_expression.quickening = BINARY_GENERIC;
+                code[pc].opcode = crb_binary_opcode(expr);
+                break;
+            }
+            pc += 2;
+            break;
+        case ARRAY_SIZE_OP:
+            crb_array_size_operation(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case CONCAT_STRING_OP:
+            expr = code[pc+1].pointer;
+            if (!crb_concat_string_operation(inter, env, expr)) {
+                expr->u.binary_expression.quickening = BINARY_GENERIC;
+                code[pc].opcode = crb_binary_opcode(expr);
+                break;
+            }
+            pc += 2;
+            break;
+        case LOGICAL_AND_OP:    /* FALLTHRU */
+        case LOGICAL_OR_OP:
+            expr = code[pc+1].pointer;
+            vp = STACK_TOP(inter);
+            if (vp->type != CRB_BOOLEAN_VALUE) {
+                crb_runtime_error(inter, env, expr->line_number,
+                                  NOT_BOOLEAN_TYPE_ERR,
+                                  CRB_MESSAGE_ARGUMENT_END);
+            }
+            if ((code[pc].opcode == LOGICAL_AND_OP)
+                != (vp->u.boolean_value != CRB_FALSE)) {
+                /* the left operand is the result */
+                pc = code[pc+2].int_value;
+            } else {
+                inter->stack.stack_pointer--;
+                pc += 3;
+            }
+            break;
+        case LOGICAL_RESULT_OP:
+            STACK_TOP(inter)->type = CRB_BOOLEAN_VALUE;
+            pc++;
+            break;
+        case MINUS_OP:
+            crb_minus_operation(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case LOGICAL_NOT_OP:
+            crb_logical_not_operation(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case CALL_OP:
+            expr = code[pc+1].pointer;
+            crb_call_function_expression(inter, env, expr,
+                                         code[pc+2].int_value);
+            pc += 3;
+            break;
+        case INLINE_ENTER_OP:
+            expr = code[pc+1].pointer;
+            if (crb_enter_inline_function(inter, env, expr,
+                                          code[pc+2].int_value)) {
+                pc += 4;
+            } else {
+                crb_call_function_expression(inter, env, expr,
+                                             code[pc+2].int_value);
+                pc = code[pc+3].int_value;
+            }
+            break;
+        case INLINE_PARAMETER_OP:
+            crb_inline_parameter(inter, code[pc+1].int_value);
+            pc += 2;
+            break;
+        case INLINE_LEAVE_OP:
+            crb_leave_inline_function(inter, code[pc+1].int_value);
+            pc += 2;
+            break;
+        case MEMBER_OP:
+            crb_member_operation(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case INDEX_OP:
+            vp = crb_get_array_element_lvalue(inter, env, code[pc+1].pointer);
+            push(inter, vp);
+            pc += 2;
+            break;
+        case NEW_ARRAY_OP:
+            new_array(inter, code[pc+1].int_value);
+            pc += 2;
+            break;
+        case INC_DEC_IDENTIFIER_OP:
+            expr = code[pc+1].pointer;
+            vp = crb_get_identifier_lvalue(inter, env,
+                                           expr->u.inc_dec.operand
+                                           ->line_number,
+                                           &expr->u.inc_dec.operand
+                                           ->u.identifier);
+            crb_inc_dec_operation(inter, env, expr, vp);
+            pc += 2;
+            break;
+        case INC_DEC_LOCAL_INT_OP:
+            crb_inc_dec_local_int_operation(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case INC_DEC_MEMBER_OP:
+            expr = code[pc+1].pointer;
+            vp = crb_get_member_lvalue(inter, env, expr->u.inc_dec.operand);
+            crb_inc_dec_operation(inter, env, expr, vp);
+            pc += 2;
+            break;
+        case INC_DEC_INDEX_OP:
+            expr = code[pc+1].pointer;
+            vp = crb_get_array_element_lvalue(inter, env,
+                                              expr->u.inc_dec.operand);
+            crb_inc_dec_operation(inter, env, expr, vp);
+            pc += 2;
+            break;
+        case JUMP_OP:
+            pc = code[pc+1].int_value;
+            break;
+        case JUMP_IF_FALSE_OP:
+            expr = code[pc+1].pointer;
+            vp = STACK_TOP(inter);
+            if (vp->type != CRB_BOOLEAN_VALUE) {
+                crb_runtime_error(inter, env, expr->line_number,
+                                  NOT_BOOLEAN_TYPE_ERR,
+                                  CRB_MESSAGE_ARGUMENT_END);
+            }
+            inter->stack.stack_pointer--;
+            if (vp->u.boolean_value) {
+                pc += 3;
+            } else {
+                pc = code[pc+2].int_value;
+            }
+            break;
+        case GLOBAL_OP:
+            crb_execute_global_statement(inter, env, code[pc+1].pointer);
+            pc += 2;
+            break;
+        case FOREACH_ITERATOR_OP:
+            statement = code[pc+1].pointer;
+            if (crb_is_native_iterable(STACK_TOP(inter))) {
+                v.type = CRB_INT_VALUE;
+                v.u.int_value = 0;
+                push(inter, &v);
+                pc += 2;
+                break;
+            }
+            obj = STACK_TOP(inter)->u.object;
+            v = CRB_call_method(inter, env, statement->line_number,
+                                obj, ITERATOR_METHOD_NAME, 0, NULL);
+            push(inter, &v);
+            pc += 2;
+            break;
+        case FOREACH_INIT_OP:
+            statement = code[pc+1].pointer;
+            v.type = CRB_NULL_VALUE;
+            crb_assign_to_variable(inter, env, statement->line_number,
+                                   &statement->u.foreach_s.variable, &v);
+            pc += 2;
+            break;
+        case FOREACH_IS_DONE_OP:
+            statement = code[pc+1].pointer;
+            if (crb_is_native_iterable(STACK_TOP(inter) - 1)) {
+                if (crb_foreach_is_done((STACK_TOP(inter) - 1)->u.object,
+                                        STACK_TOP(inter)->u.int_value)) {
+                    pc = code[pc+2].int_value;
+                } else {
+                    pc += 3;
+                }
+                break;
+            }
+            obj = STACK_TOP(inter)->u.object;
+            v = CRB_call_method(inter, env, statement->line_number,
+                                obj, IS_DONE_METHOD_NAME, 0, NULL);
+            if (v.type != CRB_BOOLEAN_VALUE) {
+                crb_runtime_error(inter, env, statement->line_number,
+                                  NOT_BOOLEAN_TYPE_ERR,
+                                  CRB_MESSAGE_ARGUMENT_END);
+            }
+            if (v.u.boolean_value) {
+                pc = code[pc+2].int_value;
+            } else {
+                pc += 3;
+            }
+            break;
+        case FOREACH_CURRENT_ITEM_OP:
+            statement = code[pc+1].pointer;
+            if (crb_is_native_iterable(STACK_TOP(inter) - 1)) {
+                crb_foreach_current_item(inter,
+                                         (STACK_TOP(inter) - 1)->u.object,
+                                         STACK_TOP(inter)->u.int_value, &v);
+            } else {
+                obj = STACK_TOP(inter)->u.object;
+                v = CRB_call_method(inter, env, statement->line_number,
+                                    obj, CURRENT_ITEM_METHOD_NAME, 0, NULL);
+            }
+            crb_assign_to_variable(inter, env, statement->line_number,
+                                   &statement->u.foreach_s.variable, &v);
+            pc += 2;
+            break;
+        case FOREACH_NEXT_OP:
+            statement = code[pc+1].pointer;
+            if (crb_is_native_iterable(STACK_TOP(inter) - 1)) {
+                STACK_TOP(inter)->u.int_value++;
+                pc += 2;
+                break;
+            }
+            obj = STACK_TOP(inter)->u.object;
+            CRB_call_method(inter, env, statement->line_number,
+                            obj, NEXT_METHOD_NAME, 0, NULL);
+            pc += 2;
+            break;
+        case CATCH_OP:
+            statement = code[pc+1].pointer;
+            v = inter->current_exception;
+            push(inter, &v);
+            inter->current_exception.type = CRB_NULL_VALUE;
+            crb_assign_to_variable(inter, env, statement->line_number,
+                                   &statement->u.try_s.exception, &v);
+            pc += 2;
+            break;
+        case RETHROW_OP:
+            if (inter->current_exception.type != CRB_NULL_VALUE) {
+                longjmp(inter->current_recovery_environment.environment,
+                        LONGJMP_ARG);
+            }
+            pc++;
+            break;
+        case THROW_OP:
+            inter->current_exception = *STACK_TOP(inter);
+            inter->stack.stack_pointer--;
+            longjmp(inter->current_recovery_environment.environment,
+                    LONGJMP_ARG);
+            break;
+        case RETURN_OP:
+            result.type = RETURN_STATEMENT_RESULT;
+            result.u.return_value = *STACK_TOP(inter);
+            return result;
+        case TAIL_CALL_OP:
+            result.type = TAIL_CALL_STATEMENT_RESULT;
+            result.u.tail_call.expression = code[pc+1].pointer;
+            result.u.tail_call.argument_count = code[pc+2].int_value;
+            return result;
+        case LEAVE_OP:
+            result.type = code[pc+1].int_value;
+            result.u.label = NULL;
+            return result;
+        case OPCODE_COUNT_PLUS_1:       /* FALLTHRU */
+        default:
+            DBG_assert(0, ("bad case..%d\n", code[pc].opcode));
+        }
+    }
+}
+
+static TryRegion *
+search_try_region(CRB_Executable *exe, int pc)
+{
+    int i;
+
+    /* inner regions come first. */
+    for (i = 0; i < exe->try_region_count; i++) {
+        if (pc >= exe->try_region[i].start_pc
+            && pc < exe->try_region[i].end_pc) {
+            return &exe->try_region[i];
+        }
+    }
+    return NULL;
+}
+
+StatementResult
+crb_execute_byte_code(CRB_Interpreter *inter, CRB_LocalEnvironment *env,
+                      CRB_Executable *exe)
+{
+    volatile int pc = 0;
+    int base;
+    int size;
+    int inline_frame_backup;
+    CRB_LocalEnvironment *top_env_backup;
+    RecoveryEnvironment env_backup;
+    TryRegion *region;
+    StatementResult result;
+
+    base = inter->stack.stack_pointer;
+    ensure_stack_size(inter, exe->need_stack_size);
+
+    if (exe->try_region_count == 0) {
+        result = execute_code(inter, env, exe, &pc);
+    } else {
+        top_env_backup = inter->top_environment;
+        inline_frame_backup = inter->inline_frame.frame_count;
+        env_backup = inter->current_recovery_environment;
+        for (;;) {
+            if (setjmp(inter->current_recovery_environment.environment)
+                == 0) {
+                result = execute_code(inter, env, exe, &pc);
+                break;
+            }
+            crb_unwind_local_environment(inter, top_env_backup);
+            inter->inline_frame.frame_count = inline_frame_backup;
+            region = search_try_region(exe, pc);
+            if (region == NULL) {
+                inter->current_recovery_environment = env_backup;
+                longjmp(env_backup.environment, LONGJMP_ARG);
+            }
+            inter->stack.stack_pointer = base + region->stack_depth;
+            pc = region->handler_pc;
+        }
+        inter->current_recovery_environment = env_backup;
+    }
+    if (result.type == TAIL_CALL_STATEMENT_RESULT) {
+        /* the function and the arguments of the call stay at base. */
+        size = result.u.tail_call.argument_count + 1;
+        memmove(&inter->stack.stack[base],
+                &inter->stack.stack[inter->stack.stack_pointer - size],
+                sizeof(CRB_Value) * size);
+        inter->stack.stack_pointer = base + size;
+    } else {
+        inter->stack.stack_pointer = base;
+    }
+
+    return result;
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include "CRB.h"
+#include "CRB_dev.h"
+#include "MEM.h"
+
+/*
+ * Runs a file with the given GC pause budget in microseconds.
+ * 0 collects the whole heap at once, anything else marks and
+ * sweeps in slices. The output must not depend on it.
+ */
+int
+main(int argc, char **argv)
+{
+    CRB_Interpreter     *interpreter;
+    FILE *fp;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage:%s budget filename", argv[0]);
+        exit(1);
+    }
+
+    fp = fopen(argv[2], "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s not found.\n", argv[2]);
+        exit(1);
+    }
+
+    setlocale(LC_CTYPE, "");
+    interpreter = CRB_create_interpreter();
+    CRB_set_gc_pause_budget(interpreter, atol(argv[1]));
+    CRB_compile(interpreter, fp);
+    CRB_interpret(interpreter);
+    CRB_dispose_interpreter(interpreter);
+
+    MEM_dump_blocks(stdout);
+
+    return 0;
+}
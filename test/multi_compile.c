@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include "CRB.h"
+#include "MEM.h"
+
+/*
+ * Compiles each file in turn into one interpreter and runs them,
+ * as an embedding application may do.
+ */
+int
+main(int argc, char **argv)
+{
+    CRB_Interpreter     *interpreter;
+    FILE *fp;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage:%s filename ...", argv[0]);
+        exit(1);
+    }
+
+    setlocale(LC_CTYPE, "");
+    interpreter = CRB_create_interpreter();
+    for (i = 1; i < argc; i++) {
+        fp = fopen(argv[i], "r");
+        if (fp == NULL) {
+            fprintf(stderr, "%s not found.\n", argv[i]);
+            exit(1);
+        }
+        CRB_compile(interpreter, fp);
+        fclose(fp);
+    }
+    CRB_interpret(interpreter);
+    CRB_dispose_interpreter(interpreter);
+
+    MEM_dump_blocks(stdout);
+
+    return 0;
+}